@@ -0,0 +1,374 @@
+#include "alog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#define ALOG_RING_SIZE 512          /* records per producer thread, power of two */
+#define ALOG_MAX_ARGS 12
+#define ALOG_STR_BYTES 112
+#define ALOG_LINE_MAX 512
+#define ALOG_IDLE_SLEEP_NS 2000000  /* consumer poll interval while every ring is empty */
+
+typedef union {
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+    uint16_t str_off;
+} alog_arg_t;
+
+/* Binary record: the format literal's address is the format id; arguments are captured
+   raw and %s strings copied inline, so formatting happens later on the logger thread. */
+typedef struct {
+    const char *fmt;
+    const char *file;
+    uint32_t line;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t str_len;
+    alog_arg_t args[ALOG_MAX_ARGS];
+    char strs[ALOG_STR_BYTES];
+} alog_record_t;
+
+/* Single-producer (owning thread) / single-consumer (logger thread) ring. */
+typedef struct alog_ring {
+    alog_record_t records[ALOG_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    struct alog_ring *next;
+} alog_ring_t;
+
+int alog_level = LOG_TRACE;
+
+static __thread alog_ring_t *t_ring;
+static alog_ring_t *s_rings;
+static pthread_mutex_t s_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t s_thread;
+static bool s_running;
+static bool s_stop;
+static uint64_t s_dropped;
+static uint64_t s_dropped_reported;
+
+typedef enum {
+    SPEC_NONE,
+    SPEC_INT,
+    SPEC_UINT,
+    SPEC_CHAR,
+    SPEC_DOUBLE,
+    SPEC_STRING,
+    SPEC_POINTER,
+    SPEC_PERCENT
+} spec_kind_t;
+
+typedef struct {
+    const char *start;
+    const char *end;
+    spec_kind_t kind;
+    int star_count;
+    char length[3];
+    char conv;
+} spec_t;
+
+/* Parses one conversion starting at '%'; returns false on a malformed spec. */
+static bool parse_spec(const char *p, spec_t *spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+    if (*p == '%') {
+        spec->kind = SPEC_PERCENT;
+        spec->end = p + 1;
+        return true;
+    }
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') { spec->star_count++; p++; } else { while (*p >= '0' && *p <= '9') p++; }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') { spec->star_count++; p++; } else { while (*p >= '0' && *p <= '9') p++; }
+    }
+    int n = 0;
+    while (*p && strchr("hljztLq", *p) && n < 2) spec->length[n++] = *p++;
+    spec->conv = *p;
+    switch (*p) {
+        case 'd': case 'i': spec->kind = SPEC_INT; break;
+        case 'u': case 'o': case 'x': case 'X': spec->kind = SPEC_UINT; break;
+        case 'c': spec->kind = SPEC_CHAR; break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = SPEC_DOUBLE; break;
+        case 's': spec->kind = SPEC_STRING; break;
+        case 'p': spec->kind = SPEC_POINTER; break;
+        default: return false;
+    }
+    spec->end = p + 1;
+    return true;
+}
+
+static alog_ring_t *thread_ring(void) {
+    if (t_ring == NULL) {
+        alog_ring_t *r = calloc(1, sizeof(*r));
+        if (r == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&s_rings_lock);
+        r->next = s_rings;
+        s_rings = r;
+        pthread_mutex_unlock(&s_rings_lock);
+        t_ring = r;
+    }
+    return t_ring;
+}
+
+static void capture_args(alog_record_t *rec, va_list ap) {
+    const char *p = rec->fmt;
+    spec_t spec;
+
+    rec->nargs = 0;
+    rec->str_len = 0;
+    while ((p = strchr(p, '%')) != NULL) {
+        if (!parse_spec(p, &spec)) {
+            break;
+        }
+        p = spec.end;
+        if (spec.kind == SPEC_PERCENT) {
+            continue;
+        }
+        if (rec->nargs + spec.star_count + 1 > ALOG_MAX_ARGS) {
+            break;
+        }
+        for (int i = 0; i < spec.star_count; i++) {
+            rec->args[rec->nargs++].i = va_arg(ap, int);
+        }
+
+        alog_arg_t *a = &rec->args[rec->nargs++];
+        bool ll = spec.length[0] == 'l' && spec.length[1] == 'l';
+        switch (spec.kind) {
+            case SPEC_INT:
+                if (ll || spec.length[0] == 'j' || spec.length[0] == 'q') a->i = va_arg(ap, long long);
+                else if (spec.length[0] == 'l') a->i = va_arg(ap, long);
+                else if (spec.length[0] == 'z') a->i = va_arg(ap, ssize_t);
+                else if (spec.length[0] == 't') a->i = va_arg(ap, ptrdiff_t);
+                else if (spec.length[0] == 'h' && spec.length[1] == 'h') a->i = (signed char)va_arg(ap, int);
+                else if (spec.length[0] == 'h') a->i = (short)va_arg(ap, int);
+                else a->i = va_arg(ap, int);
+                break;
+            case SPEC_UINT:
+                if (ll || spec.length[0] == 'j' || spec.length[0] == 'q') a->u = va_arg(ap, unsigned long long);
+                else if (spec.length[0] == 'l') a->u = va_arg(ap, unsigned long);
+                else if (spec.length[0] == 'z') a->u = va_arg(ap, size_t);
+                else if (spec.length[0] == 't') a->u = (unsigned long long)va_arg(ap, ptrdiff_t);
+                else if (spec.length[0] == 'h' && spec.length[1] == 'h') a->u = (unsigned char)va_arg(ap, unsigned);
+                else if (spec.length[0] == 'h') a->u = (unsigned short)va_arg(ap, unsigned);
+                else a->u = va_arg(ap, unsigned);
+                break;
+            case SPEC_CHAR:
+                a->i = va_arg(ap, int);
+                break;
+            case SPEC_DOUBLE:
+                a->d = spec.length[0] == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+                break;
+            case SPEC_STRING: {
+                const char *s = va_arg(ap, const char *);
+                if (s == NULL) s = "(null)";
+                size_t room = ALOG_STR_BYTES - rec->str_len;
+                size_t n = strlen(s);
+                if (room == 0) {
+                    a->str_off = ALOG_STR_BYTES - 1;
+                    break;
+                }
+                if (n >= room) n = room - 1;
+                memcpy(rec->strs + rec->str_len, s, n);
+                rec->strs[rec->str_len + n] = '\0';
+                a->str_off = rec->str_len;
+                rec->str_len = (uint16_t)(rec->str_len + n + 1);
+                break;
+            }
+            case SPEC_POINTER:
+                a->p = va_arg(ap, void *);
+                break;
+            default:
+                break;
+        }
+    }
+    rec->strs[ALOG_STR_BYTES - 1] = '\0';
+}
+
+static void format_record(const alog_record_t *rec, char *out, size_t out_len) {
+    const char *p = rec->fmt;
+    size_t o = 0;
+    int argi = 0;
+    spec_t spec;
+
+    out[0] = '\0';
+    while (*p && o + 1 < out_len) {
+        if (*p != '%') {
+            out[o++] = *p++;
+            continue;
+        }
+        if (!parse_spec(p, &spec)) {
+            break;
+        }
+        p = spec.end;
+        if (spec.kind == SPEC_PERCENT) {
+            out[o++] = '%';
+            continue;
+        }
+        if (argi + spec.star_count + 1 > rec->nargs) {
+            /* More conversions than ALOG_MAX_ARGS: show that the line was cut short. */
+            snprintf(out + o, out_len - o, "...");
+            return;
+        }
+
+        /* Rebuild the spec with a length modifier matching how the argument was stored. */
+        char fmt[32];
+        size_t flen = (size_t)(spec.end - spec.start) - strlen(spec.length) - 1;
+        if (flen >= sizeof(fmt) - 4) flen = sizeof(fmt) - 4;
+        memcpy(fmt, spec.start, flen);
+        fmt[flen] = '\0';
+        if (spec.kind == SPEC_INT || spec.kind == SPEC_UINT) {
+            strcat(fmt, "ll");
+        }
+        size_t l = strlen(fmt);
+        fmt[l] = spec.conv;
+        fmt[l + 1] = '\0';
+
+        int star[2] = {0, 0};
+        for (int i = 0; i < spec.star_count; i++) {
+            star[i] = (int)rec->args[argi++].i;
+        }
+        const alog_arg_t *a = &rec->args[argi++];
+        char *dst = out + o;
+        size_t room = out_len - o;
+        int n = 0;
+
+#define ALOG_EMIT(value) \
+        (spec.star_count == 2 ? snprintf(dst, room, fmt, star[0], star[1], value) : \
+         spec.star_count == 1 ? snprintf(dst, room, fmt, star[0], value) : snprintf(dst, room, fmt, value))
+        switch (spec.kind) {
+            case SPEC_INT: n = ALOG_EMIT(a->i); break;
+            case SPEC_UINT: n = ALOG_EMIT(a->u); break;
+            case SPEC_CHAR: n = ALOG_EMIT((int)a->i); break;
+            case SPEC_DOUBLE: n = ALOG_EMIT(a->d); break;
+            case SPEC_STRING: n = ALOG_EMIT(rec->strs + a->str_off); break;
+            case SPEC_POINTER: n = ALOG_EMIT(a->p); break;
+            default: break;
+        }
+#undef ALOG_EMIT
+        if (n < 0) break;
+        o += (size_t)n < room ? (size_t)n : room - 1;
+    }
+    out[o] = '\0';
+}
+
+static bool drain_once(void) {
+    char line[ALOG_LINE_MAX];
+    bool any = false;
+
+    pthread_mutex_lock(&s_rings_lock);
+    alog_ring_t *rings = s_rings;
+    pthread_mutex_unlock(&s_rings_lock);
+
+    for (alog_ring_t *r = rings; r != NULL; r = r->next) {
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = r->tail;
+        while (tail != head) {
+            const alog_record_t *rec = &r->records[tail & (ALOG_RING_SIZE - 1)];
+            format_record(rec, line, sizeof(line));
+            log_log(rec->level, rec->file, (int)rec->line, "%s", line);
+            tail++;
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+            any = true;
+        }
+    }
+
+    uint64_t dropped = __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+    if (dropped != s_dropped_reported) {
+        log_log(LOG_WARN, __FILE__, __LINE__, "alog: %llu log records dropped (ring full), %llu total",
+                (unsigned long long)(dropped - s_dropped_reported), (unsigned long long)dropped);
+        s_dropped_reported = dropped;
+    }
+    return any;
+}
+
+static void *logger_thread(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, ALOG_IDLE_SLEEP_NS };
+    while (!__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) {
+        if (!drain_once()) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_once();
+    return NULL;
+}
+
+void alog_write(int level, const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+
+    if (!s_running) {
+        /* Before alog_init (or in tools that never start it) behave like plain log.c. */
+        char buf[ALOG_LINE_MAX];
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        log_log(level, file, line, "%s", buf);
+        return;
+    }
+
+    alog_ring_t *r = thread_ring();
+    if (r == NULL) {
+        __atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint32_t head = r->head;
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= ALOG_RING_SIZE) {
+        __atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    alog_record_t *rec = &r->records[head & (ALOG_RING_SIZE - 1)];
+    rec->fmt = fmt;
+    rec->file = file;
+    rec->line = (uint32_t)line;
+    rec->level = (uint8_t)level;
+    va_start(ap, fmt);
+    capture_args(rec, ap);
+    va_end(ap);
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void alog_set_level(int level) {
+    alog_level = level;
+    log_set_level(level);
+}
+
+bool alog_init(void) {
+    if (s_running) {
+        return true;
+    }
+    s_stop = false;
+    if (pthread_create(&s_thread, NULL, logger_thread, NULL) != 0) {
+        log_error("alog: cannot start logger thread, logging synchronously");
+        return false;
+    }
+    s_running = true;
+    return true;
+}
+
+uint64_t alog_dropped(void) {
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+void alog_shutdown(void) {
+    if (!s_running) {
+        return;
+    }
+    __atomic_store_n(&s_stop, true, __ATOMIC_RELEASE);
+    pthread_join(s_thread, NULL);
+    s_running = false;
+}
@@ -0,0 +1,54 @@
+#ifndef ALOG_H
+#define ALOG_H
+
+/*
+ * Asynchronous front end for log.c. Include this instead of log.h: the log_* macros
+ * below capture the format id and raw arguments into a per-thread lock-free ring and a
+ * background thread formats them and hands the text to log.c.
+ *
+ * ALOG_MIN_LEVEL removes calls below it at compile time (release builds: -DNDEBUG or
+ * -DALOG_MIN_LEVEL=LOG_INFO); alog_level filters at run time before anything is queued.
+ */
+
+#include "log.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ALOG_MIN_LEVEL
+#ifdef NDEBUG
+#define ALOG_MIN_LEVEL LOG_INFO
+#else
+#define ALOG_MIN_LEVEL LOG_TRACE
+#endif
+#endif
+
+extern int alog_level;
+
+bool alog_init(void);
+void alog_set_level(int level);
+void alog_write(int level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+uint64_t alog_dropped(void);
+void alog_shutdown(void);
+
+#define ALOG_AT(level, ...) \
+    do { \
+        if ((level) >= ALOG_MIN_LEVEL && (level) >= alog_level) { \
+            alog_write((level), __FILE__, __LINE__, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#undef log_trace
+#undef log_debug
+#undef log_info
+#undef log_warn
+#undef log_error
+#undef log_fatal
+#define log_trace(...) ALOG_AT(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) ALOG_AT(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  ALOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_warn(...)  ALOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_error(...) ALOG_AT(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) ALOG_AT(LOG_FATAL, __VA_ARGS__)
+
+#endif /* ALOG_H */
@@ -0,0 +1,59 @@
+#include "blink.h"
+
+static uint64_t s_reference_ns;
+
+/* Period boundaries fall on ref + k * period. The default reference is timebase zero, which
+   is shared by every zone in the process. With clock sync the reference is the local time at
+   which the shared clock read zero; it may lie "before" zero, so the subtraction below is
+   modulo 2^64 and yields the shared clock reading. */
+void blink_set_reference(uint64_t ref_ns) {
+    s_reference_ns = ref_ns;
+}
+
+static uint64_t phase(const blink_t *b, uint64_t now_ns) {
+    return (now_ns - s_reference_ns) % b->period_ns;
+}
+
+/* A counted blink starts with the current period if its lit part is still running, else with
+   the next one, so exactly `count` flashes are shown. */
+void blink_start(blink_t *b, uint32_t period_ms, float duty, uint32_t count, uint64_t now_ns) {
+    if (period_ms == 0 || !(duty > 0.0f)) {
+        blink_stop(b);
+        return;
+    }
+    if (duty > 1.0f) {
+        duty = 1.0f;
+    }
+    b->period_ns = (uint64_t)period_ms * 1000000u;
+    b->on_ns = (uint64_t)((double)b->period_ns * duty);
+    b->end_ns = 0;
+    if (count > 0) {
+        uint64_t p = phase(b, now_ns);
+        uint64_t start = now_ns - p + (p < b->on_ns ? 0 : b->period_ns);
+        b->end_ns = start + (uint64_t)count * b->period_ns;
+    }
+}
+
+void blink_stop(blink_t *b) {
+    b->period_ns = 0;
+    b->on_ns = 0;
+    b->end_ns = 0;
+}
+
+bool blink_active(const blink_t *b, uint64_t now_ns) {
+    return b->period_ns != 0 && (b->end_ns == 0 || now_ns < b->end_ns);
+}
+
+bool blink_lit(const blink_t *b, uint64_t now_ns) {
+    return !blink_active(b, now_ns) || phase(b, now_ns) < b->on_ns;
+}
+
+/* When the output next switches, or 0 if it never will. */
+uint64_t blink_next_edge_ns(const blink_t *b, uint64_t now_ns) {
+    if (!blink_active(b, now_ns)) {
+        return 0;
+    }
+    uint64_t p = phase(b, now_ns);
+    uint64_t edge = now_ns + (p < b->on_ns ? b->on_ns - p : b->period_ns - p);
+    return b->end_ns != 0 && edge > b->end_ns ? b->end_ns : edge;
+}
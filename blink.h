@@ -0,0 +1,23 @@
+#ifndef BLINK_H
+#define BLINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* One running blink; each zone has its own. Zero-initialised means not blinking.
+   Blinks are evaluated against the timebase on the render tick and phase-aligned to a shared
+   reference, so every light with the same period switches on the same millisecond. */
+typedef struct {
+    uint64_t period_ns;
+    uint64_t on_ns;
+    uint64_t end_ns;  /* 0 for endless */
+} blink_t;
+
+void blink_set_reference(uint64_t ref_ns);
+void blink_start(blink_t *b, uint32_t period_ms, float duty, uint32_t count, uint64_t now_ns);
+void blink_stop(blink_t *b);
+bool blink_active(const blink_t *b, uint64_t now_ns);
+bool blink_lit(const blink_t *b, uint64_t now_ns);
+uint64_t blink_next_edge_ns(const blink_t *b, uint64_t now_ns);
+
+#endif /* BLINK_H */
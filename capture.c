@@ -0,0 +1,204 @@
+#include "capture.h"
+#include "alog.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MAGIC "SLKCAP01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK (4u * 1024u * 1024u)
+
+/* File layout: header, then 8-byte aligned records appended back to back. end_offset is
+   bumped only after a record is fully written, so a crash never exposes a torn record. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    volatile uint64_t end_offset;
+    uint64_t records;
+} capture_header_t;
+
+typedef struct {
+    uint32_t rec_len;
+    uint32_t payload_len;
+    uint64_t t_ns;
+    uint32_t src_addr;
+    uint16_t src_port;
+    uint16_t dst_port; /* Listener port the packet was routed as; 0 (older captures) for the main port */
+} capture_record_t;
+
+static int s_fd = -1;
+static uint8_t *s_map;
+static size_t s_map_len;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static bool map_file(size_t len) {
+    if (s_map != NULL) {
+        munmap(s_map, s_map_len);
+        s_map = NULL;
+    }
+    if (ftruncate(s_fd, (off_t)len) < 0) {
+        log_error("capture: ftruncate to %zu failed: %s", len, strerror(errno));
+        return false;
+    }
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, s_fd, 0);
+    if (p == MAP_FAILED) {
+        log_error("capture: mmap failed: %s", strerror(errno));
+        return false;
+    }
+    s_map = p;
+    s_map_len = len;
+    return true;
+}
+
+bool capture_open(const char *path) {
+    s_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (s_fd < 0) {
+        log_error("capture: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (!map_file(CAPTURE_CHUNK)) {
+        close(s_fd);
+        s_fd = -1;
+        return false;
+    }
+
+    capture_header_t *h = (capture_header_t *)s_map;
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(h->magic));
+    h->version = CAPTURE_VERSION;
+    h->header_size = sizeof(capture_header_t);
+    h->records = 0;
+    h->end_offset = sizeof(capture_header_t);
+
+    log_info("capture: recording received packets to %s", path);
+    return true;
+}
+
+bool capture_active(void) { return s_map != NULL; }
+
+void capture_append(const void *data, int len, const struct sockaddr_in *from, int port) {
+    if (s_map == NULL || len <= 0) {
+        return;
+    }
+
+    capture_header_t *h = (capture_header_t *)s_map;
+    size_t rec_len = (sizeof(capture_record_t) + (size_t)len + 7u) & ~(size_t)7u;
+    size_t off = (size_t)h->end_offset;
+
+    if (off + rec_len > s_map_len) {
+        if (!map_file(s_map_len + CAPTURE_CHUNK)) {
+            capture_close();
+            return;
+        }
+        h = (capture_header_t *)s_map;
+    }
+
+    capture_record_t *r = (capture_record_t *)(s_map + off);
+    r->rec_len = (uint32_t)rec_len;
+    r->payload_len = (uint32_t)len;
+    r->t_ns = now_ns();
+    r->src_addr = from != NULL ? from->sin_addr.s_addr : 0;
+    r->src_port = from != NULL ? from->sin_port : 0;
+    r->dst_port = (uint16_t)port;
+    memcpy(r + 1, data, (size_t)len);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    h->records++;
+    h->end_offset = off + rec_len;
+}
+
+void capture_close(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    if (s_map != NULL) {
+        capture_header_t *h = (capture_header_t *)s_map;
+        size_t used = (size_t)h->end_offset;
+        log_info("capture: %llu packets, %zu bytes", (unsigned long long)h->records, used);
+        munmap(s_map, s_map_len);
+        s_map = NULL;
+        if (ftruncate(s_fd, (off_t)used) < 0) {
+            log_error("capture: final ftruncate failed: %s", strerror(errno));
+        }
+    }
+    close(s_fd);
+    s_fd = -1;
+}
+
+bool capture_reader_open(capture_reader_t *r, const char *path) {
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("capture: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(capture_header_t)) {
+        log_error("capture: %s is too short to be a capture", path);
+        close(fd);
+        return false;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        log_error("capture: mmap %s failed: %s", path, strerror(errno));
+        return false;
+    }
+
+    const capture_header_t *h = p;
+    if (memcmp(h->magic, CAPTURE_MAGIC, sizeof(h->magic)) != 0 || h->version != CAPTURE_VERSION) {
+        log_error("capture: %s is not a version %d capture", path, CAPTURE_VERSION);
+        munmap(p, (size_t)st.st_size);
+        return false;
+    }
+
+    r->map = p;
+    r->map_len = (size_t)st.st_size;
+    r->end = (size_t)h->end_offset < r->map_len ? (size_t)h->end_offset : r->map_len;
+    r->offset = h->header_size;
+    return true;
+}
+
+bool capture_reader_next(capture_reader_t *r, capture_packet_t *pkt) {
+    if (r->offset + sizeof(capture_record_t) > r->end) {
+        return false;
+    }
+
+    const capture_record_t *rec = (const capture_record_t *)(r->map + r->offset);
+    if (rec->rec_len < sizeof(capture_record_t) || r->offset + rec->rec_len > r->end ||
+        sizeof(capture_record_t) + rec->payload_len > rec->rec_len) {
+        log_error("capture: corrupt record at offset %zu", r->offset);
+        return false;
+    }
+
+    pkt->data = (const char *)(rec + 1);
+    pkt->len = (int)rec->payload_len;
+    pkt->t_ns = rec->t_ns;
+    memset(&pkt->from, 0, sizeof(pkt->from));
+    pkt->from.sin_family = AF_INET;
+    pkt->from.sin_addr.s_addr = rec->src_addr;
+    pkt->from.sin_port = rec->src_port;
+    pkt->port = rec->dst_port;
+
+    r->offset += rec->rec_len;
+    return true;
+}
+
+void capture_reader_close(capture_reader_t *r) {
+    if (r->map != NULL) {
+        munmap((void *)r->map, r->map_len);
+        r->map = NULL;
+    }
+}
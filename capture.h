@@ -0,0 +1,33 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_len;
+    size_t end;
+    size_t offset;
+} capture_reader_t;
+
+typedef struct {
+    const char *data;
+    int len;
+    uint64_t t_ns;
+    struct sockaddr_in from;
+    int port; /* Port the server routed it as; 0 for the main port */
+} capture_packet_t;
+
+bool capture_open(const char *path);
+bool capture_active(void);
+void capture_append(const void *data, int len, const struct sockaddr_in *from, int port);
+void capture_close(void);
+
+bool capture_reader_open(capture_reader_t *r, const char *path);
+bool capture_reader_next(capture_reader_t *r, capture_packet_t *pkt);
+void capture_reader_close(capture_reader_t *r);
+
+#endif /* CAPTURE_H */
@@ -1,6 +1,7 @@
 #include "cli.h"
 #include "config.h"
-#include "log.h"
+#include "settings.h"
+#include "alog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
@@ -10,14 +11,25 @@
 static int port = 9000;
 static bool debug_mode = false;
 static bool test_mode = false;
+static const char *record_path = NULL;
+static const char *state_path = NULL;
+static bool state_disabled = false;
+static const char *config_path = NULL;
 
 void cli_print_usage(const char *program_name) {
     printf("\nUsage: %s [OPTIONS]\n\n", program_name);
     printf("This program listens for OSC messages on the specified port and controls LED colors.\n\n");
     printf("Options:\n");
+    printf("  -c, --config    Settings file, reloaded whenever it changes (see README)\n");
     printf("  -d, --debug     Enable debug mode\n");
     printf("  -h, --help      Show this help message\n");
     printf("  -p, --port      Specify port number (default: 9000)\n");
+    printf("  -r, --record    Append every received packet to a capture file (see oscreplay)\n");
+    printf("      --rate-limit N   Packets/s admitted per source address, 0 disables (default: %d)\n", RATELIMIT_RATE);
+    printf("      --rate-burst N   Packets a source may send back to back (default: %d)\n", RATELIMIT_BURST);
+    printf("      --rate-policy P  drop, coalesce (keep newest) or deprioritize (default: coalesce)\n");
+    printf("  -s, --state     State file restored on startup (default: ~/.slicky_osc-<port>.state)\n");
+    printf("      --no-state  Do not persist or restore state\n");
     printf("  -t, --test      Test mode: run without USB device (no HID init or I/O)\n");
     printf("\n");
     printf("The OSC messages are sent to the /setcolorint and /setcolorhex addresses.\n");
@@ -26,12 +38,21 @@ void cli_print_usage(const char *program_name) {
     printf("  /setcolorint nnnnn  expects a 32-bit int.\n");
     printf("  /setcolorhex nnnnn  expects a string to convert to a 32-bit rgb color in hex.\n");
     printf("  /blink n            expects a 32-bit integer. Any value > 0 enables blinking.\n");
+    printf("  /blink period_ms duty [count]  blinks with that period and lit fraction (0-1, or int percent);\n");
+    printf("                      count > 0 gives that many flashes, then a steady light.\n");
+    printf("  /pattern name [rate]  runs rainbow, pulse or strobe in the server (off stops it); rate is\n");
+    printf("                      wheel turns, pulses or flashes per second.\n");
     printf("  /blink_on_change n  expects a 32-bit integer. Any value > 0 enables blinking on color change.\n");
+    printf("  /scene/store n      saves the current look as preset n (0-%d).\n", SCENE_MAX - 1);
+    printf("  /scene/recall n [fade_ms]  switches to preset n, optionally crossfading.\n");
+    printf("  /group/<name>/...   any of the above, only on servers in group <name> (\"all\" is every server).\n");
     printf("\n");
     printf("Status (server -> client, port %d):\n", FEEDBACK_PORT);
-    printf("  Reply: sent for each received packet. Periodic: every 1 second to last sender.\n");
+    printf("  Reply: once per sender per loop pass, after its messages are applied.\n");
+    printf("  Periodic: every status_interval seconds (default %d) to the last sender.\n", STATUS_INTERVAL);
     printf("  /status/color nnnn        32-bit RGB color\n");
     printf("  /status/blinking 0|1      continuous blink on (1) or off (0)\n");
+    printf("  /status/blink ms pct      blink period and lit percentage\n");
     printf("  /status/blink_on_change 0|1  blink on color change (1) or off (0)\n");
     printf("\n");
     printf("Press Ctrl+C to stop.\n");
@@ -39,20 +60,30 @@ void cli_print_usage(const char *program_name) {
 
 void cli_parse_arguments(int argc, char *argv[]) {
     int opt;
-    const char *short_options = "dhtp:";
+    const char *short_options = "c:dhtp:r:s:";
     struct option long_options[] = {
+        {"config", required_argument, 0, 'c'},
         {"debug", no_argument, 0, 'd'},
         {"help", no_argument, 0, 'h'},
         {"test", no_argument, 0, 't'},
         {"port", required_argument, 0, 'p'},
+        {"record", required_argument, 0, 'r'},
+        {"state", required_argument, 0, 's'},
+        {"no-state", no_argument, 0, 'S'},
+        {"rate-limit", required_argument, 0, 'L'},
+        {"rate-burst", required_argument, 0, 'B'},
+        {"rate-policy", required_argument, 0, 'P'},
         {0, 0, 0, 0}
     };
 
     while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
         switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
             case 'd':
                 debug_mode = true;
-                log_set_level(LOG_DEBUG);
+                alog_set_level(LOG_DEBUG);
                 break;
             case 'h':
                 cli_print_usage(argv[0]);
@@ -72,6 +103,29 @@ void cli_parse_arguments(int argc, char *argv[]) {
                 port = (int)p;
                 break;
             }
+            case 'r':
+                record_path = optarg;
+                break;
+            case 's':
+                state_path = optarg;
+                break;
+            case 'S':
+                state_disabled = true;
+                break;
+            case 'L':
+            case 'B':
+                /* Command-line values win over the settings file, including after a reload. */
+                if (!settings_override(opt == 'L' ? "rate_limit" : "rate_burst", optarg)) {
+                    fprintf(stderr, "Error: --rate-limit and --rate-burst must be non-negative numbers\n");
+                    exit(1);
+                }
+                break;
+            case 'P':
+                if (!settings_override("rate_policy", optarg)) {
+                    fprintf(stderr, "Error: --rate-policy must be drop, coalesce or deprioritize\n");
+                    exit(1);
+                }
+                break;
             default:
                 cli_print_usage(argv[0]);
                 exit(1);
@@ -82,3 +136,37 @@ void cli_parse_arguments(int argc, char *argv[]) {
 int cli_port(void) { return port; }
 bool cli_debug(void) { return debug_mode; }
 bool cli_test_mode(void) { return test_mode; }
+const char *cli_record_path(void) { return record_path; }
+const char *cli_config_path(void) { return config_path; }
+
+const char *cli_state_path(void) {
+    static char default_path[512];
+
+    if (state_disabled) {
+        return NULL;
+    }
+    if (state_path != NULL) {
+        return state_path;
+    }
+    const char *home = getenv("HOME");
+    snprintf(default_path, sizeof(default_path), "%s/.slicky_osc-%d.state",
+             home != NULL ? home : "/tmp", port);
+    return default_path;
+}
+
+/* Scenes live next to the state file: ~/.slicky_osc-<port>.scenes, or FILE.scenes for --state FILE. */
+const char *cli_scene_path(void) {
+    static char default_path[512];
+    const char *state = cli_state_path();
+
+    if (state == NULL) {
+        return NULL;
+    }
+    if (state_path != NULL) {
+        snprintf(default_path, sizeof(default_path), "%s.scenes", state_path);
+    } else {
+        const char *home = getenv("HOME");
+        snprintf(default_path, sizeof(default_path), "%s/.slicky_osc-%d.scenes", home != NULL ? home : "/tmp", port);
+    }
+    return default_path;
+}
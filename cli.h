@@ -9,5 +9,9 @@ void cli_print_usage(const char *program_name);
 int cli_port(void);
 bool cli_debug(void);
 bool cli_test_mode(void);
+const char *cli_record_path(void);
+const char *cli_state_path(void);
+const char *cli_scene_path(void);
+const char *cli_config_path(void);
 
 #endif /* CLI_H */
@@ -0,0 +1,416 @@
+#include "clocksync.h"
+#include "netif.h"
+#include "config.h"
+#include "settings.h"
+#include "ssdp.h"
+#include "blink.h"
+#include "pattern.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SYNC_MAGIC 0x534C4B53u /* "SLKS" */
+#define SYNC_VERSION 1
+#define SYNC_BEACON_LEN 24
+#define SYNC_FLAG_LEADER 0x01    /* Sender believes it leads */
+#define SYNC_FLAG_CANDIDATE 0x02 /* Sender's clock is on the shared timebase and it may lead */
+#define SYNC_STEP_NS 50000000    /* A leader sample this far off the fit restarts the fit */
+
+typedef struct {
+    uint64_t id;
+    int priority;
+    bool candidate;
+    uint64_t seen_ns;
+} sync_peer_t;
+
+typedef struct {
+    uint64_t local_ns;
+    int64_t offset_ns; /* Leader's shared clock minus our clock on arrival */
+} sync_sample_t;
+
+static int s_fd = -1;
+static int s_port;
+static uint64_t s_node_id;
+static struct in_addr s_joined[NETIF_MAX];
+static int s_joined_count;
+static sync_peer_t s_peers[SYNC_MAX_PEERS];
+static int s_peer_count;
+static uint64_t s_started_ns;
+static uint64_t s_next_beacon_ns;
+
+/* Shared clock = local + offset + drift * (local - fit_ref). */
+static bool s_locked;
+static bool s_leading;
+static uint64_t s_leader_id;
+static int64_t s_offset_ns;
+static double s_drift;
+static uint64_t s_fit_ref_ns;
+static sync_sample_t s_samples[SYNC_WINDOW];
+static int s_sample_count;
+static int s_sample_next;
+
+static uint64_t s_beacons_sent;
+static uint64_t s_beacons_received;
+static uint64_t s_leader_changes;
+
+static uint64_t shared_now(uint64_t local_ns) {
+    int64_t since = (int64_t)(local_ns - s_fit_ref_ns);
+    return local_ns + (uint64_t)(s_offset_ns + (int64_t)(s_drift * (double)since));
+}
+
+/* Servers are told apart by their SSDP uuid, which is stable per host and port. */
+static uint64_t make_node_id(void) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = ssdp_uuid(); *p; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (56 - 8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static bool can_lead(uint64_t now) {
+    return s_locked || now - s_started_ns >= (uint64_t)SYNC_LEADER_TIMEOUT_MS * 1000000u;
+}
+
+static void join_groups(void) {
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr.s_addr = inet_addr(SYNC_MULTICAST_IP);
+
+    for (int i = 0; i < s_joined_count; i++) {
+        mreq.imr_interface = s_joined[i];
+        setsockopt(s_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    s_joined_count = 0;
+
+    if (netif_count() == 0) {
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
+            s_joined[s_joined_count++] = mreq.imr_interface;
+        }
+        return;
+    }
+    for (int i = 0; i < netif_count(); i++) {
+        mreq.imr_interface = netif_get(i)->addr;
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            log_error("sync: cannot join multicast group on %s: %s", netif_get(i)->name, strerror(errno));
+            continue;
+        }
+        s_joined[s_joined_count++] = mreq.imr_interface;
+    }
+}
+
+/* 24 bytes, big-endian: magic, version, priority, flags, reserved, node id, shared clock. */
+static void send_beacon(uint64_t now) {
+    uint8_t buf[SYNC_BEACON_LEN];
+    struct sockaddr_in dest;
+    uint8_t flags = (uint8_t)((s_leading ? SYNC_FLAG_LEADER : 0) | (can_lead(now) ? SYNC_FLAG_CANDIDATE : 0));
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(s_port);
+    dest.sin_addr.s_addr = inet_addr(SYNC_MULTICAST_IP);
+
+    put_u32(buf, SYNC_MAGIC);
+    buf[4] = SYNC_VERSION;
+    buf[5] = (uint8_t)settings()->sync_priority;
+    buf[6] = flags;
+    buf[7] = 0;
+    put_u64(buf + 8, s_node_id);
+
+    for (int i = 0; i < (netif_count() > 0 ? netif_count() : 1); i++) {
+        struct in_addr ifaddr = { .s_addr = htonl(INADDR_ANY) };
+        if (netif_count() > 0) {
+            ifaddr = netif_get(i)->addr;
+        }
+        setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr));
+        /* Stamped last thing before the send so the clock reading leaves with as little delay as possible. */
+        put_u64(buf + 16, s_locked ? shared_now(timebase_now_ns()) : timebase_now_ns());
+        if (sendto(s_fd, buf, sizeof(buf), 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+            log_debug("sync: beacon send failed: %s", strerror(errno));
+            continue;
+        }
+        s_beacons_sent++;
+    }
+}
+
+/* Drift is the least-squares slope of offset over local time. The offset is then the upper
+   envelope of the window: network delay only ever makes a beacon look late, so the least
+   delayed sample is the best reading of the leader's clock. */
+static void fit(void) {
+    const sync_sample_t *newest = &s_samples[(s_sample_next + SYNC_WINDOW - 1) % SYNC_WINDOW];
+    double slope = 0.0;
+
+    if (s_sample_count >= 4) {
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (int i = 0; i < s_sample_count; i++) {
+            double x = (double)(int64_t)(s_samples[i].local_ns - newest->local_ns);
+            double y = (double)(s_samples[i].offset_ns - newest->offset_ns);
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double den = s_sample_count * sxx - sx * sx;
+        if (den > 0) {
+            slope = (s_sample_count * sxy - sx * sy) / den;
+        }
+        if (slope > SYNC_MAX_DRIFT_PPM * 1e-6) slope = SYNC_MAX_DRIFT_PPM * 1e-6;
+        if (slope < -SYNC_MAX_DRIFT_PPM * 1e-6) slope = -SYNC_MAX_DRIFT_PPM * 1e-6;
+    }
+
+    int64_t best = INT64_MIN;
+    for (int i = 0; i < s_sample_count; i++) {
+        double x = (double)(int64_t)(s_samples[i].local_ns - newest->local_ns);
+        int64_t o = s_samples[i].offset_ns - (int64_t)(slope * x);
+        if (o > best) best = o;
+    }
+    s_offset_ns = best;
+    s_drift = slope;
+    s_fit_ref_ns = newest->local_ns;
+}
+
+static void add_sample(uint64_t local_ns, uint64_t leader_ns) {
+    int64_t offset = (int64_t)(leader_ns - local_ns);
+
+    if (s_sample_count > 0) {
+        int64_t predicted = (int64_t)(shared_now(local_ns) - local_ns);
+        if (offset - predicted > SYNC_STEP_NS || predicted - offset > SYNC_STEP_NS) {
+            log_info("sync: leader clock stepped by %lld us, refitting", (long long)((offset - predicted) / 1000));
+            s_sample_count = 0;
+            s_sample_next = 0;
+        }
+    }
+    s_samples[s_sample_next] = (sync_sample_t){ local_ns, offset };
+    s_sample_next = (s_sample_next + 1) % SYNC_WINDOW;
+    if (s_sample_count < SYNC_WINDOW) s_sample_count++;
+    fit();
+    if (!s_locked) {
+        log_info("sync: locked to %016llx, offset %lld us", (unsigned long long)s_leader_id,
+                 (long long)(s_offset_ns / 1000));
+        s_locked = true;
+    }
+}
+
+static sync_peer_t *find_peer(uint64_t id) {
+    for (int i = 0; i < s_peer_count; i++) {
+        if (s_peers[i].id == id) {
+            return &s_peers[i];
+        }
+    }
+    if (s_peer_count == SYNC_MAX_PEERS) {
+        return NULL;
+    }
+    memset(&s_peers[s_peer_count], 0, sizeof(s_peers[0]));
+    s_peers[s_peer_count].id = id;
+    return &s_peers[s_peer_count++];
+}
+
+/* Lowest priority, then lowest node id, among the servers that may lead. Every server sees the
+   same beacons, so they agree without a vote. */
+static void elect(uint64_t now) {
+    uint64_t best_id = 0;
+    int best_prio = 256;
+
+    for (int i = 0; i < s_peer_count;) {
+        if (now - s_peers[i].seen_ns > (uint64_t)SYNC_LEADER_TIMEOUT_MS * 1000000u) {
+            log_info("sync: %016llx went silent", (unsigned long long)s_peers[i].id);
+            s_peers[i] = s_peers[--s_peer_count];
+            continue;
+        }
+        if (s_peers[i].candidate && (s_peers[i].priority < best_prio ||
+                                     (s_peers[i].priority == best_prio && s_peers[i].id < best_id))) {
+            best_id = s_peers[i].id;
+            best_prio = s_peers[i].priority;
+        }
+        i++;
+    }
+    if (can_lead(now) && (settings()->sync_priority < best_prio ||
+                          (settings()->sync_priority == best_prio && s_node_id < best_id))) {
+        best_id = s_node_id;
+    }
+    if (best_id == 0 || best_id == s_leader_id) {
+        return;
+    }
+
+    s_leader_id = best_id;
+    s_leader_changes++;
+    s_sample_count = 0;
+    s_sample_next = 0;
+    if (best_id == s_node_id) {
+        /* Carry on from our estimate of the shared clock, so a handover does not jump the phase. */
+        if (s_locked) {
+            s_offset_ns = (int64_t)(shared_now(now) - now);
+        }
+        s_drift = 0.0;
+        s_fit_ref_ns = now;
+        s_locked = true;
+        s_leading = true;
+        log_info("sync: leading the shared clock");
+    } else {
+        s_leading = false;
+        log_info("sync: following %016llx", (unsigned long long)best_id);
+    }
+}
+
+void clocksync_init(void) {
+    s_port = settings()->sync_port;
+    if (s_port == 0) {
+        return;
+    }
+    s_node_id = make_node_id();
+    s_started_ns = timebase_now_ns();
+    s_next_beacon_ns = s_started_ns;
+
+    s_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_fd < 0) {
+        log_error("sync: cannot create socket: %s", strerror(errno));
+        return;
+    }
+    fcntl(s_fd, F_SETFL, O_NONBLOCK);
+
+    int on = 1;
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(s_port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_error("sync: cannot bind port %d: %s", s_port, strerror(errno));
+        close(s_fd);
+        s_fd = -1;
+        return;
+    }
+    join_groups();
+
+    unsigned char ttl = 4;
+    setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    log_info("sync: node %016llx, beacons on %s:%d", (unsigned long long)s_node_id, SYNC_MULTICAST_IP, s_port);
+}
+
+int clocksync_fd(void) { return s_fd; }
+
+void clocksync_handle_readable(void) {
+    uint8_t buf[64];
+    ssize_t len;
+
+    while ((len = recv(s_fd, buf, sizeof(buf), 0)) > 0) {
+        uint64_t now = timebase_now_ns();
+        if (len < SYNC_BEACON_LEN || get_u32(buf) != SYNC_MAGIC || buf[4] != SYNC_VERSION) {
+            continue;
+        }
+        uint64_t id = get_u64(buf + 8);
+        if (id == s_node_id) {
+            continue;
+        }
+        s_beacons_received++;
+        sync_peer_t *peer = find_peer(id);
+        if (peer == NULL) {
+            continue;
+        }
+        peer->priority = buf[5];
+        peer->candidate = (buf[6] & SYNC_FLAG_CANDIDATE) != 0;
+        peer->seen_ns = now;
+        if (id == s_leader_id && !s_leading && peer->candidate) {
+            add_sample(now, get_u64(buf + 16));
+        }
+    }
+}
+
+void clocksync_interfaces_changed(void) {
+    if (s_fd >= 0) {
+        join_groups();
+    }
+}
+
+/* Once on the shared clock, blinks and patterns are phased from the local time at which it
+   read zero, so equal periods switch together on every server. */
+void clocksync_tick(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    uint64_t now = timebase_now_ns();
+    elect(now);
+    if (now >= s_next_beacon_ns) {
+        send_beacon(now);
+        s_next_beacon_ns = now + (uint64_t)SYNC_BEACON_MS * 1000000u;
+    }
+    if (s_locked) {
+        uint64_t ref = now - shared_now(now);
+        blink_set_reference(ref);
+        pattern_set_reference(ref);
+    }
+}
+
+int clocksync_next_timeout_ms(void) {
+    if (s_fd < 0) {
+        return -1;
+    }
+    uint64_t now = timebase_now_ns();
+    return s_next_beacon_ns <= now ? 0 : (int)((s_next_beacon_ns - now + 999999u) / 1000000u);
+}
+
+void clocksync_settings_changed(void) {
+    if (settings()->sync_port != s_port) {
+        clocksync_shutdown();
+        clocksync_init();
+    }
+}
+
+void clocksync_log_stats(void) {
+    if (s_fd >= 0) {
+        log_info("sync: %s %016llx, offset %lld us, drift %.1f ppm, %llu beacons sent, %llu received, "
+                 "%llu leader changes", s_leading ? "leading as" : "following", (unsigned long long)s_leader_id,
+                 (long long)(s_offset_ns / 1000), s_drift * 1e6, (unsigned long long)s_beacons_sent,
+                 (unsigned long long)s_beacons_received, (unsigned long long)s_leader_changes);
+    }
+}
+
+/* Back to the local clock: blinks phase from timebase zero and patterns from their own start. */
+void clocksync_shutdown(void) {
+    if (s_fd >= 0) {
+        close(s_fd);
+        s_fd = -1;
+    }
+    s_port = 0;
+    s_joined_count = 0;
+    s_peer_count = 0;
+    s_locked = false;
+    s_leading = false;
+    s_leader_id = 0;
+    s_offset_ns = 0;
+    s_drift = 0.0;
+    s_sample_count = 0;
+    s_sample_next = 0;
+    blink_set_reference(0);
+    pattern_clear_reference();
+}
@@ -0,0 +1,16 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+/* Shared timebase between servers on one network: the servers elect a leader over multicast,
+   follow its clock beacons, and phase blinks and patterns from the shared clock. */
+void clocksync_init(void);
+int clocksync_fd(void);
+void clocksync_handle_readable(void);
+void clocksync_interfaces_changed(void);
+void clocksync_tick(void);
+int clocksync_next_timeout_ms(void);
+void clocksync_settings_changed(void);
+void clocksync_log_stats(void);
+void clocksync_shutdown(void);
+
+#endif /* CLOCKSYNC_H */
@@ -4,10 +4,51 @@
 #define MAX_STR 255
 #define VENDOR_ID 0x04D8
 #define PRODUCT_ID 0xEC24
-#define SSDP_INTERVAL 5   /* Send SSDP announcements every 5 seconds */
+#define SSDP_MAX_AGE 1800   /* CACHE-CONTROL max-age advertised in NOTIFY and M-SEARCH replies */
+#define SSDP_INTERVAL 600   /* Re-send ssdp:alive well inside max-age/2 (plus jitter) */
+#define SSDP_NOTIFY_REPEAT 2 /* Copies of each NOTIFY sent, since SSDP runs over lossy UDP */
+#define NETIF_POLL_INTERVAL 10 /* Re-scan interfaces this often where no change notification exists */
 #define STATUS_INTERVAL 1 /* Send /status to last sender every 1 second */
+#define RENDER_FPS 30 /* Pattern frames per second */
+#define BLINK_INTERVAL_MS 500 /* Time between blink on/off toggles */
+#define BLINK_ON_CHANGE_COUNT 3 /* Flashes acknowledging a color change with blink_on_change */
+#define DITHER_FPS 120 /* Device refresh rate while a slow fade is dithered (0 disables dithering) */
+#define DITHER_MIN_FADE_MS 2000 /* Fades at least this long are rendered at 16 bits and dithered */
+#define LED_REASSERT_MS 1000 /* Rewrite an unchanged color this often, in case the device was replugged */
+#define LED_HEALTH_WINDOW_MS 10000 /* A degraded light is healthy again after this long without trouble */
+#define LED_RECOVERY_MAX_MS 10000 /* Longest wait between reconnect attempts for an offline light */
+#define LED_RECOVERY_POLL_MS 100 /* How often the recovery thread looks for offline lights */
+#define LED_SPIKE_FACTOR 4 /* A write this many times slower than average counts as a latency spike */
+#define LED_SPIKE_MIN_US 2000 /* ...provided it also took at least this long */
+#define LED_SPIKE_WARMUP 8 /* Writes averaged before spikes are judged */
+#define ZONE_MAX 8 /* Independent zones (state + devices) served by one process */
+#define ZONE_NAME_MAX 16
+#define RELAY_MAX 4 /* Relay rules (relay.<name>.*) in one settings file */
+#define RELAY_TARGETS_MAX 32 /* Downstream servers per relay rule */
+#define RELAY_BUNDLE_MAX 1400 /* Forwarded bundles stay under a typical Ethernet MTU */
+#define RELAY_STALE_MS 3000 /* A downstream server silent this long no longer counts as answering */
+#define RELIABLE_SENDERS 32 /* Reliable senders tracked at once; the least recently heard is replaced */
+#define RELIABLE_WINDOW 32 /* Sequence numbers ahead of the cumulative ack that are remembered; all fit in the ack */
+#define RELIABLE_RTO_MS 40 /* oscclient -r: first retransmit timeout, doubled per attempt */
+#define RELIABLE_TRIES 6   /* oscclient -r: attempts before giving up */
+#define SCENE_MAX 32 /* Preset slots for /scene/store and /scene/recall */
 #define SSDP_PORT 1901
 #define FEEDBACK_PORT 9500  /* UDP port for status/feedback (distinct from incoming OSC port) */
+#define RATELIMIT_RATE 0    /* Default packets/s admitted per source address (0 disables) */
+#define RATELIMIT_BURST 20  /* Default bucket depth, so short cue bursts pass untouched */
+#define OSC_GROUP_PORT 9100 /* Multicast OSC input port, used when osc_group is set */
+#define SACN_PORT 5568
+#define ARTNET_PORT 6454
+#define DMX_UNMAPPED -1 /* dmx_universe of a zone DMX does not drive; 0 is a valid Art-Net port address */
+#define DMX_SOURCE_TIMEOUT_MS 2500 /* E1.31 network data loss timeout; a silent sender leaves the merge */
 #define SSDP_MULTICAST_IP "239.255.255.250"
+#define SYNC_MULTICAST_IP "239.255.76.83" /* Clock beacons between servers (sync_port enables) */
+#define SYNC_PRIORITY 100 /* Default election priority; the lowest priority, then the lowest node id, leads */
+#define SYNC_BEACON_MS 500 /* Clock beacon period */
+#define SYNC_LEADER_TIMEOUT_MS 2000 /* A server silent this long is dropped from the election */
+#define SYNC_WINDOW 16 /* Leader beacons kept for the offset and drift fit */
+#define SYNC_MAX_DRIFT_PPM 500 /* Fitted drift is clamped to this, so a bad window cannot run away */
+#define SYNC_MAX_PEERS 32
+#define SSDP_DESCRIPTION_PATH "/osc-cue-description.xml" /* Served over TCP on the OSC port number */
 
 #endif /* CONFIG_H */
@@ -0,0 +1,428 @@
+#include "dmx.h"
+#include "config.h"
+#include "settings.h"
+#include "netif.h"
+#include "state.h"
+#include "zone.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define DMX_CHANNELS 512
+#define DMX_SOURCES 16      /* Distinct (source, universe) streams tracked at once */
+#define DMX_MAX_JOINS 64    /* Universe groups times interfaces */
+#define SACN_MIN_LEN 126
+#define ARTNET_MIN_LEN 18
+#define ARTNET_OP_DMX 0x5000
+#define DMX_DEFAULT_PRIORITY 100 /* sACN default; Art-Net has no priority and always uses this */
+
+/* A sender is identified by its sACN CID, or by its IPv4 address for Art-Net. */
+typedef struct {
+    bool used;
+    bool artnet;
+    uint8_t id[16];
+    int universe;
+    uint8_t priority;
+    uint8_t seq;
+    uint64_t last_ns;
+    int len;
+    uint8_t data[DMX_CHANNELS];
+} dmx_source_t;
+
+static int s_sacn_fd = -1;
+static int s_artnet_fd = -1;
+static dmx_source_t s_sources[DMX_SOURCES];
+static struct ip_mreq s_joined[DMX_MAX_JOINS];
+static int s_joined_count;
+static uint64_t s_stale_frames;
+
+static const uint8_t s_acn_id[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+static const char *const s_merge_names[] = { "htp", "ltp" };
+
+bool dmx_parse_merge(const char *name, dmx_merge_t *merge) {
+    for (int i = 0; i < (int)(sizeof(s_merge_names) / sizeof(s_merge_names[0])); i++) {
+        if (strcmp(name, s_merge_names[i]) == 0) {
+            *merge = (dmx_merge_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int open_socket(int port, const char *what) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        log_error("Failed to create %s socket: %s", what, strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_error("Failed to bind %s socket to port %d: %s", what, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void join(struct in_addr group, struct in_addr iface) {
+    if (s_joined_count == DMX_MAX_JOINS) {
+        return;
+    }
+    struct ip_mreq *mreq = &s_joined[s_joined_count];
+    mreq->imr_multiaddr = group;
+    mreq->imr_interface = iface;
+    if (setsockopt(s_sacn_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, mreq, sizeof(*mreq)) < 0) {
+        log_error("sACN: cannot join %s: %s", inet_ntoa(group), strerror(errno));
+        return;
+    }
+    s_joined_count++;
+}
+
+/* sACN universe N is multicast to 239.255.<N high byte>.<N low byte>; join each mapped universe on every interface. */
+static void join_groups(void) {
+    for (int i = 0; i < s_joined_count; i++) {
+        setsockopt(s_sacn_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &s_joined[i], sizeof(s_joined[i]));
+    }
+    s_joined_count = 0;
+    if (s_sacn_fd < 0) {
+        return;
+    }
+
+    for (int z = 0; z < zone_count(); z++) {
+        int universe = zone_get(z)->dmx_universe;
+        bool seen = universe <= 0; /* Unmapped, or Art-Net only: sACN reserves universe 0 */
+        for (int k = 0; k < z && !seen; k++) {
+            seen = zone_get(k)->dmx_universe == universe;
+        }
+        if (seen) {
+            continue;
+        }
+        struct in_addr group = { .s_addr = htonl(0xEFFF0000u | (uint32_t)(universe & 0xFFFF)) };
+        if (netif_count() == 0) {
+            join(group, (struct in_addr){ .s_addr = htonl(INADDR_ANY) });
+        }
+        for (int i = 0; i < netif_count(); i++) {
+            join(group, netif_get(i)->addr);
+        }
+    }
+}
+
+void dmx_init(void) {
+    const settings_t *cfg = settings();
+
+    if (cfg->sacn) {
+        s_sacn_fd = open_socket(SACN_PORT, "sACN");
+        join_groups();
+    }
+    if (cfg->artnet) {
+        s_artnet_fd = open_socket(ARTNET_PORT, "Art-Net");
+    }
+    if (s_sacn_fd >= 0 || s_artnet_fd >= 0) {
+        log_info("DMX input:%s%s, merge %s", s_sacn_fd >= 0 ? " sACN" : "", s_artnet_fd >= 0 ? " Art-Net" : "",
+                 s_merge_names[cfg->dmx_merge]);
+    }
+}
+
+void dmx_fill_fdset(fd_set *set, int *max_fd) {
+    if (s_sacn_fd >= 0) {
+        FD_SET(s_sacn_fd, set);
+        if (s_sacn_fd > *max_fd) *max_fd = s_sacn_fd;
+    }
+    if (s_artnet_fd >= 0) {
+        FD_SET(s_artnet_fd, set);
+        if (s_artnet_fd > *max_fd) *max_fd = s_artnet_fd;
+    }
+}
+
+static bool universe_mapped(int universe) {
+    if (universe == DMX_UNMAPPED) {
+        return false;
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        if (zone_get(i)->dmx_universe == universe) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Combines every live source on the universe and hands each mapped zone its color. Only the
+   zone's color changes, so the render tick still writes each light at most once per pass. */
+static void merge_universe(int universe) {
+    uint8_t merged[DMX_CHANNELS];
+    int top_priority = -1;
+    const dmx_source_t *latest = NULL;
+
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        const dmx_source_t *src = &s_sources[i];
+        if (src->used && src->universe == universe && src->priority > top_priority) {
+            top_priority = src->priority;
+        }
+    }
+    if (top_priority < 0) {
+        return;
+    }
+
+    /* Only the highest-priority sources take part, as in E1.31. */
+    memset(merged, 0, sizeof(merged));
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        const dmx_source_t *src = &s_sources[i];
+        if (!src->used || src->universe != universe || src->priority != top_priority) {
+            continue;
+        }
+        if (latest == NULL || src->last_ns > latest->last_ns) {
+            latest = src;
+        }
+        if ((dmx_merge_t)settings()->dmx_merge == DMX_MERGE_HTP) {
+            for (int c = 0; c < src->len; c++) {
+                if (src->data[c] > merged[c]) merged[c] = src->data[c];
+            }
+        }
+    }
+    if ((dmx_merge_t)settings()->dmx_merge == DMX_MERGE_LTP) {
+        memcpy(merged, latest->data, (size_t)latest->len);
+    }
+
+    for (int i = 0; i < zone_count(); i++) {
+        zone_t *z = zone_get(i);
+        if (z->dmx_universe == DMX_UNMAPPED || z->dmx_universe != universe) {
+            continue;
+        }
+        int c = z->dmx_channel - 1;
+        int color = (merged[c] << 16) | (merged[c + 1] << 8) | merged[c + 2];
+        if (color != z->dmx_color) {
+            z->dmx_color = color;
+            state_set_live_color(z, color);
+        }
+    }
+}
+
+static dmx_source_t *lookup_source(bool artnet, const uint8_t *id, int universe, uint64_t now) {
+    dmx_source_t *victim = NULL;
+
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        dmx_source_t *src = &s_sources[i];
+        if (src->used && src->artnet == artnet && src->universe == universe && memcmp(src->id, id, 16) == 0) {
+            return src;
+        }
+        if (!src->used) {
+            if (victim == NULL || victim->used) victim = src;
+        } else if (victim == NULL || (victim->used && src->last_ns < victim->last_ns)) {
+            victim = src;
+        }
+    }
+    if (victim->used && now - victim->last_ns < (uint64_t)DMX_SOURCE_TIMEOUT_MS * 1000000u) {
+        log_warn("DMX: source table full, ignoring a new sender on universe %d", universe);
+        return NULL;
+    }
+    memset(victim, 0, sizeof(*victim));
+    victim->used = true;
+    victim->artnet = artnet;
+    memcpy(victim->id, id, 16);
+    victim->universe = universe;
+    return victim;
+}
+
+/* E1.31 6.7.2: a frame is out of order if it is up to 20 behind the last one; anything further
+   back means the sender restarted, so it is taken. */
+static bool sequence_ok(dmx_source_t *src, uint8_t seq, bool fresh) {
+    int8_t diff = (int8_t)(seq - src->seq);
+    if (!fresh && diff <= 0 && diff > -20) {
+        s_stale_frames++;
+        return false;
+    }
+    src->seq = seq;
+    return true;
+}
+
+static void accept_frame(bool artnet, const uint8_t *id, int universe, uint8_t priority, uint8_t seq, bool check_seq,
+                         const uint8_t *data, int len) {
+    uint64_t now = timebase_now_ns();
+
+    if (!universe_mapped(universe)) {
+        return;
+    }
+    dmx_source_t *src = lookup_source(artnet, id, universe, now);
+    if (src == NULL) {
+        return;
+    }
+    bool fresh = src->last_ns == 0;
+    if (check_seq && !sequence_ok(src, seq, fresh)) {
+        return;
+    }
+    if (fresh) {
+        log_info("DMX: new %s source on universe %d", artnet ? "Art-Net" : "sACN", universe);
+    }
+    src->priority = priority;
+    src->last_ns = now;
+    src->len = len > DMX_CHANNELS ? DMX_CHANNELS : len;
+    memcpy(src->data, data, (size_t)src->len);
+    merge_universe(universe);
+}
+
+static void drop_source(dmx_source_t *src) {
+    int universe = src->universe;
+    src->used = false;
+    merge_universe(universe);
+}
+
+static void handle_sacn(const uint8_t *p, int len) {
+    if (len < SACN_MIN_LEN || memcmp(p + 4, s_acn_id, sizeof(s_acn_id)) != 0 ||
+        (uint32_t)(p[18] << 24 | p[19] << 16 | p[20] << 8 | p[21]) != 0x00000004u ||
+        (uint32_t)(p[40] << 24 | p[41] << 16 | p[42] << 8 | p[43]) != 0x00000002u || p[117] != 0x02 ||
+        p[125] != 0x00) {
+        return;
+    }
+    uint8_t options = p[112];
+    int universe = p[113] << 8 | p[114];
+    int count = (p[123] << 8 | p[124]) - 1;
+
+    if (universe == 0) {
+        return; /* Reserved by E1.31; Art-Net port address 0 is valid */
+    }
+    if (options & 0x80) {
+        return; /* Preview data, meant for visualisers */
+    }
+    if (options & 0x40) {
+        /* Stream terminated: forget the sender now rather than after the timeout. */
+        for (int i = 0; i < DMX_SOURCES; i++) {
+            dmx_source_t *src = &s_sources[i];
+            if (src->used && !src->artnet && src->universe == universe && memcmp(src->id, p + 22, 16) == 0) {
+                drop_source(src);
+            }
+        }
+        return;
+    }
+    if (count < 0 || 126 + count > len) {
+        return;
+    }
+    accept_frame(false, p + 22, universe, p[108], p[111], true, p + 126, count);
+}
+
+static void handle_artnet(const uint8_t *p, int len, const struct sockaddr_in *from) {
+    uint8_t id[16];
+
+    if (len < ARTNET_MIN_LEN || memcmp(p, "Art-Net", 8) != 0 || (p[8] | p[9] << 8) != ARTNET_OP_DMX) {
+        return;
+    }
+    int universe = (p[15] & 0x7F) << 8 | p[14];
+    int count = p[16] << 8 | p[17];
+    if (count < 2 || ARTNET_MIN_LEN + count > len) {
+        return;
+    }
+    memset(id, 0, sizeof(id));
+    memcpy(id, &from->sin_addr, sizeof(from->sin_addr));
+    /* Art-Net sequence 0 means the sender does not number its frames. */
+    accept_frame(true, id, universe, DMX_DEFAULT_PRIORITY, p[12], p[12] != 0, p + ARTNET_MIN_LEN, count);
+}
+
+void dmx_handle(fd_set *set) {
+    uint8_t buf[1024];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    int len;
+
+    if (s_sacn_fd >= 0 && FD_ISSET(s_sacn_fd, set)) {
+        from_len = sizeof(from);
+        while ((len = (int)recvfrom(s_sacn_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len)) > 0) {
+            handle_sacn(buf, len);
+            from_len = sizeof(from);
+        }
+    }
+    if (s_artnet_fd >= 0 && FD_ISSET(s_artnet_fd, set)) {
+        from_len = sizeof(from);
+        while ((len = (int)recvfrom(s_artnet_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len)) > 0) {
+            handle_artnet(buf, len, &from);
+            from_len = sizeof(from);
+        }
+    }
+}
+
+void dmx_interfaces_changed(void) {
+    join_groups();
+}
+
+/* Mapping changes rejoin groups in place; switching a protocol on or off reopens its socket. */
+void dmx_settings_changed(void) {
+    const settings_t *cfg = settings();
+
+    if ((cfg->sacn != 0) != (s_sacn_fd >= 0) || (cfg->artnet != 0) != (s_artnet_fd >= 0)) {
+        dmx_shutdown();
+        dmx_init();
+        return;
+    }
+    join_groups();
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        if (s_sources[i].used && !universe_mapped(s_sources[i].universe)) {
+            s_sources[i].used = false;
+        }
+    }
+}
+
+/* A sender that goes quiet for DMX_SOURCE_TIMEOUT_MS no longer takes part in the merge. */
+void dmx_tick(void) {
+    uint64_t now = timebase_now_ns();
+
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        dmx_source_t *src = &s_sources[i];
+        if (src->used && now - src->last_ns >= (uint64_t)DMX_SOURCE_TIMEOUT_MS * 1000000u) {
+            log_info("DMX: %s source on universe %d timed out", src->artnet ? "Art-Net" : "sACN", src->universe);
+            drop_source(src);
+        }
+    }
+}
+
+int dmx_next_timeout_ms(void) {
+    uint64_t now = timebase_now_ns();
+    int wait = -1;
+
+    for (int i = 0; i < DMX_SOURCES; i++) {
+        const dmx_source_t *src = &s_sources[i];
+        if (!src->used) {
+            continue;
+        }
+        uint64_t deadline = src->last_ns + (uint64_t)DMX_SOURCE_TIMEOUT_MS * 1000000u;
+        int ms = deadline <= now ? 0 : (int)((deadline - now + 999999u) / 1000000u);
+        if (wait < 0 || ms < wait) wait = ms;
+    }
+    return wait;
+}
+
+void dmx_shutdown(void) {
+    if (s_stale_frames > 0) {
+        log_info("DMX: %llu out-of-order frames discarded", (unsigned long long)s_stale_frames);
+    }
+    s_stale_frames = 0;
+    if (s_sacn_fd >= 0) {
+        for (int i = 0; i < s_joined_count; i++) {
+            setsockopt(s_sacn_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &s_joined[i], sizeof(s_joined[i]));
+        }
+        s_joined_count = 0;
+        close(s_sacn_fd);
+        s_sacn_fd = -1;
+    }
+    if (s_artnet_fd >= 0) {
+        close(s_artnet_fd);
+        s_artnet_fd = -1;
+    }
+    memset(s_sources, 0, sizeof(s_sources));
+}
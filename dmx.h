@@ -0,0 +1,24 @@
+#ifndef DMX_H
+#define DMX_H
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+#define DMX_MAX_START_CHANNEL 510 /* Leaves room for green and blue */
+
+typedef enum {
+    DMX_MERGE_HTP, /* Highest value per channel across sources */
+    DMX_MERGE_LTP  /* Channels follow whichever source sent last */
+} dmx_merge_t;
+
+bool dmx_parse_merge(const char *name, dmx_merge_t *merge);
+void dmx_init(void);
+void dmx_fill_fdset(fd_set *set, int *max_fd);
+void dmx_handle(fd_set *set);
+void dmx_interfaces_changed(void);
+void dmx_settings_changed(void);
+void dmx_tick(void);
+int dmx_next_timeout_ms(void);
+void dmx_shutdown(void);
+
+#endif /* DMX_H */
@@ -0,0 +1,224 @@
+#include "http.h"
+#include "config.h"
+#include "ssdp.h"
+#include "settings.h"
+#include "alog.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HTTP_MAX_CLIENTS 4
+#define HTTP_REQ_MAX 1024
+
+typedef struct {
+    int fd;
+    size_t len;
+    char req[HTTP_REQ_MAX];
+} http_client_t;
+
+static int s_listen_fd = -1;
+static http_client_t s_clients[HTTP_MAX_CLIENTS];
+static int s_port;
+static char s_description[2048];
+static int s_description_len;
+
+/* Rendered per request so the URLs carry the address of the interface the client reached us on. */
+static void build_description(const char *ip) {
+    int port = s_port;
+    char host[128] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+
+    s_description_len = snprintf(s_description, sizeof(s_description),
+        "<?xml version=\"1.0\"?>\r\n"
+        "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">\r\n"
+        "  <specVersion><major>1</major><minor>0</minor></specVersion>\r\n"
+        "  <device>\r\n"
+        "    <deviceType>urn:schemas-upnp-org:device:OSC_CUE:1</deviceType>\r\n"
+        "    <friendlyName>OSC Cue Light (%s:%d)</friendlyName>\r\n"
+        "    <manufacturer>slicky_osc</manufacturer>\r\n"
+        "    <modelName>OSC_Cue_Light</modelName>\r\n"
+        "    <modelNumber>1.0</modelNumber>\r\n"
+        "    <UDN>uuid:%s</UDN>\r\n"
+        "    <serviceList>\r\n"
+        "      <service>\r\n"
+        "        <serviceType>urn:schemas-upnp-org:service:OSC_CUE:1</serviceType>\r\n"
+        "        <serviceId>urn:upnp-org:serviceId:OSC_CUE</serviceId>\r\n"
+        "        <SCPDURL>%s</SCPDURL>\r\n"
+        "        <controlURL>osc.udp://%s:%d</controlURL>\r\n"
+        "        <eventSubURL>osc.udp://%s:%d</eventSubURL>\r\n"
+        "      </service>\r\n"
+        "    </serviceList>\r\n"
+        "  </device>\r\n"
+        "</root>\r\n",
+        host, port, ssdp_uuid(), SSDP_DESCRIPTION_PATH,
+        ip, port, ip, settings()->feedback_port);
+    if (s_description_len < 0 || (size_t)s_description_len >= sizeof(s_description)) {
+        s_description_len = 0;
+    }
+}
+
+static void close_client(http_client_t *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+static void respond(http_client_t *c) {
+    char method[8], path[256];
+    char header[256];
+    int header_len;
+    bool head_only = false;
+
+    c->req[c->len] = '\0';
+    if (sscanf(c->req, "%7s %255s", method, path) != 2) {
+        header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send(c->fd, header, (size_t)header_len, 0);
+        return;
+    }
+
+    head_only = strcmp(method, "HEAD") == 0;
+    if (strcmp(method, "GET") != 0 && !head_only) {
+        header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send(c->fd, header, (size_t)header_len, 0);
+        return;
+    }
+
+    if (strcmp(path, SSDP_DESCRIPTION_PATH) != 0) {
+        header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send(c->fd, header, (size_t)header_len, 0);
+        return;
+    }
+
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    char ip[INET_ADDRSTRLEN] = "127.0.0.1";
+    if (getsockname(c->fd, (struct sockaddr *)&local, &local_len) == 0) {
+        inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+    }
+    build_description(ip);
+
+    header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n"
+        "\r\n", s_description_len);
+    send(c->fd, header, (size_t)header_len, 0);
+    if (!head_only) {
+        send(c->fd, s_description, (size_t)s_description_len, 0);
+    }
+    log_debug("HTTP: served %s", SSDP_DESCRIPTION_PATH);
+}
+
+int http_init(int port) {
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        s_clients[i].fd = -1;
+    }
+
+    s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s_listen_fd < 0) {
+        log_error("Failed to create HTTP socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+
+    int on = 1;
+    setsockopt(s_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_listen_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(s_listen_fd, HTTP_MAX_CLIENTS) < 0) {
+        log_error("Failed to listen for HTTP on TCP port %d: %s", port, strerror(errno));
+        close(s_listen_fd);
+        s_listen_fd = -1;
+        return -1;
+    }
+
+    s_port = port;
+    return s_listen_fd;
+}
+
+void http_fill_fdset(fd_set *set, int *max_fd) {
+    if (s_listen_fd < 0) {
+        return;
+    }
+    FD_SET(s_listen_fd, set);
+    if (s_listen_fd > *max_fd) *max_fd = s_listen_fd;
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0) {
+            FD_SET(s_clients[i].fd, set);
+            if (s_clients[i].fd > *max_fd) *max_fd = s_clients[i].fd;
+        }
+    }
+}
+
+void http_handle(fd_set *set) {
+    if (s_listen_fd < 0) {
+        return;
+    }
+
+    if (FD_ISSET(s_listen_fd, set)) {
+        int cfd;
+        while ((cfd = accept(s_listen_fd, NULL, NULL)) >= 0) {
+            http_client_t *slot = NULL;
+            for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+                if (s_clients[i].fd < 0) {
+                    slot = &s_clients[i];
+                    break;
+                }
+            }
+            if (slot == NULL) {
+                close(cfd);
+                continue;
+            }
+            fcntl(cfd, F_SETFL, O_NONBLOCK);
+            slot->fd = cfd;
+            slot->len = 0;
+        }
+    }
+
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        http_client_t *c = &s_clients[i];
+        if (c->fd < 0 || !FD_ISSET(c->fd, set)) {
+            continue;
+        }
+        ssize_t n = recv(c->fd, c->req + c->len, sizeof(c->req) - 1 - c->len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+        if (n <= 0) {
+            close_client(c);
+            continue;
+        }
+        c->len += (size_t)n;
+        c->req[c->len] = '\0';
+        if (strstr(c->req, "\r\n\r\n") != NULL || c->len >= sizeof(c->req) - 1) {
+            respond(c);
+            close_client(c);
+        }
+    }
+}
+
+void http_shutdown(void) {
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0) {
+            close_client(&s_clients[i]);
+        }
+    }
+    if (s_listen_fd >= 0) {
+        close(s_listen_fd);
+        s_listen_fd = -1;
+    }
+}
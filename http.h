@@ -0,0 +1,12 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+int http_init(int port);
+void http_fill_fdset(fd_set *set, int *max_fd);
+void http_handle(fd_set *set);
+void http_shutdown(void);
+
+#endif /* HTTP_H */
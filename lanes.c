@@ -0,0 +1,299 @@
+#include "lanes.h"
+#include "relay.h"
+#include "state.h"
+#include "zone.h"
+#include "alog.h"
+#include "timebase.h"
+#include "tinyosc.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LANE_MSG_MAX 512     /* Larger messages skip the lanes and are applied on arrival */
+#define LANE_CUE_SLOTS 64
+#define LANE_STREAM_SLOTS 256
+
+typedef struct {
+    uint64_t enqueued_ns;
+    uint16_t len;
+    uint8_t zone;
+    bool cancelled;
+    char data[LANE_MSG_MAX];
+} lane_entry_t;
+
+typedef struct {
+    lane_entry_t *slots;
+    int capacity;
+    int head;
+    int count;
+    bool drop_oldest; /* Stale stream frames are worth less than new ones; cues are applied rather than dropped */
+    lane_stats_t stats;
+    uint64_t avg_delay_ns;
+    uint64_t max_delay_ns;
+} lane_queue_t;
+
+static lane_entry_t s_cue_slots[LANE_CUE_SLOTS];
+static lane_entry_t s_stream_slots[LANE_STREAM_SLOTS];
+static lane_queue_t s_lanes[LANE_COUNT] = {
+    [LANE_CUE] = { s_cue_slots, LANE_CUE_SLOTS, 0, 0, false, { "cue" }, 0, 0 },
+    [LANE_STREAM] = { s_stream_slots, LANE_STREAM_SLOTS, 0, 0, true, { "stream" }, 0, 0 },
+};
+
+/* Color commands are streams unless they black the light out; everything else is a cue. */
+static lane_t classify(const zone_t *z, tosc_message *osc, bool *cancels_stream) {
+    const char *addr = tosc_getAddress(osc) + z->prefix_len;
+    tosc_message peek = *osc;
+
+    *cancels_stream = false;
+    if (strcmp(addr, "/setcolorint") == 0) {
+        if (tosc_getFormat(osc)[0] == 'i' && tosc_getNextInt32(&peek) == 0) {
+            *cancels_stream = true;
+            return LANE_CUE;
+        }
+        return LANE_STREAM;
+    }
+    if (strcmp(addr, "/setcolorhex") == 0) {
+        const char *hex = tosc_getFormat(osc)[0] == 's' ? tosc_getNextString(&peek) : NULL;
+        if (hex != NULL && strspn(hex, "0") == strlen(hex) && hex[0] != '\0') {
+            *cancels_stream = true;
+            return LANE_CUE;
+        }
+        return LANE_STREAM;
+    }
+    /* A blink keeps the color it blinks, so only a scene recall replaces queued frames. */
+    *cancels_stream = strcmp(addr, "/scene/recall") == 0;
+    return LANE_CUE;
+}
+
+/* A newer color for a zone supersedes any still queued, so a backlog jumps straight to the latest. */
+static void coalesce_stream(int zone) {
+    lane_queue_t *q = &s_lanes[LANE_STREAM];
+    for (int i = 0; i < q->count; i++) {
+        lane_entry_t *e = &q->slots[(q->head + i) % q->capacity];
+        if (!e->cancelled && e->zone == zone) {
+            e->cancelled = true;
+            q->stats.coalesced++;
+        }
+    }
+}
+
+/* Only the cue's own zone is affected (zone -1 for all); other zones' fades keep streaming. */
+static void cancel_stream(int zone) {
+    lane_queue_t *q = &s_lanes[LANE_STREAM];
+    for (int i = 0; i < q->count; i++) {
+        lane_entry_t *e = &q->slots[(q->head + i) % q->capacity];
+        if (!e->cancelled && (zone < 0 || e->zone == zone)) {
+            e->cancelled = true;
+            q->stats.cancelled++;
+        }
+    }
+}
+
+typedef struct {
+    int port;
+    bool debug;
+    unsigned zones;
+} enqueue_ctx_t;
+
+static void dispatch_one(lane_queue_t *q, uint64_t now, bool debug);
+
+static void dispatch_all(lane_queue_t *q, bool debug) {
+    uint64_t now = timebase_now_ns();
+    while (q->count > 0) {
+        dispatch_one(q, now, debug);
+    }
+}
+
+/* Returns the slot for a new entry. A full stream lane drops its oldest frame; a full cue lane is
+   applied on the spot, so a burst of cues is never discarded. */
+static lane_entry_t *push_entry(lane_queue_t *q, bool debug) {
+    if (q->count == q->capacity) {
+        if (q->drop_oldest) {
+            q->stats.dropped++;
+            q->head = (q->head + 1) % q->capacity;
+            q->count--;
+        } else {
+            dispatch_all(q, debug);
+        }
+    }
+    q->count++;
+    return &q->slots[(q->head + q->count - 1) % q->capacity];
+}
+
+/* A cue runs ahead of the stream lane, so the zone's queued colors go into the cue lane before it
+   and still apply first: a color followed by /blink blinks that color. */
+static void promote_stream(int zone, bool debug) {
+    lane_queue_t *sq = &s_lanes[LANE_STREAM];
+    lane_queue_t *cq = &s_lanes[LANE_CUE];
+    for (int i = 0; i < sq->count; i++) {
+        lane_entry_t *e = &sq->slots[(sq->head + i) % sq->capacity];
+        if (!e->cancelled && e->zone == zone) {
+            *push_entry(cq, debug) = *e;
+            e->cancelled = true;
+        }
+    }
+}
+
+static void enqueue_msg(tosc_message *osc, int len, void *ctx) {
+    enqueue_ctx_t *ec = ctx;
+    zone_t *z = zone_route(ec->port, tosc_getAddress(osc));
+    bool cancels_stream;
+
+    if (relay_offer(osc)) {
+        /* Forwarded, not applied; the zone still counts so the sender keeps getting status. */
+        if (z != NULL) {
+            ec->zones |= 1u << z->index;
+        }
+        return;
+    }
+    if (z == NULL) {
+        log_debug("lanes: no zone for %s on port %d", tosc_getAddress(osc), ec->port);
+        return;
+    }
+    ec->zones |= 1u << z->index;
+
+    lane_t lane = classify(z, osc, &cancels_stream);
+    lane_queue_t *q = &s_lanes[lane];
+
+    if (osc->len > LANE_MSG_MAX) {
+        /* Applied on arrival, after everything queued before it. */
+        lanes_dispatch(ec->debug);
+        state_process_osc_msg(z, osc, len, ec->debug);
+        return;
+    }
+    if (cancels_stream) {
+        /* An unprefixed scene recall replaces every zone's look. */
+        bool all = z->prefix_len == 0 && strcmp(tosc_getAddress(osc), "/scene/recall") == 0;
+        cancel_stream(all ? -1 : z->index);
+    }
+    if (lane == LANE_STREAM) {
+        coalesce_stream(z->index);
+    } else {
+        promote_stream(z->index, ec->debug);
+    }
+
+    lane_entry_t *e = push_entry(q, ec->debug);
+    e->enqueued_ns = timebase_now_ns();
+    e->len = (uint16_t)osc->len;
+    e->zone = (uint8_t)z->index;
+    e->cancelled = false;
+    memcpy(e->data, osc->buffer, osc->len);
+}
+
+void lanes_init(void) {
+    for (int i = 0; i < LANE_COUNT; i++) {
+        lane_queue_t *q = &s_lanes[i];
+        const char *name = q->stats.name;
+        q->head = 0;
+        q->count = 0;
+        q->avg_delay_ns = 0;
+        q->max_delay_ns = 0;
+        memset(&q->stats, 0, sizeof(q->stats));
+        q->stats.name = name;
+    }
+}
+
+/* Returns a bitmask of the zones the packet addressed, or 0 if it was malformed or matched none. */
+unsigned lanes_enqueue_packet(char *buffer, int len, int port, bool debug) {
+    enqueue_ctx_t ec = { port, debug, 0 };
+    if (!state_parse_packet(buffer, len, enqueue_msg, &ec)) {
+        return 0;
+    }
+    return ec.zones;
+}
+
+typedef struct {
+    int port;
+    int streams;
+    bool other;
+} stream_check_ctx_t;
+
+static void check_msg(tosc_message *osc, int len, void *ctx) {
+    stream_check_ctx_t *sc = ctx;
+    zone_t *z = zone_route(sc->port, tosc_getAddress(osc));
+    bool cancels_stream;
+    (void)len;
+
+    if (z != NULL && classify(z, osc, &cancels_stream) == LANE_STREAM) {
+        sc->streams++;
+    } else {
+        sc->other = true;
+    }
+}
+
+/* True if every message in the packet would go to the stream lane, so a newer one can replace it. */
+bool lanes_packet_is_stream(char *buffer, int len, int port) {
+    stream_check_ctx_t sc = { port, 0, false };
+    return state_parse_packet(buffer, len, check_msg, &sc) && sc.streams > 0 && !sc.other;
+}
+
+static void dispatch_one(lane_queue_t *q, uint64_t now, bool debug) {
+    lane_entry_t *e = &q->slots[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    if (e->cancelled) {
+        return;
+    }
+
+    uint64_t delay = now - e->enqueued_ns;
+    q->avg_delay_ns = q->avg_delay_ns == 0 ? delay : q->avg_delay_ns - q->avg_delay_ns / 8 + delay / 8;
+    if (delay > q->max_delay_ns) {
+        q->max_delay_ns = delay;
+    }
+    q->stats.dispatched++;
+
+    tosc_message osc;
+    zone_t *z = zone_get(e->zone);
+    if (z != NULL && tosc_parseMessage(&osc, e->data, e->len) == 0) {
+        state_process_osc_msg(z, &osc, e->len, debug);
+    }
+}
+
+void lanes_dispatch(bool debug) {
+    for (int i = 0; i < LANE_COUNT; i++) {
+        dispatch_all(&s_lanes[i], debug);
+    }
+}
+
+int lanes_next_timeout_ms(void) {
+    for (int i = 0; i < LANE_COUNT; i++) {
+        if (s_lanes[i].count > 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void lanes_stats(lane_t lane, lane_stats_t *out) {
+    const lane_queue_t *q = &s_lanes[lane];
+    *out = q->stats;
+    out->depth = q->count;
+    out->avg_delay_us = (uint32_t)(q->avg_delay_ns / 1000u);
+    out->max_delay_us = (uint32_t)(q->max_delay_ns / 1000u);
+}
+
+void lanes_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len) {
+    char outbuf[128];
+    char addr[32];
+
+    for (int i = 0; i < LANE_COUNT; i++) {
+        lane_stats_t st;
+        lanes_stats((lane_t)i, &st);
+        snprintf(addr, sizeof(addr), "/status/lane/%s", st.name);
+        uint32_t n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "iii", st.depth, (int32_t)st.avg_delay_us,
+                                       (int32_t)st.max_delay_us);
+        if (n > 0) {
+            sendto(fd, outbuf, (size_t)n, 0, peer, peer_len);
+        }
+        s_lanes[i].max_delay_ns = 0;
+    }
+}
+
+void lanes_log_stats(void) {
+    for (int i = 0; i < LANE_COUNT; i++) {
+        lane_stats_t st;
+        lanes_stats((lane_t)i, &st);
+        log_info("lanes: %s dispatched %llu, dropped %llu, cancelled %llu, coalesced %llu, avg delay %u us",
+                 st.name, (unsigned long long)st.dispatched, (unsigned long long)st.dropped,
+                 (unsigned long long)st.cancelled, (unsigned long long)st.coalesced, st.avg_delay_us);
+    }
+}
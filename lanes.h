@@ -0,0 +1,35 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Lanes in priority order: everything in a higher lane is dispatched before a lower one. */
+typedef enum {
+    LANE_CUE,    /* Blackout, blink and other one-shot cues */
+    LANE_STREAM, /* Continuous color updates from faders and effects */
+    LANE_COUNT
+} lane_t;
+
+typedef struct {
+    const char *name;
+    int depth;
+    uint64_t dispatched;
+    uint64_t dropped;
+    uint64_t cancelled;
+    uint64_t coalesced; /* Stream frames superseded by a newer color for the same zone */
+    uint32_t avg_delay_us; /* Moving average of enqueue-to-dispatch time */
+    uint32_t max_delay_us; /* Worst case since the last lanes_send_status() */
+} lane_stats_t;
+
+void lanes_init(void);
+unsigned lanes_enqueue_packet(char *buffer, int len, int port, bool debug);
+bool lanes_packet_is_stream(char *buffer, int len, int port);
+void lanes_dispatch(bool debug);
+int lanes_next_timeout_ms(void);
+void lanes_stats(lane_t lane, lane_stats_t *out);
+void lanes_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len);
+void lanes_log_stats(void);
+
+#endif /* LANES_H */
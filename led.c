@@ -1,111 +1,439 @@
 #include "led.h"
 #include "config.h"
-#include "log.h"
-#include "hidapi.h"
-#include <math.h>
+#include "settings.h"
+#include "alog.h"
+#include "slicky.h"
+#include "tinyosc.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
-static hid_device *s_dev;
+/* One session per distinct serial; zones that name the same light share it.
+   While `recovering` is set the session's device belongs to the recovery thread and the
+   main loop does not touch it. */
+typedef struct {
+    bool used;
+    char serial[64];
+    slicky_device *dev;
+    unsigned logged_fps;
+    led_health_t health;
+    bool recovering;
+    bool reconnected;          /* Set by the recovery thread, consumed by led_handle_readable() */
+    uint64_t retry_ns;
+    unsigned backoff_ms;       /* Owned by the recovery thread while recovering */
+    unsigned error_streak;     /* Failed writes since the light was last healthy */
+    uint64_t last_issue_ns;
+    uint64_t write_avg_ns;
+    led_stats_t stats;
+} led_session_t;
 
-static bool is_connected(void) {
-    if (s_dev != NULL) {
-        hid_close(s_dev);
+static led_session_t s_sessions[LED_MAX_SESSIONS];
+static bool s_test_mode;
+static uint8_t s_lut[3][256];
+static bool s_lut_active;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER; /* Held around device open/close */
+static pthread_t s_thread;
+static bool s_thread_running;
+static bool s_stop;
+static int s_doorbell[2] = { -1, -1 };
+static FILE *s_trace;
+
+static const char *const s_health_names[] = { "healthy", "degraded", "offline" };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static const char *describe(const led_session_t *ls) {
+    return ls->serial[0] != '\0' ? ls->serial : "(any)";
+}
+
+static void set_health(led_session_t *ls, led_health_t health) {
+    if (ls->health == health) {
+        return;
+    }
+    if (health == LED_HEALTHY) {
+        log_info("led: serial %s is healthy again", describe(ls));
+    } else {
+        log_warn("led: serial %s is %s", describe(ls), s_health_names[health]);
+    }
+    ls->health = health;
+}
+
+static void go_offline(led_session_t *ls, uint64_t now) {
+    set_health(ls, LED_OFFLINE);
+    ls->last_issue_ns = now;
+    ls->backoff_ms = SLICKY_REOPEN_MS;
+    ls->retry_ns = now + (uint64_t)ls->backoff_ms * 1000000u;
+    ls->write_avg_ns = 0;
+    ls->logged_fps = 0;
+    __atomic_store_n(&ls->recovering, true, __ATOMIC_RELEASE);
+}
+
+static void open_session(led_session_t *ls) {
+    const settings_t *cfg = settings();
+    ls->dev = slicky_open((unsigned short)cfg->vendor_id, (unsigned short)cfg->product_id, ls->serial);
+    ls->health = LED_HEALTHY;
+    ls->recovering = false;
+    ls->reconnected = false;
+    ls->error_streak = 0;
+    if (!slicky_connected(ls->dev)) {
+        log_info("HID error: No device connected (serial %s).", describe(ls));
+        go_offline(ls, now_ns());
     }
-    s_dev = hid_open(VENDOR_ID, PRODUCT_ID, NULL);
-    return (s_dev != NULL);
 }
 
-static int write_buffer(unsigned char buf[65]) {
-    int res = -1;
-    /* test_mode is handled in led_init: we never call hid_write in test mode */
-    if (is_connected()) {
-        res = hid_write(s_dev, buf, 65);
-        if (res < 0) {
-            log_error("Error: Problem writing to hid device.");
+/* Reopens offline devices off the network loop; hid_open can take a while on a struggling hub. */
+static void *recovery_thread(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, LED_RECOVERY_POLL_MS * 1000000L };
+
+    while (!__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) {
+        uint64_t now = now_ns();
+        for (int i = 0; i < LED_MAX_SESSIONS; i++) {
+            led_session_t *ls = &s_sessions[i];
+            if (!__atomic_load_n(&ls->recovering, __ATOMIC_ACQUIRE) ||
+                __atomic_load_n(&ls->reconnected, __ATOMIC_ACQUIRE) || now < ls->retry_ns) {
+                continue;
+            }
+            pthread_mutex_lock(&s_lock);
+            bool ok = ls->used && ls->dev != NULL && slicky_reconnect(ls->dev);
+            pthread_mutex_unlock(&s_lock);
+            if (ok) {
+                __atomic_store_n(&ls->reconnected, true, __ATOMIC_RELEASE);
+                if (write(s_doorbell[1], "r", 1) < 0) { }
+            } else {
+                /* Back off so a dead hub is not hammered with opens. */
+                ls->backoff_ms = ls->backoff_ms * 2 < LED_RECOVERY_MAX_MS ? ls->backoff_ms * 2 : LED_RECOVERY_MAX_MS;
+                ls->retry_ns = now + (uint64_t)ls->backoff_ms * 1000000u;
+            }
         }
-    } else {
-        log_info("HID error: No device connected.");
-    }
-    return res;
-}
-
-static int set_color(unsigned char r, unsigned char g, unsigned char b, unsigned char w) {
-    unsigned char buf[65];
-    buf[0] = 0x00;
-    buf[1] = 0x0A;
-    buf[2] = 0x04;
-    buf[3] = 0x00;
-    buf[4] = 0x00;
-    buf[5] = w;
-    buf[6] = b;
-    buf[7] = g;
-    buf[8] = r;
-    return write_buffer(buf);
-}
-
-static color_rgb_t hsv_to_rgb(float H, float S, float V) {
-    H = fmodf(H, 1.0f);
-
-    float h = H * 6;
-    unsigned char i = (unsigned char)floorf(h);
-    float a = V * (1 - S);
-    float b = V * (1 - S * (h - i));
-    float c = V * (1 - (S * (1 - (h - i))));
-    float rf, gf, bf;
-
-    switch (i) {
-        case 0:
-            rf = V * 255; gf = c * 255; bf = a * 255;
-            break;
-        case 1:
-            rf = b * 255; gf = V * 255; bf = a * 255;
-            break;
-        case 2:
-            rf = a * 255; gf = V * 255; bf = c * 255;
-            break;
-        case 3:
-            rf = a * 255; gf = b * 255; bf = V * 255;
-            break;
-        case 4:
-            rf = c * 255; gf = a * 255; bf = V * 255;
-            break;
-        case 5:
-        default:
-            rf = V * 255; gf = a * 255; bf = b * 255;
-            break;
-    }
-
-    unsigned char R = (unsigned char)rf;
-    unsigned char G = (unsigned char)gf;
-    unsigned char B = (unsigned char)bf;
-    return (color_rgb_t)((R << 16) | (G << 8) | B);
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
 }
 
 void led_init(bool test_mode) {
+    s_test_mode = test_mode;
     if (test_mode) {
-        s_dev = NULL;
         return;
     }
-    if (hid_init() < 0) {
+    if (slicky_init() < 0) {
         log_info("Error: Problem initializing the hidapi library.");
     }
-    s_dev = hid_open(VENDOR_ID, PRODUCT_ID, NULL);
+    if (pipe(s_doorbell) < 0) {
+        log_error("led: cannot create recovery pipe: %s", strerror(errno));
+        return;
+    }
+    fcntl(s_doorbell[0], F_SETFL, O_NONBLOCK);
+    fcntl(s_doorbell[1], F_SETFL, O_NONBLOCK);
+    s_stop = false;
+    if (pthread_create(&s_thread, NULL, recovery_thread, NULL) != 0) {
+        log_error("led: cannot start recovery thread; offline lights stay offline");
+        return;
+    }
+    s_thread_running = true;
 }
 
-void led_set_rgb(color_rgb_t rgb) {
-    /* In test mode, hid_device is NULL and is_connected() will fail; skip actual write */
-    if (s_dev == NULL) {
+int led_open(const char *serial) {
+    int free_slot = -1;
+
+    if (serial == NULL) {
+        serial = "";
+    }
+    for (int i = 0; i < LED_MAX_SESSIONS; i++) {
+        if (s_sessions[i].used && strcmp(s_sessions[i].serial, serial) == 0) {
+            return i;
+        }
+        if (!s_sessions[i].used && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0 || strlen(serial) >= sizeof(s_sessions[0].serial)) {
+        log_error("led: cannot open a session for serial %s", serial);
+        return -1;
+    }
+
+    led_session_t *ls = &s_sessions[free_slot];
+    memset(ls, 0, sizeof(*ls));
+    ls->used = true;
+    strcpy(ls->serial, serial);
+    /* In test mode the session has no device and writes are skipped. */
+    if (!s_test_mode) {
+        open_session(ls);
+    }
+    return free_slot;
+}
+
+void led_close_all(void) {
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < LED_MAX_SESSIONS; i++) {
+        if (s_sessions[i].used && s_sessions[i].dev != NULL) {
+            slicky_close(s_sessions[i].dev);
+        }
+        memset(&s_sessions[i], 0, sizeof(s_sessions[i]));
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+/* Re-targets open sessions after VID/PID changed; the next render rewrites the color. */
+void led_configure(void) {
+    if (s_test_mode) {
+        return;
+    }
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < LED_MAX_SESSIONS; i++) {
+        if (s_sessions[i].used) {
+            slicky_close(s_sessions[i].dev);
+            open_session(&s_sessions[i]);
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+/* LUT file: up to 256 lines of "r g b" (0-255), one per input level; '#' starts a comment. */
+bool led_load_lut(const char *path) {
+    uint8_t lut[3][256];
+    char line[128];
+    int n = 0;
+
+    if (path == NULL || path[0] == '\0') {
+        s_lut_active = false;
+        return true;
+    }
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        log_error("lut: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    while (n < 256 && fgets(line, sizeof(line), f) != NULL) {
+        int r, g, b;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        int fields = sscanf(line, "%d %d %d", &r, &g, &b);
+        if (fields <= 0) continue;
+        if (fields != 3 || r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
+            log_error("lut: %s: bad entry %d", path, n);
+            fclose(f);
+            return false;
+        }
+        lut[0][n] = (uint8_t)r;
+        lut[1][n] = (uint8_t)g;
+        lut[2][n] = (uint8_t)b;
+        n++;
+    }
+    fclose(f);
+    if (n != 256) {
+        log_error("lut: %s has %d entries, expected 256", path, n);
+        return false;
+    }
+    memcpy(s_lut, lut, sizeof(s_lut));
+    s_lut_active = true;
+    log_info("lut: loaded %s", path);
+    return true;
+}
+
+void led_write(int handle, color_rgb_t rgb) {
+    if (handle < 0 || handle >= LED_MAX_SESSIONS || !s_sessions[handle].used) {
+        return;
+    }
+    led_session_t *ls = &s_sessions[handle];
+    if (s_lut_active) {
+        rgb = ((color_rgb_t)s_lut[0][(rgb >> 16) & 0xFF] << 16) | ((color_rgb_t)s_lut[1][(rgb >> 8) & 0xFF] << 8) |
+              s_lut[2][rgb & 0xFF];
+    }
+    if (s_trace != NULL) {
+        fprintf(s_trace, "%llu %s %06x\n", (unsigned long long)(timebase_now_ns() / 1000u), describe(ls),
+                rgb & 0xFFFFFF);
+    }
+    if (ls->dev == NULL || __atomic_load_n(&ls->recovering, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+    int res = slicky_set_rgb(ls->dev, rgb);
+    uint64_t now = now_ns();
+    uint64_t took = now - start;
+
+    if (res < 0) {
+        ls->stats.errors++;
+        ls->error_streak++;
+        log_error("Error: Problem writing to hid device (serial %s, %u failures since last healthy).", describe(ls),
+                  ls->error_streak);
+        go_offline(ls, now);
         return;
     }
-    set_color((rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF, 0);
+    ls->stats.writes++;
+
+    /* A write far slower than usual is the first sign of a browning-out hub. */
+    if (ls->stats.writes > LED_SPIKE_WARMUP && took > ls->write_avg_ns * LED_SPIKE_FACTOR &&
+        took > (uint64_t)LED_SPIKE_MIN_US * 1000u) {
+        ls->stats.spikes++;
+        ls->last_issue_ns = now;
+        log_warn("led: serial %s write took %llu us (usually %llu us)", describe(ls),
+                 (unsigned long long)(took / 1000u), (unsigned long long)(ls->write_avg_ns / 1000u));
+        set_health(ls, LED_DEGRADED);
+    }
+    ls->write_avg_ns = ls->write_avg_ns == 0 ? took : ls->write_avg_ns - ls->write_avg_ns / 16 + took / 16;
+    if (ls->health == LED_DEGRADED && now - ls->last_issue_ns >= (uint64_t)LED_HEALTH_WINDOW_MS * 1000000u) {
+        ls->error_streak = 0;
+        set_health(ls, LED_HEALTHY);
+    }
+
+    /* Report the measured rate when it settles and whenever it moves by a quarter or more. */
+    unsigned fps = slicky_max_fps(ls->dev);
+    if (fps != 0 && (ls->logged_fps == 0 || fps * 4 < ls->logged_fps * 3 || fps * 4 > ls->logged_fps * 5)) {
+        log_info("led: serial %s sustains about %u writes/s", describe(ls), fps);
+        ls->logged_fps = fps;
+    }
+}
+
+/* Every frame written, as "<timebase us> <serial> <rrggbb>", test mode included; NULL stops. */
+void led_set_trace(FILE *out) { s_trace = out; }
+
+int led_health_fd(void) { return s_doorbell[0]; }
+
+/* Hands recovered devices back to the main loop. Returns true if any came back, so the caller
+   can rewrite the current frame to them. They stay degraded until a clean LED_HEALTH_WINDOW_MS. */
+bool led_handle_readable(void) {
+    char buf[16];
+    bool any = false;
+
+    while (read(s_doorbell[0], buf, sizeof(buf)) > 0) { }
+    for (int i = 0; i < LED_MAX_SESSIONS; i++) {
+        led_session_t *ls = &s_sessions[i];
+        if (!ls->used || !__atomic_load_n(&ls->reconnected, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        ls->stats.reconnects++;
+        ls->last_issue_ns = now_ns();
+        __atomic_store_n(&ls->reconnected, false, __ATOMIC_RELAXED);
+        __atomic_store_n(&ls->recovering, false, __ATOMIC_RELEASE);
+        log_info("HID device connected (serial %s).", describe(ls));
+        set_health(ls, LED_DEGRADED);
+        any = true;
+    }
+    return any;
 }
 
-void led_pattern_rainbow(float *p_hue, uint8_t repeat) {
-    (void)repeat;
-    color_rgb_t rgb = hsv_to_rgb(*p_hue + 1.0f, 1.0f, 1.0f);
-    led_set_rgb(rgb);
-    *p_hue += 0.05f;
-    if (*p_hue > 1.0f) {
-        *p_hue -= 1.0f;
+const char *led_health_name(led_health_t health) { return s_health_names[health]; }
+
+/* Test-mode sessions have no device and always report healthy. */
+led_health_t led_health(int handle) {
+    if (handle < 0 || handle >= LED_MAX_SESSIONS || !s_sessions[handle].used) {
+        return LED_OFFLINE;
+    }
+    return s_sessions[handle].health;
+}
+
+int led_stats(led_stats_t *out, int max) {
+    int n = 0;
+    for (int i = 0; i < LED_MAX_SESSIONS && n < max; i++) {
+        const led_session_t *ls = &s_sessions[i];
+        if (!ls->used) {
+            continue;
+        }
+        out[n] = ls->stats;
+        snprintf(out[n].serial, sizeof(out[n].serial), "%s", describe(ls));
+        out[n].health = ls->health;
+        out[n].max_fps = led_max_fps(i);
+        n++;
+    }
+    return n;
+}
+
+void led_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len) {
+    led_stats_t st[LED_MAX_SESSIONS];
+    char outbuf[192];
+    char addr[32];
+    int n = led_stats(st, LED_MAX_SESSIONS);
+
+    for (int i = 0; i < n; i++) {
+        snprintf(addr, sizeof(addr), "/status/device/%d", i);
+        uint32_t len = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "ssiii", st[i].serial,
+                                         s_health_names[st[i].health], (int32_t)st[i].errors,
+                                         (int32_t)st[i].reconnects, (int32_t)st[i].max_fps);
+        if (len > 0) {
+            sendto(fd, outbuf, (size_t)len, 0, peer, peer_len);
+        }
+    }
+}
+
+void led_log_stats(void) {
+    led_stats_t st[LED_MAX_SESSIONS];
+    int n = led_stats(st, LED_MAX_SESSIONS);
+
+    for (int i = 0; i < n; i++) {
+        log_info("led: serial %s %s, %llu writes, %llu errors, %llu reconnects, %llu latency spikes", st[i].serial,
+                 s_health_names[st[i].health], (unsigned long long)st[i].writes, (unsigned long long)st[i].errors,
+                 (unsigned long long)st[i].reconnects, (unsigned long long)st[i].spikes);
+    }
+}
+
+/* 0 while the rate is unknown (test mode, disconnected or still measuring); callers then do not clamp. */
+unsigned led_max_fps(int handle) {
+    if (handle < 0 || handle >= LED_MAX_SESSIONS || s_sessions[handle].dev == NULL ||
+        __atomic_load_n(&s_sessions[handle].recovering, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return slicky_max_fps(s_sessions[handle].dev);
+}
+
+int led_serials(char *out, size_t out_len) {
+    slicky_info_t infos[8];
+    size_t o = 0;
+
+    if (out_len == 0) {
+        return 0;
+    }
+    out[0] = '\0';
+    if (s_test_mode) {
+        return 0;
+    }
+
+    const settings_t *cfg = settings();
+    int n = slicky_enumerate((unsigned short)cfg->vendor_id, (unsigned short)cfg->product_id, infos,
+                             (int)(sizeof(infos) / sizeof(infos[0])));
+    int count = 0;
+    for (int i = 0; i < n && i < (int)(sizeof(infos) / sizeof(infos[0])); i++) {
+        if (infos[i].serial[0] == '\0') {
+            continue;
+        }
+        if (count > 0 && o + 1 < out_len) {
+            out[o++] = ',';
+        }
+        for (const char *c = infos[i].serial; *c && o + 1 < out_len; c++) {
+            out[o++] = *c != ',' ? *c : '?';
+        }
+        count++;
+    }
+    out[o] = '\0';
+    return count;
+}
+
+void led_shutdown(void) {
+    if (s_thread_running) {
+        __atomic_store_n(&s_stop, true, __ATOMIC_RELEASE);
+        pthread_join(s_thread, NULL);
+        s_thread_running = false;
+    }
+    led_close_all();
+    if (s_doorbell[0] >= 0) {
+        close(s_doorbell[0]);
+        close(s_doorbell[1]);
+        s_doorbell[0] = s_doorbell[1] = -1;
+    }
+    if (!s_test_mode) {
+        slicky_exit();
     }
 }
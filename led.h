@@ -3,11 +3,48 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define LED_MAX_SESSIONS 8
 
 typedef uint32_t color_rgb_t;
 
+/* Write failures and disconnects take a light offline; latency spikes and a recent reconnect
+   leave it degraded until it has behaved for LED_HEALTH_WINDOW_MS. */
+typedef enum {
+    LED_HEALTHY,
+    LED_DEGRADED,
+    LED_OFFLINE
+} led_health_t;
+
+typedef struct {
+    char serial[64];
+    led_health_t health;
+    unsigned max_fps;
+    uint64_t writes;
+    uint64_t errors;
+    uint64_t reconnects;
+    uint64_t spikes;
+} led_stats_t;
+
 void led_init(bool test_mode);
-void led_set_rgb(color_rgb_t rgb);
-void led_pattern_rainbow(float *p_hue, uint8_t repeat);
+int led_open(const char *serial);
+void led_close_all(void);
+void led_configure(void);
+bool led_load_lut(const char *path);
+void led_write(int handle, color_rgb_t rgb);
+void led_set_trace(FILE *out);
+unsigned led_max_fps(int handle);
+int led_health_fd(void);
+bool led_handle_readable(void);
+const char *led_health_name(led_health_t health);
+led_health_t led_health(int handle);
+int led_stats(led_stats_t *out, int max);
+void led_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len);
+void led_log_stats(void);
+int led_serials(char *out, size_t out_len);
+void led_shutdown(void);
 
 #endif /* LED_H */
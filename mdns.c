@@ -0,0 +1,670 @@
+#include "mdns.h"
+#include "netif.h"
+#include "config.h"
+#include "led.h"
+#include "settings.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MDNS_PORT 5353
+#define MDNS_GROUP "224.0.0.251"
+#define MDNS_SERVICE "_osc._udp.local"
+#define MDNS_SERVICES_ENUM "_services._dns-sd._udp.local"
+#define MDNS_PKT_MAX 1024
+#define MDNS_NAME_MAX 256
+#define MDNS_TTL_HOST 120
+#define MDNS_TTL_OTHER 4500
+#define MDNS_PROBE_COUNT 3
+#define MDNS_PROBE_INTERVAL_MS 250
+#define MDNS_ANNOUNCE_COUNT 2
+#define MDNS_ANNOUNCE_INTERVAL_MS 1000
+#define MDNS_CONFLICT_BACKOFF_MS 1000
+#define MDNS_MIN_MULTICAST_GAP_MS 1000
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_TXT 16
+#define DNS_TYPE_SRV 33
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+#define DNS_CACHE_FLUSH 0x8000
+#define DNS_QU 0x8000
+
+typedef enum {
+    MDNS_PROBING,
+    MDNS_ANNOUNCING,
+    MDNS_RUNNING
+} mdns_phase_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    bool overflow;
+} wbuf_t;
+
+/* A pre-encoded response for one interface; the A record differs per interface address. */
+typedef struct {
+    uint8_t data[MDNS_PKT_MAX];
+    size_t len;
+    size_t flush_off[4];
+    int flush_count;
+    uint64_t last_sent_ms;
+    bool pending;
+} mdns_cache_t;
+
+static int s_fd = -1;
+static int s_port;
+static char s_base_name[64];
+static char s_instance[64];
+static char s_instance_full[MDNS_NAME_MAX];
+static char s_host_full[MDNS_NAME_MAX];
+static char s_txt_port[24];
+static char s_txt_feedback[24];
+static char s_txt_serials[200];
+static int s_rename_count;
+static mdns_phase_t s_phase;
+static int s_phase_step;
+static uint64_t s_next_action_ms;
+static mdns_cache_t s_cache[NETIF_MAX];
+static int s_cache_count;
+static struct in_addr s_joined[NETIF_MAX];
+static int s_joined_count;
+
+static uint64_t now_ms(void) {
+    return timebase_now_ns() / 1000000u;
+}
+
+static void put_bytes(wbuf_t *w, const void *p, size_t n) {
+    if (w->len + n > w->cap) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static void put_u8(wbuf_t *w, uint8_t v) { put_bytes(w, &v, 1); }
+
+static void put_u16(wbuf_t *w, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(w, b, 2);
+}
+
+static void put_u32(wbuf_t *w, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(w, b, 4);
+}
+
+/* Names are written uncompressed so cached answers can be spliced behind an echoed question. */
+static void put_name(wbuf_t *w, const char *first_label, const char *dotted) {
+    if (first_label != NULL) {
+        size_t n = strlen(first_label);
+        put_u8(w, (uint8_t)n);
+        put_bytes(w, first_label, n);
+    }
+    while (dotted != NULL && *dotted) {
+        size_t n = strcspn(dotted, ".");
+        put_u8(w, (uint8_t)n);
+        put_bytes(w, dotted, n);
+        dotted += n;
+        if (*dotted == '.') dotted++;
+    }
+    put_u8(w, 0);
+}
+
+static size_t begin_rr(wbuf_t *w, const char *first_label, const char *dotted, uint16_t type,
+                       bool flush, uint32_t ttl, mdns_cache_t *c) {
+    put_name(w, first_label, dotted);
+    put_u16(w, type);
+    if (flush && c != NULL && c->flush_count < 4) {
+        c->flush_off[c->flush_count++] = w->len;
+    }
+    put_u16(w, DNS_CLASS_IN | (flush ? DNS_CACHE_FLUSH : 0));
+    put_u32(w, ttl);
+    size_t rdlen_off = w->len;
+    put_u16(w, 0);
+    return rdlen_off;
+}
+
+static void end_rr(wbuf_t *w, size_t rdlen_off) {
+    if (w->overflow) return;
+    size_t rdlen = w->len - rdlen_off - 2;
+    w->buf[rdlen_off] = (uint8_t)(rdlen >> 8);
+    w->buf[rdlen_off + 1] = (uint8_t)rdlen;
+}
+
+static void put_txt_string(wbuf_t *w, const char *s) {
+    size_t n = strlen(s);
+    if (n > 255) n = 255;
+    put_u8(w, (uint8_t)n);
+    put_bytes(w, s, n);
+}
+
+static void put_srv_record(wbuf_t *w, bool flush, uint32_t ttl, mdns_cache_t *c) {
+    size_t off = begin_rr(w, s_instance, MDNS_SERVICE, DNS_TYPE_SRV, flush, ttl, c);
+    put_u16(w, 0);
+    put_u16(w, 0);
+    put_u16(w, (uint16_t)s_port);
+    put_name(w, NULL, s_host_full);
+    end_rr(w, off);
+}
+
+static void put_txt_record(wbuf_t *w, bool flush, uint32_t ttl, mdns_cache_t *c) {
+    size_t off = begin_rr(w, s_instance, MDNS_SERVICE, DNS_TYPE_TXT, flush, ttl, c);
+    put_txt_string(w, "txtvers=1");
+    put_txt_string(w, s_txt_port);
+    put_txt_string(w, s_txt_feedback);
+    put_txt_string(w, s_txt_serials);
+    end_rr(w, off);
+}
+
+static void encode_response(mdns_cache_t *c, struct in_addr addr, bool goodbye) {
+    uint32_t ttl_other = goodbye ? 0 : MDNS_TTL_OTHER;
+    uint32_t ttl_host = goodbye ? 0 : MDNS_TTL_HOST;
+    wbuf_t w = { c->data, 0, sizeof(c->data), false };
+    size_t off;
+
+    c->flush_count = 0;
+    put_u16(&w, 0);
+    put_u16(&w, 0x8400);
+    put_u16(&w, 0);
+    put_u16(&w, 5);
+    put_u16(&w, 0);
+    put_u16(&w, 0);
+
+    off = begin_rr(&w, NULL, MDNS_SERVICE, DNS_TYPE_PTR, false, ttl_other, c);
+    put_name(&w, s_instance, MDNS_SERVICE);
+    end_rr(&w, off);
+
+    off = begin_rr(&w, NULL, MDNS_SERVICES_ENUM, DNS_TYPE_PTR, false, ttl_other, c);
+    put_name(&w, NULL, MDNS_SERVICE);
+    end_rr(&w, off);
+
+    put_srv_record(&w, true, ttl_host, c);
+    put_txt_record(&w, true, ttl_other, c);
+
+    off = begin_rr(&w, NULL, s_host_full, DNS_TYPE_A, true, ttl_host, c);
+    put_bytes(&w, &addr.s_addr, 4);
+    end_rr(&w, off);
+
+    if (w.overflow) {
+        log_error("mDNS: response does not fit in %d bytes", MDNS_PKT_MAX);
+        c->len = 0;
+        return;
+    }
+    c->len = w.len;
+}
+
+static void rebuild_cache(void) {
+    if (netif_count() == 0) {
+        struct in_addr lo = { .s_addr = htonl(INADDR_LOOPBACK) };
+        encode_response(&s_cache[0], lo, false);
+        s_cache_count = 1;
+        return;
+    }
+    for (int i = 0; i < netif_count(); i++) {
+        encode_response(&s_cache[i], netif_get(i)->addr, false);
+    }
+    s_cache_count = netif_count();
+}
+
+static void sanitize_label(char *dst, size_t dst_len, const char *src) {
+    size_t j = 0;
+    for (size_t i = 0; src[i] && j + 1 < dst_len; i++) {
+        char ch = src[i];
+        if (ch == '.') break;
+        dst[j++] = (isalnum((unsigned char)ch) || ch == '-') ? ch : '-';
+    }
+    dst[j] = '\0';
+    if (j == 0) {
+        snprintf(dst, dst_len, "slicky");
+    }
+}
+
+static void set_instance_name(void) {
+    if (s_rename_count == 0) {
+        snprintf(s_instance, sizeof(s_instance), "%s", s_base_name);
+    } else {
+        snprintf(s_instance, sizeof(s_instance), "%.48s (%d)", s_base_name, s_rename_count + 1);
+    }
+    snprintf(s_instance_full, sizeof(s_instance_full), "%s.%s", s_instance, MDNS_SERVICE);
+}
+
+static void send_to_group(const uint8_t *data, size_t len, int if_index) {
+    struct sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(MDNS_PORT);
+    dest.sin_addr.s_addr = inet_addr(MDNS_GROUP);
+
+    struct in_addr ifaddr = { .s_addr = htonl(INADDR_ANY) };
+    const netif_t *nif = netif_get(if_index);
+    if (nif != NULL) {
+        ifaddr = nif->addr;
+    }
+    setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr));
+    if (sendto(s_fd, data, len, 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+        log_debug("mDNS: send on %s failed: %s", nif != NULL ? nif->name : "default", strerror(errno));
+    }
+}
+
+static void send_cached(int i) {
+    if (s_cache[i].len == 0) return;
+    send_to_group(s_cache[i].data, s_cache[i].len, i);
+    s_cache[i].last_sent_ms = now_ms();
+    s_cache[i].pending = false;
+}
+
+static void send_probe(void) {
+    uint8_t buf[MDNS_PKT_MAX];
+    wbuf_t w = { buf, 0, sizeof(buf), false };
+
+    put_u16(&w, 0);
+    put_u16(&w, 0);
+    put_u16(&w, 1);
+    put_u16(&w, 0);
+    put_u16(&w, 2);
+    put_u16(&w, 0);
+    put_name(&w, s_instance, MDNS_SERVICE);
+    put_u16(&w, DNS_TYPE_ANY);
+    put_u16(&w, DNS_CLASS_IN | DNS_QU);
+    put_srv_record(&w, false, MDNS_TTL_HOST, NULL);
+    put_txt_record(&w, false, MDNS_TTL_OTHER, NULL);
+    if (w.overflow) return;
+
+    int n = netif_count() > 0 ? netif_count() : 1;
+    for (int i = 0; i < n; i++) {
+        send_to_group(buf, w.len, netif_count() > 0 ? i : -1);
+    }
+}
+
+static void start_probing(uint64_t delay_ms) {
+    s_phase = MDNS_PROBING;
+    s_phase_step = 0;
+    /* RFC 6762 8.1: random 0-250 ms before the first probe. */
+    s_next_action_ms = now_ms() + delay_ms + (uint64_t)(rand() % MDNS_PROBE_INTERVAL_MS);
+}
+
+static void handle_conflict(void) {
+    s_rename_count++;
+    set_instance_name();
+    rebuild_cache();
+    log_info("mDNS: name conflict, renaming service to \"%s\"", s_instance);
+    start_probing(MDNS_CONFLICT_BACKOFF_MS);
+}
+
+/* Decodes a possibly-compressed name as dotted text. Returns false on a malformed name. */
+static bool read_name(const uint8_t *pkt, size_t len, size_t *off, char *out, size_t out_len) {
+    size_t pos = *off;
+    size_t o = 0;
+    bool jumped = false;
+    int hops = 0;
+
+    out[0] = '\0';
+    while (pos < len) {
+        uint8_t l = pkt[pos];
+        if (l == 0) {
+            if (!jumped) *off = pos + 1;
+            if (o > 0) out[o - 1] = '\0';
+            return true;
+        }
+        if ((l & 0xC0) == 0xC0) {
+            if (pos + 1 >= len || ++hops > 16) return false;
+            if (!jumped) *off = pos + 2;
+            pos = ((size_t)(l & 0x3F) << 8) | pkt[pos + 1];
+            jumped = true;
+            continue;
+        }
+        if (pos + 1 + l > len || o + l + 1 >= out_len) return false;
+        memcpy(out + o, pkt + pos + 1, l);
+        o += l;
+        out[o++] = '.';
+        out[o] = '\0';
+        pos += 1 + l;
+    }
+    return false;
+}
+
+static uint16_t get_u16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+/* Compares a received SRV/TXT rdata for our instance name against ours: 0 equal, <0 ours sorts first. */
+static int compare_rdata(const uint8_t *pkt, size_t len, size_t rd_off, uint16_t rdlen, uint16_t type) {
+    uint8_t ours_buf[MDNS_PKT_MAX];
+    wbuf_t w = { ours_buf, 0, sizeof(ours_buf), false };
+
+    if (type == DNS_TYPE_SRV) {
+        if (rdlen < 7) return -1;
+        uint16_t their_port = get_u16(pkt + rd_off + 4);
+        char target[MDNS_NAME_MAX];
+        size_t name_off = rd_off + 6;
+        if (!read_name(pkt, len, &name_off, target, sizeof(target))) return -1;
+        if (their_port != (uint16_t)s_port) return (uint16_t)s_port < their_port ? -1 : 1;
+        return strcasecmp(s_host_full, target);
+    }
+
+    put_txt_record(&w, false, 0, NULL);
+    /* Skip the encoded name/type/class/ttl/rdlength to get at our TXT rdata. */
+    size_t hdr = 0;
+    char scratch[MDNS_NAME_MAX];
+    if (w.overflow || !read_name(ours_buf, w.len, &hdr, scratch, sizeof(scratch))) return -1;
+    hdr += 10;
+    size_t ours_rd = w.len - hdr;
+    size_t n = ours_rd < rdlen ? ours_rd : rdlen;
+    int cmp = memcmp(ours_buf + hdr, pkt + rd_off, n);
+    if (cmp != 0) return cmp;
+    return ours_rd == rdlen ? 0 : (ours_rd < rdlen ? -1 : 1);
+}
+
+static void reply_unicast(const struct sockaddr_in *from, const uint8_t *query, size_t qlen,
+                          size_t q_start, size_t q_end, int if_index) {
+    mdns_cache_t *c = &s_cache[if_index];
+    uint8_t buf[MDNS_PKT_MAX * 2];
+    bool legacy = ntohs(from->sin_port) != MDNS_PORT;
+    size_t qbytes = legacy ? q_end - q_start : 0;
+
+    if (c->len == 0 || 12 + qbytes + (c->len - 12) > sizeof(buf) || q_end > qlen) return;
+
+    memcpy(buf, c->data, 12);
+    if (legacy) {
+        /* RFC 6762 6.7: echo ID and question, and drop cache-flush bits for legacy resolvers. */
+        memcpy(buf, query, 2);
+        buf[4] = 0;
+        buf[5] = 1;
+        memcpy(buf + 12, query + q_start, qbytes);
+    }
+    memcpy(buf + 12 + qbytes, c->data + 12, c->len - 12);
+    if (legacy) {
+        for (int i = 0; i < c->flush_count; i++) {
+            buf[c->flush_off[i] + qbytes] &= 0x7F;
+        }
+    }
+    sendto(s_fd, buf, 12 + qbytes + c->len - 12, 0, (const struct sockaddr *)from, sizeof(*from));
+}
+
+static int cache_index_for(struct in_addr peer) {
+    const netif_t *nif = netif_for_peer(peer);
+    for (int i = 0; i < netif_count(); i++) {
+        if (nif == netif_get(i)) return i;
+    }
+    return 0;
+}
+
+static void handle_packet(const uint8_t *pkt, size_t len, const struct sockaddr_in *from) {
+    if (len < 12) return;
+
+    uint16_t flags = get_u16(pkt + 2);
+    int qd = get_u16(pkt + 4), an = get_u16(pkt + 6), ns = get_u16(pkt + 8), ar = get_u16(pkt + 10);
+    bool is_response = (flags & 0x8000) != 0;
+    size_t off = 12;
+    char name[MDNS_NAME_MAX];
+    bool answer = false, probe_for_us = false;
+    size_t first_q_start = 0, first_q_end = 0;
+
+    for (int i = 0; i < qd; i++) {
+        size_t q_start = off;
+        if (!read_name(pkt, len, &off, name, sizeof(name)) || off + 4 > len) return;
+        uint16_t qtype = get_u16(pkt + off);
+        off += 4;
+        if (i == 0) {
+            first_q_start = q_start;
+            first_q_end = off;
+        }
+        if (is_response) continue;
+
+        bool match = false;
+        if ((qtype == DNS_TYPE_PTR || qtype == DNS_TYPE_ANY) &&
+            (strcasecmp(name, MDNS_SERVICE) == 0 || strcasecmp(name, MDNS_SERVICES_ENUM) == 0)) {
+            match = true;
+        } else if (strcasecmp(name, s_instance_full) == 0 &&
+                   (qtype == DNS_TYPE_SRV || qtype == DNS_TYPE_TXT || qtype == DNS_TYPE_ANY)) {
+            match = true;
+            if (ns > 0) probe_for_us = true;
+        } else if (strcasecmp(name, s_host_full) == 0 && (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY)) {
+            match = true;
+        }
+        if (match) {
+            answer = true;
+        }
+    }
+
+    /* Answer, authority and additional records: look for someone else claiming our name. */
+    int records = an + ns + ar;
+    for (int i = 0; i < records; i++) {
+        if (!read_name(pkt, len, &off, name, sizeof(name)) || off + 10 > len) return;
+        uint16_t type = get_u16(pkt + off);
+        uint16_t rdlen = get_u16(pkt + off + 8);
+        size_t rd_off = off + 10;
+        off = rd_off + rdlen;
+        if (off > len) return;
+
+        if (strcasecmp(name, s_instance_full) != 0 || (type != DNS_TYPE_SRV && type != DNS_TYPE_TXT)) {
+            continue;
+        }
+        int cmp = compare_rdata(pkt, len, rd_off, rdlen, type);
+        if (cmp == 0) continue;
+
+        if (is_response) {
+            handle_conflict();
+            return;
+        }
+        if (s_phase == MDNS_PROBING && probe_for_us && cmp < 0) {
+            /* RFC 6762 8.2: simultaneous probe tiebreak; the lexicographically later data wins. */
+            log_info("mDNS: lost probe tiebreak for \"%s\", retrying", s_instance);
+            start_probing(MDNS_CONFLICT_BACKOFF_MS);
+            return;
+        }
+    }
+
+    if (is_response || !answer || s_phase == MDNS_PROBING) return;
+
+    int ci = cache_index_for(from->sin_addr);
+    if (ntohs(from->sin_port) != MDNS_PORT) {
+        reply_unicast(from, pkt, len, first_q_start, first_q_end, ci);
+        return;
+    }
+    /* Port 5353 is shared via SO_REUSEPORT with other responders on this host, so a unicast
+       reply could land on the wrong socket: QU questions get multicast answers too, and
+       probes for our name are defended at once without the per-interface rate limit. */
+    if (probe_for_us || now_ms() - s_cache[ci].last_sent_ms >= MDNS_MIN_MULTICAST_GAP_MS) {
+        send_cached(ci);
+    } else {
+        s_cache[ci].pending = true;
+    }
+}
+
+static void join_groups(void) {
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr.s_addr = inet_addr(MDNS_GROUP);
+
+    for (int i = 0; i < s_joined_count; i++) {
+        mreq.imr_interface = s_joined[i];
+        setsockopt(s_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    s_joined_count = 0;
+
+    int n = netif_count() > 0 ? netif_count() : 1;
+    for (int i = 0; i < n; i++) {
+        mreq.imr_interface.s_addr = netif_count() > 0 ? netif_get(i)->addr.s_addr : htonl(INADDR_ANY);
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            log_error("mDNS: failed to join %s: %s", MDNS_GROUP, strerror(errno));
+            continue;
+        }
+        s_joined[s_joined_count++] = mreq.imr_interface;
+    }
+}
+
+int mdns_init(int port) {
+    char host[128] = "slicky";
+    char label[64];
+
+    s_port = port;
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    sanitize_label(label, sizeof(label), host);
+    snprintf(s_host_full, sizeof(s_host_full), "%s.local", label);
+    snprintf(s_base_name, sizeof(s_base_name), "OSC Cue Light (%.24s:%d)", label, port);
+    set_instance_name();
+
+    snprintf(s_txt_port, sizeof(s_txt_port), "port=%d", port);
+    snprintf(s_txt_feedback, sizeof(s_txt_feedback), "feedback=%d", settings()->feedback_port);
+    char serials[sizeof(s_txt_serials) - 8];
+    led_serials(serials, sizeof(serials));
+    snprintf(s_txt_serials, sizeof(s_txt_serials), "serials=%s", serials);
+
+    s_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_fd < 0) {
+        log_error("mDNS: failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(s_fd, F_SETFL, O_NONBLOCK);
+
+    int on = 1;
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(MDNS_PORT);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_error("mDNS: failed to bind port %d: %s", MDNS_PORT, strerror(errno));
+        close(s_fd);
+        s_fd = -1;
+        return -1;
+    }
+
+    unsigned char ttl = 255;
+    setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    join_groups();
+    rebuild_cache();
+    start_probing(0);
+
+    log_info("mDNS: advertising \"%s\" as %s on %s", s_instance, MDNS_SERVICE, s_host_full);
+    return s_fd;
+}
+
+int mdns_fd(void) { return s_fd; }
+
+void mdns_handle_readable(void) {
+    uint8_t buf[9000];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    while ((len = recvfrom(s_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len)) > 0) {
+        handle_packet(buf, (size_t)len, &from);
+        from_len = sizeof(from);
+    }
+}
+
+void mdns_interfaces_changed(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    join_groups();
+    rebuild_cache();
+    if (s_phase != MDNS_PROBING) {
+        s_phase = MDNS_ANNOUNCING;
+        s_phase_step = 0;
+        s_next_action_ms = now_ms();
+    }
+}
+
+/* TXT contents changed: rebuild the records and re-announce them with the cache-flush bit. */
+void mdns_settings_changed(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    snprintf(s_txt_feedback, sizeof(s_txt_feedback), "feedback=%d", settings()->feedback_port);
+    rebuild_cache();
+    if (s_phase != MDNS_PROBING) {
+        s_phase = MDNS_ANNOUNCING;
+        s_phase_step = 0;
+        s_next_action_ms = now_ms();
+    }
+}
+
+void mdns_tick(void) {
+    if (s_fd < 0) {
+        return;
+    }
+
+    uint64_t now = now_ms();
+    if (s_phase == MDNS_PROBING && now >= s_next_action_ms) {
+        if (s_phase_step < MDNS_PROBE_COUNT) {
+            send_probe();
+            s_phase_step++;
+            s_next_action_ms = now + MDNS_PROBE_INTERVAL_MS;
+        } else {
+            s_phase = MDNS_ANNOUNCING;
+            s_phase_step = 0;
+            s_next_action_ms = now;
+        }
+    }
+    if (s_phase == MDNS_ANNOUNCING && now >= s_next_action_ms) {
+        for (int i = 0; i < s_cache_count; i++) {
+            send_cached(i);
+        }
+        if (++s_phase_step >= MDNS_ANNOUNCE_COUNT) {
+            s_phase = MDNS_RUNNING;
+        } else {
+            s_next_action_ms = now + MDNS_ANNOUNCE_INTERVAL_MS;
+        }
+    }
+    for (int i = 0; i < s_cache_count; i++) {
+        if (s_cache[i].pending && now - s_cache[i].last_sent_ms >= MDNS_MIN_MULTICAST_GAP_MS) {
+            send_cached(i);
+        }
+    }
+}
+
+int mdns_next_timeout_ms(void) {
+    if (s_fd < 0) {
+        return -1;
+    }
+
+    uint64_t now = now_ms();
+    uint64_t next = UINT64_MAX;
+    if (s_phase != MDNS_RUNNING) {
+        next = s_next_action_ms;
+    }
+    for (int i = 0; i < s_cache_count; i++) {
+        if (s_cache[i].pending && s_cache[i].last_sent_ms + MDNS_MIN_MULTICAST_GAP_MS < next) {
+            next = s_cache[i].last_sent_ms + MDNS_MIN_MULTICAST_GAP_MS;
+        }
+    }
+    if (next == UINT64_MAX) return -1;
+    return next <= now ? 0 : (int)(next - now);
+}
+
+void mdns_shutdown(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    if (s_phase != MDNS_PROBING) {
+        for (int i = 0; i < s_cache_count; i++) {
+            struct in_addr addr = netif_count() > 0 ? netif_get(i)->addr : (struct in_addr){ htonl(INADDR_LOOPBACK) };
+            encode_response(&s_cache[i], addr, true);
+            send_cached(i);
+        }
+    }
+    close(s_fd);
+    s_fd = -1;
+}
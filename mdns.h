@@ -0,0 +1,13 @@
+#ifndef MDNS_H
+#define MDNS_H
+
+int mdns_init(int port);
+int mdns_fd(void);
+void mdns_handle_readable(void);
+void mdns_interfaces_changed(void);
+void mdns_settings_changed(void);
+void mdns_tick(void);
+int mdns_next_timeout_ms(void);
+void mdns_shutdown(void);
+
+#endif /* MDNS_H */
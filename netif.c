@@ -0,0 +1,182 @@
+#include "netif.h"
+#include "alog.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+static netif_t s_ifs[NETIF_MAX];
+static int s_count;
+static netif_t s_loopback;
+static bool s_have_loopback;
+static int s_watch_fd = -1;
+
+static bool same_set(const netif_t *a, int a_n, const netif_t *b, int b_n) {
+    if (a_n != b_n) {
+        return false;
+    }
+    for (int i = 0; i < a_n; i++) {
+        if (a[i].addr.s_addr != b[i].addr.s_addr || a[i].netmask.s_addr != b[i].netmask.s_addr ||
+            a[i].index != b[i].index) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool netif_refresh(void) {
+    struct ifaddrs *ifap = NULL;
+    netif_t found[NETIF_MAX];
+    int n = 0;
+
+    if (getifaddrs(&ifap) < 0) {
+        log_error("getifaddrs failed: %s", strerror(errno));
+        return false;
+    }
+
+    s_have_loopback = false;
+    for (struct ifaddrs *ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET) continue;
+        if (!(ifa->ifa_flags & IFF_UP)) continue;
+
+        netif_t nif;
+        memset(&nif, 0, sizeof(nif));
+        strncpy(nif.name, ifa->ifa_name, sizeof(nif.name) - 1);
+        nif.addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+        if (ifa->ifa_netmask != NULL) {
+            nif.netmask = ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr;
+        }
+        nif.index = if_nametoindex(ifa->ifa_name);
+        inet_ntop(AF_INET, &nif.addr, nif.ip, sizeof(nif.ip));
+
+        if (ifa->ifa_flags & IFF_LOOPBACK) {
+            if (!s_have_loopback) {
+                s_loopback = nif;
+                s_have_loopback = true;
+            }
+            continue;
+        }
+        if (!(ifa->ifa_flags & IFF_MULTICAST) || n >= NETIF_MAX) continue;
+        found[n++] = nif;
+    }
+    freeifaddrs(ifap);
+
+    if (same_set(found, n, s_ifs, s_count)) {
+        return false;
+    }
+
+    memcpy(s_ifs, found, sizeof(found[0]) * (size_t)n);
+    s_count = n;
+    for (int i = 0; i < s_count; i++) {
+        log_info("Interface %s: %s", s_ifs[i].name, s_ifs[i].ip);
+    }
+    if (s_count == 0) {
+        log_info("No multicast-capable interfaces up, advertising on loopback only.");
+    }
+    return true;
+}
+
+int netif_count(void) { return s_count; }
+
+const netif_t *netif_get(int i) {
+    if (i < 0 || i >= s_count) {
+        return NULL;
+    }
+    return &s_ifs[i];
+}
+
+const netif_t *netif_for_peer(struct in_addr peer) {
+    if ((ntohl(peer.s_addr) >> 24) == 127) {
+        return s_have_loopback ? &s_loopback : NULL;
+    }
+    for (int i = 0; i < s_count; i++) {
+        if ((s_ifs[i].addr.s_addr & s_ifs[i].netmask.s_addr) == (peer.s_addr & s_ifs[i].netmask.s_addr)) {
+            return &s_ifs[i];
+        }
+    }
+    if (s_count > 0) {
+        return &s_ifs[0];
+    }
+    return s_have_loopback ? &s_loopback : NULL;
+}
+
+/* Resolves a dotted address, or the first IPv4 address of a named interface (loopback included). */
+bool netif_lookup(const char *name_or_ip, struct in_addr *addr) {
+    struct ifaddrs *ifap = NULL;
+    bool found = false;
+
+    if (inet_pton(AF_INET, name_or_ip, addr) == 1) {
+        return true;
+    }
+    if (getifaddrs(&ifap) < 0) {
+        log_error("getifaddrs failed: %s", strerror(errno));
+        return false;
+    }
+    for (struct ifaddrs *ifa = ifap; ifa != NULL && !found; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET && strcmp(ifa->ifa_name, name_or_ip) == 0) {
+            *addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            found = true;
+        }
+    }
+    freeifaddrs(ifap);
+    return found;
+}
+
+int netif_watch_init(void) {
+#ifdef __linux__
+    s_watch_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (s_watch_fd < 0) {
+        log_error("Failed to open netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(s_watch_fd, F_SETFL, O_NONBLOCK);
+
+    struct sockaddr_nl snl;
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    if (bind(s_watch_fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+        log_error("Failed to bind netlink socket: %s", strerror(errno));
+        close(s_watch_fd);
+        s_watch_fd = -1;
+    }
+#endif
+    return s_watch_fd;
+}
+
+int netif_watch_fd(void) { return s_watch_fd; }
+
+bool netif_handle_readable(void) {
+    char buf[4096];
+    bool relevant = false;
+    ssize_t len;
+
+    while ((len = recv(s_watch_fd, buf, sizeof(buf), 0)) > 0) {
+#ifdef __linux__
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned)len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR ||
+                nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK) {
+                relevant = true;
+            }
+        }
+#else
+        relevant = true;
+#endif
+    }
+    return relevant && netif_refresh();
+}
+
+void netif_watch_shutdown(void) {
+    if (s_watch_fd >= 0) {
+        close(s_watch_fd);
+        s_watch_fd = -1;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef NETIF_H
+#define NETIF_H
+
+#include <stdbool.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#define NETIF_MAX 16
+
+typedef struct {
+    char name[IF_NAMESIZE];
+    char ip[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    struct in_addr netmask;
+    unsigned index;
+} netif_t;
+
+bool netif_refresh(void);
+int netif_count(void);
+const netif_t *netif_get(int i);
+const netif_t *netif_for_peer(struct in_addr peer);
+bool netif_lookup(const char *name_or_ip, struct in_addr *addr);
+
+int netif_watch_init(void);
+int netif_watch_fd(void);
+bool netif_handle_readable(void);
+void netif_watch_shutdown(void);
+
+#endif /* NETIF_H */
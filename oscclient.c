@@ -7,6 +7,10 @@
 #include <sys/socket.h> 
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
+#include <sys/select.h>
+#include <time.h>
+#include "config.h"
+#include "reliable.h"
 #include "tinyosc.h"
   
 #define PORT     9000
@@ -83,12 +87,89 @@ long hexdec(const char *hex) {
    return ret; 
 }
 
+/**
+ * @brief send a packet built by main until the server acks it
+ *
+ * Acks arrive on the feedback port; each retry waits twice as long as the last.
+ *
+ * @return the attempt that was acked, or -1 if none was
+ */
+int reliableSend(char *payload, socklen_t payload_len, uint32_t sender, uint32_t seq) {
+    int sockfd;
+    int on = 1;
+    char buffer[MAXLINE];
+    struct sockaddr_in servaddr, local;
+    long rto_ms = RELIABLE_RTO_MS;
+
+    if ( (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+        perror("socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(FEEDBACK_PORT);
+    local.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sockfd, (const struct sockaddr *) &local, sizeof(local)) < 0) {
+        perror("cannot listen for acks on the feedback port");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(PORT);
+    servaddr.sin_addr.s_addr = INADDR_ANY;
+
+    for (int attempt = 1; attempt <= RELIABLE_TRIES; attempt++, rto_ms *= 2) {
+        sendto(sockfd, payload, payload_len, 0x0, (const struct sockaddr *) &servaddr, sizeof(servaddr));
+
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (;;) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long left_ms = rto_ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (left_ms <= 0) {
+                break;
+            }
+            fd_set set;
+            struct timeval tv = { left_ms / 1000, (left_ms % 1000) * 1000 };
+            FD_ZERO(&set);
+            FD_SET(sockfd, &set);
+            if (select(sockfd + 1, &set, NULL, NULL, &tv) <= 0) {
+                break;
+            }
+            ssize_t n = recv(sockfd, buffer, sizeof(buffer), 0);
+            tosc_message osc;
+            if (n <= 0 || tosc_isBundle(buffer) || tosc_parseMessage(&osc, buffer, (int)n) != 0 ||
+                strcmp(tosc_getAddress(&osc), RELIABLE_ACK_ADDRESS) != 0 || strcmp(tosc_getFormat(&osc), "iii") != 0) {
+                continue; /* Status replies share the port */
+            }
+            uint32_t id = (uint32_t)tosc_getNextInt32(&osc);
+            uint32_t cum = (uint32_t)tosc_getNextInt32(&osc);
+            uint32_t window = (uint32_t)tosc_getNextInt32(&osc);
+            if (id == sender && (seq <= cum || (seq - cum <= 32 && (window & (1u << (seq - cum - 1)))))) {
+                close(sockfd);
+                return attempt;
+            }
+        }
+    }
+    close(sockfd);
+    return -1;
+}
+
 int main(int argc, char *argv[]) {
   // declare a buffer for writing the OSC packet into
   char buffer[1024];
+  int reliable = 0;
 
+  if (argc == 4 && strcmp(argv[1], "-r") == 0) {
+    reliable = 1;
+    argv++;
+    argc--;
+  }
   if (argc != 3) {
-    printf("Usage: %s command value\n\ncommand is typically setcolor or blink followed by a hex value\n\n", argv[0]);
+    printf("Usage: %s [-r] command value\n\ncommand is typically setcolor or blink followed by a hex value\n"
+           "-r sends it reliably: retransmitted until the server acks it on port %d\n\n", argv[0], FEEDBACK_PORT);
     return 1; 
   }
 
@@ -101,15 +182,37 @@ int main(int argc, char *argv[]) {
   // returns the number of bytes written to the buffer, negative on error
   // note that tosc_write will clear the entire buffer before writing to it
   int len;
+  int is_hex = strncmp(command,"/setcolorhex",13) == 0;
+  long color = is_hex ? 0 : hexdec(argv[2]);
+
+  if (reliable) {
+    // a bundle led by the /rel marker; each run is a new sender starting at seq 1
+    tosc_bundle bundle;
+    uint32_t sender = (uint32_t)getpid() ^ (uint32_t)time(NULL) << 16;
+    tosc_writeBundle(&bundle, 1, buffer, sizeof(buffer));
+    tosc_writeNextMessage(&bundle, RELIABLE_ADDRESS, "ii", (int32_t)sender, 1);
+    if (is_hex) {
+      tosc_writeNextMessage(&bundle, command, "s", argv[2]);
+    } else {
+      tosc_writeNextMessage(&bundle, command, "i", color);
+    }
+    len = (int)tosc_getBundleLength(&bundle);
+    int attempt = reliableSend(buffer, len, sender, 1);
+    if (attempt < 0) {
+      printf(", no ack after %d attempts\n", RELIABLE_TRIES);
+      return 1;
+    }
+    printf(", acked (attempt %d)\n", attempt);
+    return 0;
+  }
 
-  if (strncmp(command,"/setcolorhex",13) == 0) {
+  if (is_hex) {
     len = tosc_writeMessage(
         buffer, sizeof(buffer),
         command, // the address
         "s",   // the format; 'f':32-bit float, 's':ascii string, 'i':32-bit integer
         argv[2]);
   } else {
-    long color = hexdec(argv[2]);
     len = tosc_writeMessage(
         buffer, sizeof(buffer),
         command, // the address
@@ -0,0 +1,125 @@
+#include "oscgroup.h"
+#include "netif.h"
+#include "config.h"
+#include "settings.h"
+#include "zone.h"
+#include "alog.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int s_fd = -1;
+static int s_port;
+static struct in_addr s_group;
+static struct in_addr s_joined[NETIF_MAX];
+static int s_joined_count;
+
+/* With listen_address set only that interface joins, so group traffic is confined like unicast. */
+static void join_groups(void) {
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = s_group;
+
+    for (int i = 0; i < s_joined_count; i++) {
+        mreq.imr_interface = s_joined[i];
+        setsockopt(s_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    s_joined_count = 0;
+
+    if (settings()->listen_address[0] != '\0' || netif_count() == 0) {
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (settings()->listen_address[0] != '\0' && !netif_lookup(settings()->listen_address, &mreq.imr_interface)) {
+            log_error("group: no IPv4 address for listen_address %s", settings()->listen_address);
+            return;
+        }
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
+            s_joined[s_joined_count++] = mreq.imr_interface;
+        }
+        return;
+    }
+    for (int i = 0; i < netif_count(); i++) {
+        mreq.imr_interface = netif_get(i)->addr;
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            log_error("group: cannot join %s on %s: %s", inet_ntoa(s_group), netif_get(i)->name, strerror(errno));
+            continue;
+        }
+        s_joined[s_joined_count++] = mreq.imr_interface;
+    }
+}
+
+void oscgroup_init(void) {
+    const settings_t *cfg = settings();
+
+    if (cfg->osc_group[0] == '\0') {
+        return;
+    }
+    if (inet_pton(AF_INET, cfg->osc_group, &s_group) != 1 || !IN_MULTICAST(ntohl(s_group.s_addr))) {
+        log_error("group: %s is not an IPv4 multicast address", cfg->osc_group);
+        return;
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        if (zone_get(i)->port == cfg->osc_group_port) {
+            log_error("group: port %d is already a zone port", cfg->osc_group_port);
+            return;
+        }
+    }
+
+    s_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_fd < 0) {
+        log_error("group: cannot create socket: %s", strerror(errno));
+        return;
+    }
+    fcntl(s_fd, F_SETFL, O_NONBLOCK);
+
+    /* Several servers on one host may share the group port. */
+    int on = 1;
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(cfg->osc_group_port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_error("group: cannot bind port %d: %s", cfg->osc_group_port, strerror(errno));
+        close(s_fd);
+        s_fd = -1;
+        return;
+    }
+    s_port = cfg->osc_group_port;
+    join_groups();
+    log_info("group: OSC on %s:%d, member of all%s%s", cfg->osc_group, s_port,
+             cfg->groups[0] != '\0' ? ", " : "", cfg->groups);
+}
+
+int oscgroup_fd(void) { return s_fd; }
+
+/* 0 when multicast input is off, so no listener port can match it. */
+int oscgroup_port(void) { return s_fd >= 0 ? s_port : 0; }
+
+void oscgroup_interfaces_changed(void) {
+    if (s_fd >= 0) {
+        join_groups();
+    }
+}
+
+void oscgroup_settings_changed(void) {
+    oscgroup_shutdown();
+    oscgroup_init();
+}
+
+void oscgroup_shutdown(void) {
+    if (s_fd >= 0) {
+        close(s_fd);
+        s_fd = -1;
+    }
+    s_joined_count = 0;
+}
@@ -0,0 +1,13 @@
+#ifndef OSCGROUP_H
+#define OSCGROUP_H
+
+/* Multicast OSC input: one datagram to the group reaches every server that joined it. Which
+   of them act on it is chosen by /group/<name>/ addressing (see zone_strip_group). */
+void oscgroup_init(void);
+int oscgroup_fd(void);
+int oscgroup_port(void);
+void oscgroup_interfaces_changed(void);
+void oscgroup_settings_changed(void);
+void oscgroup_shutdown(void);
+
+#endif /* OSCGROUP_H */
@@ -0,0 +1,215 @@
+#include "config.h"
+#include "capture.h"
+#include "led.h"
+#include "cli.h"
+#include "lanes.h"
+#include "settings.h"
+#include "state.h"
+#include "zone.h"
+#include "pattern.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+static uint64_t real_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* With a virtual clock this jumps; otherwise it really waits. */
+static void advance_to(uint64_t deadline_ns) {
+    if (timebase_is_virtual()) {
+        timebase_advance_to(deadline_ns);
+        return;
+    }
+    uint64_t now = timebase_now_ns();
+    if (deadline_ns <= now) {
+        return;
+    }
+    uint64_t wait = deadline_ns - now;
+    struct timespec ts = { (time_t)(wait / 1000000000u), (long)(wait % 1000000000u) };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) { }
+}
+
+/* Renders every frame the server would have drawn up to the deadline: blinks, patterns and
+   fades keep running between packets, exactly as in oscserver's loop. */
+static void run_until(uint64_t deadline_ns) {
+    for (;;) {
+        state_render();
+        uint64_t next = state_next_render_ns();
+        if (next <= timebase_now_ns()) {
+            next = timebase_now_ns() + 1000000u; /* Output held for pacing; check again shortly */
+        }
+        if (next > deadline_ns) {
+            break;
+        }
+        advance_to(next);
+    }
+    advance_to(deadline_ns);
+}
+
+static void print_usage(const char *program_name) {
+    printf("\nUsage: %s [OPTIONS] capture-file\n\n", program_name);
+    printf("Feeds a capture recorded with oscserver --record back through the lanes and dispatch path.\n\n");
+    printf("Options:\n");
+    printf("  -c, --config F  Zone layout and settings file the server ran with\n");
+    printf("  -d, --debug     Enable debug mode\n");
+    printf("  -f, --fast      Replay on a virtual clock as fast as possible instead of at recorded speed\n");
+    printf("  -h, --help      Show this help message\n");
+    printf("  -o, --frames F  Write every light update to F (\"-\" for stdout) as \"<us> <serial> <rrggbb>\"\n");
+    printf("  -p, --port N    Main OSC port the server ran with (default %d)\n", cli_port());
+    printf("  -t, --tail MS   Keep rendering for MS after the last packet\n");
+    printf("  -u, --usb       Drive the USB device instead of the test-mode backend\n");
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool debug = false;
+    bool fast = false;
+    bool usb = false;
+    const char *frames_path = NULL;
+    const char *config_path = NULL;
+    int port = cli_port();
+    uint64_t tail_ns = 0;
+    int opt;
+    const char *short_options = "c:dfho:p:t:u";
+    struct option long_options[] = {
+        {"config", required_argument, 0, 'c'},
+        {"debug", no_argument, 0, 'd'},
+        {"fast", no_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"frames", required_argument, 0, 'o'},
+        {"port", required_argument, 0, 'p'},
+        {"tail", required_argument, 0, 't'},
+        {"usb", no_argument, 0, 'u'},
+        {0, 0, 0, 0}
+    };
+
+    alog_set_level(LOG_INFO);
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
+            case 'd':
+                debug = true;
+                alog_set_level(LOG_DEBUG);
+                break;
+            case 'f':
+                fast = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            case 'o':
+                frames_path = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                tail_ns = strtoull(optarg, NULL, 10) * 1000000u;
+                break;
+            case 'u':
+                usb = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    alog_init();
+    if (config_path != NULL && !settings_load(config_path)) {
+        alog_shutdown();
+        return 1;
+    }
+
+    capture_reader_t reader;
+    if (!capture_reader_open(&reader, argv[optind])) {
+        alog_shutdown();
+        return 1;
+    }
+
+    FILE *frames = NULL;
+    if (frames_path != NULL) {
+        frames = strcmp(frames_path, "-") == 0 ? stdout : fopen(frames_path, "w");
+        if (frames == NULL) {
+            log_error("replay: cannot open %s: %s", frames_path, strerror(errno));
+            capture_reader_close(&reader);
+            alog_shutdown();
+            return 1;
+        }
+    }
+
+    /* Fast replay runs on capture time from 0, so frame times repeat exactly from run to run. */
+    if (fast) {
+        timebase_use_virtual(0);
+    }
+    led_init(!usb);
+    led_set_trace(frames);
+    pattern_init();
+    zone_init(port);
+    lanes_init();
+
+    capture_packet_t pkt;
+    char buffer[2048];
+    uint64_t packets = 0, rejected = 0;
+    uint64_t first_t = 0, last_t = 0;
+    uint64_t start = real_now_ns();
+    uint64_t base = timebase_now_ns();
+
+    while (capture_reader_next(&reader, &pkt)) {
+        if (packets == 0 && rejected == 0) {
+            first_t = pkt.t_ns;
+        }
+        /* Packets recorded at one instant arrived in one loop pass; the server dispatched them together. */
+        if (pkt.t_ns != last_t) {
+            lanes_dispatch(debug);
+        }
+        last_t = pkt.t_ns;
+        run_until(base + (pkt.t_ns - first_t));
+        if (pkt.len <= 0 || (size_t)pkt.len > sizeof(buffer)) {
+            rejected++;
+            continue;
+        }
+        if (debug) {
+            log_debug("replay: %d bytes from %s:%d at +%.3f ms", pkt.len, inet_ntoa(pkt.from.sin_addr),
+                      ntohs(pkt.from.sin_port), (double)(pkt.t_ns - first_t) / 1e6);
+        }
+
+        memcpy(buffer, pkt.data, (size_t)pkt.len);
+        if (lanes_enqueue_packet(buffer, pkt.len, pkt.port, debug) != 0) {
+            packets++;
+        } else {
+            rejected++;
+        }
+    }
+    lanes_dispatch(debug);
+    run_until(base + (last_t - first_t) + tail_ns);
+    capture_reader_close(&reader);
+    led_shutdown();
+    if (frames != NULL && frames != stdout) {
+        fclose(frames);
+    }
+    alog_shutdown();
+
+    double elapsed = (double)(real_now_ns() - start) / 1e9;
+    double recorded = (double)(last_t - first_t) / 1e9;
+    printf("replayed %llu packets (%llu rejected) in %.3f s, recorded span %.3f s, %.0f packets/s\n",
+           (unsigned long long)packets, (unsigned long long)rejected, elapsed, recorded,
+           elapsed > 0 ? (double)(packets + rejected) / elapsed : 0.0);
+    return 0;
+}
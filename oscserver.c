@@ -1,9 +1,27 @@
 #include "config.h"
 #include "cli.h"
 #include "ssdp.h"
+#include "http.h"
+#include "netif.h"
+#include "mdns.h"
+#include "clocksync.h"
+#include "oscgroup.h"
+#include "relay.h"
+#include "reliable.h"
+#include "dmx.h"
+#include "shmring.h"
+#include "unixsock.h"
+#include "capture.h"
+#include "scene.h"
+#include "ratelimit.h"
+#include "lanes.h"
+#include "settings.h"
 #include "led.h"
 #include "state.h"
-#include "log.h"
+#include "zone.h"
+#include "pattern.h"
+#include "alog.h"
+#include "timebase.h"
 #include "tinyosc.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -25,117 +43,469 @@ static void sigint_handler(int sig) {
     keep_running = false;
 }
 
-int main(int argc, char *argv[]) {
+static void shorten_timeout(struct timeval *tv, int wait_ms) {
+    if (wait_ms >= 0 && (long)wait_ms * 1000 < (long)tv->tv_sec * 1000000 + tv->tv_usec) {
+        tv->tv_sec = wait_ms / 1000;
+        tv->tv_usec = (wait_ms % 1000) * 1000;
+    }
+}
+
+#define REPLY_PEERS 8
+
+typedef struct {
+    struct sockaddr_in peers[REPLY_PEERS];
+    unsigned zones[REPLY_PEERS];
+    int count;
+} replies_t;
+
+typedef struct {
+    int port;
+    int fd;
+} listener_t;
+
+/* One UDP socket per distinct zone port, all served by the same loop. */
+static listener_t s_listeners[ZONE_MAX];
+static int s_listener_count;
+
+static bool open_listeners(void) {
+    struct in_addr bind_addr = { INADDR_ANY };
+
+    if (settings()->listen_address[0] != '\0') {
+        if (!netif_lookup(settings()->listen_address, &bind_addr)) {
+            log_error("No IPv4 address for listen_address %s", settings()->listen_address);
+            return false;
+        }
+        log_info("Listening for OSC on %s only", inet_ntoa(bind_addr));
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        zone_t *z = zone_get(i);
+        int l;
+        for (l = 0; l < s_listener_count && s_listeners[l].port != z->port; l++) { }
+        if (l == s_listener_count) {
+            int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+
+            struct sockaddr_in sin = {0};
+            sin.sin_family = AF_INET;
+            sin.sin_port = htons(z->port);
+            sin.sin_addr = bind_addr;
+            if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+                log_error("Cannot bind UDP port %d for zone %s: %s", z->port, z->name, strerror(errno));
+                close(fd);
+                return false;
+            }
+            s_listeners[l].port = z->port;
+            s_listeners[l].fd = fd;
+            s_listener_count++;
+        }
+        z->fd = s_listeners[l].fd;
+    }
+    return true;
+}
+
+/* The most recent sender to each zone gets that zone's periodic status. */
+static void note_subscriber(zone_t *z, const struct sockaddr_in *from) {
+    if (!z->have_status_peer) {
+        z->last_status_ns = timebase_now_ns();
+    }
+    z->status_peer = *from;
+    z->have_status_peer = true;
+}
+
+/* Queues an admitted packet's messages by lane; the sender is answered once they have been applied.
+   Multicast packets are routed as if sent to the main port and are not answered: one datagram
+   reaches the whole rig, and the sender should not get every server's status back for it.
+   A reliable packet is acked only once it has been queued; a retransmission is acked again but not
+   applied twice. */
+static void handle_packet(char *buffer, int len, const struct sockaddr_in *from, int port, void *ctx) {
+    replies_t *replies = ctx;
+    bool group = port == oscgroup_port();
+
+    reliable_result_t reliable = group ? RELIABLE_PLAIN : reliable_check(buffer, len, from);
+
+    if (reliable == RELIABLE_DUPLICATE) {
+        return;
+    }
+    unsigned zones = lanes_enqueue_packet(buffer, len, group ? cli_port() : port, cli_debug());
+    if (reliable == RELIABLE_NEW && zones != 0) {
+        reliable_accept(buffer, len, from);
+    }
+    int i;
+
+    if (zones == 0 || group) {
+        return;
+    }
+    for (int z = 0; z < zone_count(); z++) {
+        if (zones & (1u << z)) {
+            note_subscriber(zone_get(z), from);
+        }
+    }
+    for (i = 0; i < replies->count; i++) {
+        if (replies->peers[i].sin_addr.s_addr == from->sin_addr.s_addr &&
+            replies->peers[i].sin_port == from->sin_port) {
+            replies->zones[i] |= zones;
+            return;
+        }
+    }
+    if (replies->count < REPLY_PEERS) {
+        replies->peers[replies->count] = *from;
+        replies->zones[replies->count] = zones;
+        replies->count++;
+    }
+}
+
+static void send_replies(replies_t *replies) {
+    for (int i = 0; i < replies->count; i++) {
+        struct sockaddr_in feedback_dest = replies->peers[i];
+        feedback_dest.sin_port = htons(settings()->feedback_port);
+        for (int z = 0; z < zone_count(); z++) {
+            if (replies->zones[i] & (1u << z)) {
+                const zone_t *zone = zone_get(z);
+                state_send_osc_status(zone, zone->fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest),
+                                      cli_debug());
+            }
+        }
+    }
+    replies->count = 0;
+}
+
+static void send_periodic_status(uint64_t now) {
+    for (int i = 0; i < zone_count(); i++) {
+        zone_t *z = zone_get(i);
+        if (!z->have_status_peer || now - z->last_status_ns < (uint64_t)settings()->status_interval * NS_PER_SEC) {
+            continue;
+        }
+        struct sockaddr_in feedback_dest = z->status_peer;
+        feedback_dest.sin_port = htons(settings()->feedback_port);
+        state_send_osc_status(z, z->fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest), cli_debug());
+        lanes_send_status(z->fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest));
+        led_send_status(z->fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest));
+        relay_send_status(z->fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest));
+        z->last_status_ns = now;
+    }
+}
+
+/* A reliable bundle has to be acked, so it is never replaced by a newer packet even if it only sets a color. */
+static bool coalescable(char *buffer, int len, int port) {
+    return !reliable_marked(buffer, len) &&
+           lanes_packet_is_stream(buffer, len, port == oscgroup_port() ? cli_port() : port);
+}
+
+static void receive_packets(const listener_t *l, replies_t *replies) {
     char buffer[2048];
-    time_t last_ssdp = 0;
+    struct sockaddr sa;
+    socklen_t sa_len = sizeof(struct sockaddr_in);
+    int len;
+
+    while ((len = (int)recvfrom(l->fd, buffer, sizeof(buffer), 0, &sa, &sa_len)) > 0) {
+        /* Reject empty or oversized packets to avoid parser over-reads */
+        if (len <= 0 || (size_t)len > sizeof(buffer)) {
+            continue;
+        }
+        /* Group packets are routed as the main port, so that is what replay needs. */
+        capture_append(buffer, len, (struct sockaddr_in *)&sa, l->port == oscgroup_port() ? cli_port() : l->port);
+
+        if (!ratelimit_admit(buffer, len, (struct sockaddr_in *)&sa, l->port, coalescable, handle_packet, replies)) {
+            continue;
+        }
+        handle_packet(buffer, len, (struct sockaddr_in *)&sa, l->port, replies);
+    }
+}
+
+/* Local clients are trusted and already filtered by credentials, so they skip the rate limit; they are
+   recorded like network packets so a capture replays them too, and answered by unixsock itself. */
+static unsigned handle_local_packet(char *buffer, int len, void *ctx) {
+    struct sockaddr_in local = {0};
+    (void)ctx;
+
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    capture_append(buffer, len, &local, cli_port());
+    return lanes_enqueue_packet(buffer, len, cli_port(), cli_debug());
+}
+
+/* Applies a reloaded settings file without touching the OSC socket or blanking the light. */
+static void apply_settings(const settings_t *old) {
+    const settings_t *cfg = settings();
+
+    if (cfg->rate_limit != old->rate_limit || cfg->rate_burst != old->rate_burst ||
+        cfg->rate_policy != old->rate_policy) {
+        ratelimit_configure(cfg->rate_limit, cfg->rate_burst, (ratelimit_policy_t)cfg->rate_policy);
+    }
+    if (cfg->vendor_id != old->vendor_id || cfg->product_id != old->product_id) {
+        led_configure();
+        state_refresh_output();
+    }
+    zone_settings_changed(old);
+    if (cfg->sacn != old->sacn || cfg->artnet != old->artnet || cfg->dmx_universe != old->dmx_universe ||
+        cfg->dmx_channel != old->dmx_channel || cfg->dmx_merge != old->dmx_merge ||
+        memcmp(cfg->zones, old->zones, sizeof(cfg->zones)) != 0) {
+        dmx_settings_changed();
+    }
+    if (strcmp(cfg->shm, old->shm) != 0) {
+        shmring_settings_changed();
+    }
+    if (strcmp(cfg->unix_socket, old->unix_socket) != 0) {
+        unixsock_settings_changed();
+    }
+    if (strcmp(cfg->listen_address, old->listen_address) != 0) {
+        log_warn("config: listen_address takes effect on restart");
+    }
+    if (strcmp(cfg->lut_path, old->lut_path) != 0 && led_load_lut(cfg->lut_path)) {
+        state_refresh_output();
+    }
+    if (cfg->ssdp_port != old->ssdp_port) {
+        ssdp_shutdown();
+        ssdp_init(cli_port());
+    } else if (cfg->ssdp_interval != old->ssdp_interval || cfg->ssdp_max_age != old->ssdp_max_age) {
+        ssdp_interfaces_changed();
+    }
+    if (cfg->feedback_port != old->feedback_port) {
+        mdns_settings_changed();
+    }
+    if (strcmp(cfg->osc_group, old->osc_group) != 0 || cfg->osc_group_port != old->osc_group_port ||
+        strcmp(cfg->listen_address, old->listen_address) != 0) {
+        oscgroup_settings_changed();
+    }
+    if (cfg->relay_count != old->relay_count || memcmp(cfg->relays, old->relays, sizeof(cfg->relays)) != 0 ||
+        cfg->feedback_port != old->feedback_port) {
+        relay_settings_changed();
+    }
+    if (cfg->sync_port != old->sync_port) {
+        clocksync_settings_changed();
+    }
+}
 
-    log_set_level(LOG_INFO);
+static void reload_settings(bool (*reload)(void)) {
+    settings_t old = *settings();
+    if (reload()) {
+        apply_settings(&old);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    alog_set_level(LOG_INFO);
     cli_parse_arguments(argc, argv);
+    alog_init();
+    if (cli_config_path() != NULL && !settings_load(cli_config_path())) {
+        return 1;
+    }
     signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);
+    signal(SIGPIPE, SIG_IGN);
 
     led_init(cli_test_mode());
+    led_load_lut(settings()->lut_path);
+    pattern_init();
+    zone_init(cli_port());
     if (cli_test_mode()) {
         log_info("Test mode: running without USB (no HID init or device open).");
     }
 
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    fcntl(fd, F_SETFL, O_NONBLOCK);
+    /* Push the last known look to the light before any network setup. */
+    if (cli_state_path() != NULL) {
+        state_open(cli_state_path());
+        scene_open(cli_scene_path());
+    }
+
+    if (cli_record_path() != NULL && !capture_open(cli_record_path())) {
+        return 1;
+    }
+
+    ratelimit_init(settings()->rate_limit, settings()->rate_burst, (ratelimit_policy_t)settings()->rate_policy);
+    lanes_init();
 
-    struct sockaddr_in sin = {0};
-    sin.sin_family = AF_INET;
-    sin.sin_port = htons(cli_port());
-    sin.sin_addr.s_addr = INADDR_ANY;
-    bind(fd, (struct sockaddr *)&sin, sizeof(sin));
+    if (!open_listeners()) {
+        return 1;
+    }
 
     log_info("Server is now listening on port %d UDP, feedback on port %d, advertising SSDP on port %d.",
-             cli_port(), FEEDBACK_PORT, SSDP_PORT);
+             cli_port(), settings()->feedback_port, settings()->ssdp_port);
     log_info("Press Ctrl+C to stop.");
 
-    log_debug("announce_ssdp_service start");
-    ssdp_announce_service(cli_port());
-    log_debug("announce_ssdp_service done");
+    netif_refresh();
+    netif_watch_init();
+    settings_watch_init();
+    ssdp_init(cli_port());
+    http_init(cli_port());
+    mdns_init(cli_port());
+    clocksync_init();
+    oscgroup_init();
+    relay_init();
+    dmx_init();
+    shmring_init();
+    unixsock_init();
 
-    time_t last_status_time = 0;
-    struct sockaddr_in last_status_peer;
-    bool have_status_peer = false;
+    uint64_t last_netif_poll = timebase_now_ns();
+    uint64_t last_settings_poll = timebase_now_ns();
+    replies_t replies = { {{0}}, {0}, 0 };
 
     while (keep_running) {
         fd_set read_set;
+        int max_fd = -1;
         FD_ZERO(&read_set);
-        FD_SET(fd, &read_set);
+        for (int i = 0; i < s_listener_count; i++) {
+            FD_SET(s_listeners[i].fd, &read_set);
+            if (s_listeners[i].fd > max_fd) max_fd = s_listeners[i].fd;
+        }
+        if (ssdp_fd() >= 0) {
+            FD_SET(ssdp_fd(), &read_set);
+            if (ssdp_fd() > max_fd) max_fd = ssdp_fd();
+        }
+        if (netif_watch_fd() >= 0) {
+            FD_SET(netif_watch_fd(), &read_set);
+            if (netif_watch_fd() > max_fd) max_fd = netif_watch_fd();
+        }
+        if (mdns_fd() >= 0) {
+            FD_SET(mdns_fd(), &read_set);
+            if (mdns_fd() > max_fd) max_fd = mdns_fd();
+        }
+        if (relay_fd() >= 0) {
+            FD_SET(relay_fd(), &read_set);
+            if (relay_fd() > max_fd) max_fd = relay_fd();
+        }
+        if (oscgroup_fd() >= 0) {
+            FD_SET(oscgroup_fd(), &read_set);
+            if (oscgroup_fd() > max_fd) max_fd = oscgroup_fd();
+        }
+        if (clocksync_fd() >= 0) {
+            FD_SET(clocksync_fd(), &read_set);
+            if (clocksync_fd() > max_fd) max_fd = clocksync_fd();
+        }
+        if (settings_watch_fd() >= 0) {
+            FD_SET(settings_watch_fd(), &read_set);
+            if (settings_watch_fd() > max_fd) max_fd = settings_watch_fd();
+        }
+        if (led_health_fd() >= 0) {
+            FD_SET(led_health_fd(), &read_set);
+            if (led_health_fd() > max_fd) max_fd = led_health_fd();
+        }
+        http_fill_fdset(&read_set, &max_fd);
+        dmx_fill_fdset(&read_set, &max_fd);
+        shmring_fill_fdset(&read_set, &max_fd);
+        unixsock_fill_fdset(&read_set, &max_fd);
 
         struct timeval timeout = {1, 0};
+        shorten_timeout(&timeout, ssdp_next_timeout_ms());
+        shorten_timeout(&timeout, mdns_next_timeout_ms());
+        shorten_timeout(&timeout, clocksync_next_timeout_ms());
+        shorten_timeout(&timeout, ratelimit_next_timeout_ms());
+        shorten_timeout(&timeout, lanes_next_timeout_ms());
+        shorten_timeout(&timeout, relay_next_timeout_ms());
+        shorten_timeout(&timeout, dmx_next_timeout_ms());
+        shorten_timeout(&timeout, state_next_render_ms());
+        shorten_timeout(&timeout, shmring_next_timeout_ms());
         log_debug("select start");
 
-        if (select(fd + 1, &read_set, NULL, NULL, &timeout) > 0) {
-            struct sockaddr sa;
-            socklen_t sa_len = sizeof(struct sockaddr_in);
-            int len;
-
-            while ((len = (int)recvfrom(fd, buffer, sizeof(buffer), 0, &sa, &sa_len)) > 0) {
-                bool was_empty = !have_status_peer;
-                memcpy(&last_status_peer, &sa, sizeof(last_status_peer));
-                have_status_peer = true;
-                if (was_empty) {
-                    last_status_time = time(NULL);
-                }
-
-                /* Reject empty or oversized packets to avoid parser over-reads */
-                if (len <= 0 || (size_t)len > sizeof(buffer)) {
-                    continue;
-                }
-
-                if (tosc_isBundle(buffer)) {
-                    tosc_bundle bundle;
-                    tosc_parseBundle(&bundle, buffer, len);
-                    tosc_message osc;
-                    while (tosc_getNextMessage(&bundle, &osc)) {
-                        state_process_osc_msg(&osc, len, cli_debug());
-                    }
-                } else {
-                    /* Require NUL and comma within bounds so tinyosc doesn't over-read */
-                    size_t i;
-                    for (i = 0; i < (size_t)len && buffer[i] != '\0'; i++) { }
-                    if (i >= (size_t)len) continue;
-                    for ( ; i < (size_t)len && buffer[i] != ','; i++) { }
-                    if (i >= (size_t)len) continue;
-
-                    tosc_message osc;
-                    if (tosc_parseMessage(&osc, buffer, len) != 0) continue;
-                    state_process_osc_msg(&osc, len, cli_debug());
-                }
-
-                struct sockaddr_in feedback_dest;
-                memcpy(&feedback_dest, &sa, sizeof(feedback_dest));
-                feedback_dest.sin_port = htons(FEEDBACK_PORT);
-                state_send_osc_status(fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest), cli_debug());
+        int ready = select(max_fd + 1, &read_set, NULL, NULL, &timeout);
+        if (ready > 0 && ssdp_fd() >= 0 && FD_ISSET(ssdp_fd(), &read_set)) {
+            ssdp_handle_readable();
+        }
+        if (ready > 0 && netif_watch_fd() >= 0 && FD_ISSET(netif_watch_fd(), &read_set)) {
+            if (netif_handle_readable()) {
+                ssdp_interfaces_changed();
+                mdns_interfaces_changed();
+                clocksync_interfaces_changed();
+                oscgroup_interfaces_changed();
+                dmx_interfaces_changed();
             }
-            log_debug("select done");
+        }
+        if (ready > 0 && mdns_fd() >= 0 && FD_ISSET(mdns_fd(), &read_set)) {
+            mdns_handle_readable();
+        }
+        if (ready > 0 && relay_fd() >= 0 && FD_ISSET(relay_fd(), &read_set)) {
+            relay_handle_readable();
+        }
+        if (ready > 0 && clocksync_fd() >= 0 && FD_ISSET(clocksync_fd(), &read_set)) {
+            clocksync_handle_readable();
+        }
+        if (ready > 0 && settings_watch_fd() >= 0 && FD_ISSET(settings_watch_fd(), &read_set)) {
+            reload_settings(settings_handle_readable);
+        }
+        if (ready > 0 && led_health_fd() >= 0 && FD_ISSET(led_health_fd(), &read_set)) {
+            /* A light came back: give it the current frame instead of waiting for the next change. */
+            if (led_handle_readable()) {
+                state_refresh_output();
+            }
+        }
+        if (ready > 0) {
+            http_handle(&read_set);
+            dmx_handle(&read_set);
+            unixsock_handle(&read_set, handle_local_packet, NULL);
         }
 
-        time_t now = time(NULL);
-
-        if (have_status_peer && now - last_status_time >= STATUS_INTERVAL) {
-            struct sockaddr_in feedback_dest = last_status_peer;
-            feedback_dest.sin_port = htons(FEEDBACK_PORT);
-            state_send_osc_status(fd, (struct sockaddr *)&feedback_dest, sizeof(feedback_dest), cli_debug());
-            last_status_time = now;
+        for (int i = 0; ready > 0 && i < s_listener_count; i++) {
+            if (FD_ISSET(s_listeners[i].fd, &read_set)) {
+                receive_packets(&s_listeners[i], &replies);
+                log_debug("select done");
+            }
+        }
+        if (ready > 0 && oscgroup_fd() >= 0 && FD_ISSET(oscgroup_fd(), &read_set)) {
+            listener_t group = { oscgroup_port(), oscgroup_fd() };
+            receive_packets(&group, &replies);
         }
 
-        if (now - last_ssdp >= SSDP_INTERVAL) {
-            log_debug("current_time: %ld, last_ssdp_announcement: %ld", (long)now, (long)last_ssdp);
-            ssdp_send_announcement(cli_port());
-            last_ssdp = now;
-            if (cli_debug()) {
-                log_debug("Sent periodic SSDP announcement for port %d", cli_port());
+        uint64_t now = timebase_now_ns();
+        send_periodic_status(now);
+
+        if (netif_watch_fd() < 0 && now - last_netif_poll >= (uint64_t)settings()->netif_poll_interval * NS_PER_SEC) {
+            if (netif_refresh()) {
+                ssdp_interfaces_changed();
+                mdns_interfaces_changed();
+                clocksync_interfaces_changed();
+                oscgroup_interfaces_changed();
+                dmx_interfaces_changed();
             }
+            last_netif_poll = now;
+        }
+
+        if (cli_config_path() != NULL && settings_watch_fd() < 0 && now - last_settings_poll >= NS_PER_SEC) {
+            reload_settings(settings_poll);
+            last_settings_poll = now;
         }
 
-        log_debug("handleBlink start");
-        state_handle_blink();
-        log_debug("handleBlink done");
+        /* Held-back packets go after everything that arrived within its limit. */
+        ratelimit_tick(handle_packet, &replies);
+        shmring_drain(cli_debug());
+        relay_flush();
+        lanes_dispatch(cli_debug());
+        send_replies(&replies);
+        reliable_send_acks(s_listeners[0].fd);
+        unixsock_send_replies(cli_debug());
+
+        ssdp_tick();
+        mdns_tick();
+        clocksync_tick();
+        dmx_tick();
+
+        state_render();
     }
 
-    close(fd);
+    ratelimit_log_stats();
+    lanes_log_stats();
+    led_log_stats();
+    shmring_log_stats();
+    clocksync_log_stats();
+    relay_log_stats();
+    reliable_log_stats();
+    ssdp_shutdown();
+    mdns_shutdown();
+    clocksync_shutdown();
+    oscgroup_shutdown();
+    relay_shutdown();
+    dmx_shutdown();
+    shmring_shutdown();
+    unixsock_shutdown();
+    http_shutdown();
+    netif_watch_shutdown();
+    settings_watch_shutdown();
+    capture_close();
+    scene_close();
+    state_close();
+    led_shutdown();
+    for (int i = 0; i < s_listener_count; i++) {
+        close(s_listeners[i].fd);
+    }
+    alog_shutdown();
     return 0;
 }
@@ -0,0 +1,80 @@
+#include "pattern.h"
+#include "slicky.h"
+#include <math.h>
+#include <string.h>
+
+#define PATTERN_TABLE_SIZE 256 /* One entry per step of a cycle; indices wrap with & (size - 1) */
+#define PATTERN_STROBE_DUTY 64 /* Strobe on-time out of PATTERN_TABLE_SIZE */
+
+static const char *const s_names[] = { "off", "rainbow", "pulse", "strobe" };
+static const float s_default_rates[] = { 0.0f, 1.5f, 0.5f, 10.0f };
+
+/* Frames are table lookups so the render tick never calls into libm. */
+static color_rgb_t s_hue_table[PATTERN_TABLE_SIZE];
+static uint8_t s_pulse_table[PATTERN_TABLE_SIZE];
+static uint64_t s_reference_ns;
+static bool s_have_reference;
+
+static color_rgb_t scale(color_rgb_t c, unsigned level) {
+    unsigned r = ((c >> 16) & 0xFF) * level / 255;
+    unsigned g = ((c >> 8) & 0xFF) * level / 255;
+    unsigned b = (c & 0xFF) * level / 255;
+    return (color_rgb_t)((r << 16) | (g << 8) | b);
+}
+
+void pattern_init(void) {
+    for (int i = 0; i < PATTERN_TABLE_SIZE; i++) {
+        float pos = (float)i / PATTERN_TABLE_SIZE;
+        s_hue_table[i] = slicky_hsv_to_rgb(pos, 1.0f, 1.0f);
+        s_pulse_table[i] = (uint8_t)lroundf(127.5f - 127.5f * cosf(2.0f * (float)M_PI * pos));
+    }
+}
+
+bool pattern_parse(const char *name, pattern_type_t *type) {
+    for (int i = 0; i < (int)(sizeof(s_names) / sizeof(s_names[0])); i++) {
+        if (strcmp(name, s_names[i]) == 0) {
+            *type = (pattern_type_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pattern_name(pattern_type_t type) { return s_names[type]; }
+
+float pattern_default_rate(pattern_type_t type) { return s_default_rates[type]; }
+
+/* Normally a pattern runs from its own start; with a reference (see blink_set_reference) every
+   pattern at the same rate is in the same phase, on every synchronised server. */
+void pattern_set_reference(uint64_t ref_ns) {
+    s_reference_ns = ref_ns;
+    s_have_reference = true;
+}
+
+void pattern_clear_reference(void) {
+    s_have_reference = false;
+}
+
+void pattern_start(pattern_t *p, pattern_type_t type, float rate, uint64_t now_ns) {
+    p->type = type;
+    p->rate = rate > 0.0f ? rate : s_default_rates[type];
+    p->start_ns = now_ns;
+}
+
+color_rgb_t pattern_frame(const pattern_t *p, color_rgb_t base, uint64_t now_ns) {
+    uint64_t origin = s_have_reference ? s_reference_ns : p->start_ns;
+    double cycles = (double)(now_ns - origin) / 1e9 * p->rate;
+    unsigned idx = (unsigned)((cycles - floor(cycles)) * PATTERN_TABLE_SIZE) & (PATTERN_TABLE_SIZE - 1);
+
+    switch (p->type) {
+        case PATTERN_RAINBOW:
+            return s_hue_table[idx];
+        case PATTERN_PULSE:
+            return scale(base, s_pulse_table[idx]);
+        case PATTERN_STROBE:
+            return idx < PATTERN_STROBE_DUTY ? base : 0x000000;
+        case PATTERN_OFF:
+        default:
+            return base;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include "led.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    PATTERN_OFF,
+    PATTERN_RAINBOW, /* Hue wheel; rate is wheel turns per second */
+    PATTERN_PULSE,   /* Current color breathing; rate is pulses per second */
+    PATTERN_STROBE   /* Current color flashing; rate is flashes per second */
+} pattern_type_t;
+
+/* One running pattern; each zone has its own. Zero-initialised means off. */
+typedef struct {
+    pattern_type_t type;
+    float rate;
+    uint64_t start_ns;
+} pattern_t;
+
+void pattern_init(void);
+bool pattern_parse(const char *name, pattern_type_t *type);
+const char *pattern_name(pattern_type_t type);
+float pattern_default_rate(pattern_type_t type);
+void pattern_set_reference(uint64_t ref_ns);
+void pattern_clear_reference(void);
+void pattern_start(pattern_t *p, pattern_type_t type, float rate, uint64_t now_ns);
+color_rgb_t pattern_frame(const pattern_t *p, color_rgb_t base, uint64_t now_ns);
+
+#endif /* PATTERN_H */
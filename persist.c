@@ -0,0 +1,154 @@
+#include "persist.h"
+#include "alog.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PERSIST_MAGIC "SLKSTATE"
+#define PERSIST_SLOTS 2
+
+/* Two slots written alternately: a write that is torn by a crash or power loss fails its
+   checksum, and the other slot still holds the previous complete state. Each slot is a header
+   followed by max_payload bytes of data. */
+typedef struct {
+    uint64_t seq;
+    uint32_t len;
+    uint32_t crc;
+} persist_slot_t;
+
+#define PERSIST_HEADER 8 /* Magic */
+
+static size_t slot_size(const persist_t *p) {
+    return sizeof(persist_slot_t) + p->max_payload;
+}
+
+static size_t file_size(const persist_t *p) {
+    return PERSIST_HEADER + PERSIST_SLOTS * slot_size(p);
+}
+
+static persist_slot_t *slot_at(const persist_t *p, int i) {
+    return (persist_slot_t *)(p->map + PERSIST_HEADER + (size_t)i * slot_size(p));
+}
+
+static uint8_t *slot_data(persist_slot_t *slot) {
+    return (uint8_t *)(slot + 1);
+}
+
+static uint32_t crc32(const uint8_t *p, size_t n, uint64_t seq) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (int i = 0; i < 8; i++) {
+        crc ^= (uint8_t)(seq >> (i * 8));
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    for (size_t i = 0; i < n; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+static bool slot_valid(const persist_t *p, persist_slot_t *slot) {
+    return slot->seq != 0 && slot->len <= p->max_payload &&
+           slot->crc == crc32(slot_data(slot), slot->len, slot->seq);
+}
+
+/* True if path exists and was laid out for max_payload, so a caller can read an older layout
+   before persist_open() resizes (and so clears) the file. */
+bool persist_sized_for(const char *path, size_t max_payload) {
+    persist_t probe = { .max_payload = max_payload };
+    struct stat st;
+    return stat(path, &st) == 0 && (size_t)st.st_size == file_size(&probe);
+}
+
+bool persist_open(persist_t *p, const char *path, size_t max_payload) {
+    struct stat st;
+
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->latest = -1;
+    p->max_payload = max_payload;
+
+    p->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (p->fd < 0) {
+        log_error("persist: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    bool resized = fstat(p->fd, &st) == 0 && st.st_size != 0 && (size_t)st.st_size != file_size(p);
+    if (ftruncate(p->fd, (off_t)file_size(p)) < 0) {
+        log_error("persist: cannot size %s: %s", path, strerror(errno));
+        close(p->fd);
+        p->fd = -1;
+        return false;
+    }
+    void *m = mmap(NULL, file_size(p), PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+    if (m == MAP_FAILED) {
+        log_error("persist: mmap %s failed: %s", path, strerror(errno));
+        close(p->fd);
+        p->fd = -1;
+        return false;
+    }
+    p->map = m;
+
+    if (resized || memcmp(p->map, PERSIST_MAGIC, PERSIST_HEADER) != 0) {
+        memset(p->map, 0, file_size(p));
+        memcpy(p->map, PERSIST_MAGIC, PERSIST_HEADER);
+    }
+
+    for (int i = 0; i < PERSIST_SLOTS; i++) {
+        persist_slot_t *slot = slot_at(p, i);
+        if (slot_valid(p, slot) && slot->seq > p->seq) {
+            p->seq = slot->seq;
+            p->latest = i;
+        }
+    }
+    return true;
+}
+
+bool persist_load(persist_t *p, void *payload, size_t *len, size_t max) {
+    if (p->map == NULL || p->latest < 0) {
+        return false;
+    }
+    persist_slot_t *slot = slot_at(p, p->latest);
+    size_t n = slot->len < max ? slot->len : max;
+    memcpy(payload, slot_data(slot), n);
+    *len = n;
+    return true;
+}
+
+void persist_store(persist_t *p, const void *payload, size_t len) {
+    if (p->map == NULL || len > p->max_payload) {
+        return;
+    }
+
+    int next = (p->latest + 1) % PERSIST_SLOTS;
+    persist_slot_t *slot = slot_at(p, next);
+
+    /* Invalidate first so a half-written slot can never pass as newer than the other one. */
+    slot->seq = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(slot_data(slot), payload, len);
+    slot->len = (uint32_t)len;
+    slot->crc = crc32(slot_data(slot), len, p->seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->seq = ++p->seq;
+    p->latest = next;
+
+    /* Page cache write-back is enough to survive a process crash; no fsync on the hot path. */
+    msync(p->map, file_size(p), MS_ASYNC);
+}
+
+/* Safe on a store that was never opened or failed to open. */
+void persist_close(persist_t *p) {
+    if (p->map == NULL) {
+        return;
+    }
+    msync(p->map, file_size(p), MS_SYNC);
+    munmap(p->map, file_size(p));
+    p->map = NULL;
+    close(p->fd);
+    p->fd = -1;
+}
@@ -0,0 +1,25 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PERSIST_MAX_PAYLOAD 1008 /* State file payload; keeps the original on-disk layout */
+
+/* One memory-mapped, checksummed store; each file holds a single payload of up to max_payload bytes. */
+typedef struct {
+    int fd;
+    uint8_t *map;
+    size_t max_payload;
+    uint64_t seq;
+    int latest;
+} persist_t;
+
+bool persist_sized_for(const char *path, size_t max_payload);
+bool persist_open(persist_t *p, const char *path, size_t max_payload);
+bool persist_load(persist_t *p, void *payload, size_t *len, size_t max);
+void persist_store(persist_t *p, const void *payload, size_t len);
+void persist_close(persist_t *p);
+
+#endif /* PERSIST_H */
@@ -1,151 +1,67 @@
-#include "hidapi.h"
+#include "slicky.h"
 #include <stdio.h>
-#include <math.h>
-#include <unistd.h>
+#include <time.h>
+#include <errno.h>
 
-#define MAX_STR 255
-#define VENDOR_ID 0x04D8
-#define PRODUCT_ID 0xEC24
+#define FRAME_NS 33333333L /* 30 frames per second until the device's own rate is known */
+#define TURNS_PER_SECOND 1.5f
 
-#define true 1
-#define false 0
-#define nullptr (NULL *)
-#define uint8_t unsigned char
-#define bool int
-
-hid_device *hidDevice;
-
-bool isConnected() {
-    if (hidDevice != NULL) hid_close(hidDevice);
-    hidDevice = hid_open(VENDOR_ID, PRODUCT_ID, NULL);
-
-    if (hidDevice == NULL) {
-      return false;
-    }
-    return true;
+/* Runs at whatever rate the light has been measured to sustain. */
+static long frame_ns(const slicky_device *dev) {
+    unsigned fps = slicky_max_fps(dev);
+    return fps != 0 ? 1000000000L / (long)fps : FRAME_NS;
 }
 
-int writeBuffer(unsigned char buf[65]) {
-    int res = -1;
-
-    if (isConnected()) {
-      res = hid_write(hidDevice, buf, 65); // 65 on success, -1 on failure
-      if (res < 0) printf("Error: Problem writing to hid device.");
+static void next_frame(struct timespec *deadline, long period) {
+    deadline->tv_nsec += period;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_nsec -= 1000000000L;
+        deadline->tv_sec++;
     }
-    else 
-      printf("Error: No device connected.");
-
-    return res;
-}
-
-int setColor(char r, char g, char b, char w) {
-    unsigned char buf[65]; // 65 bytes
-    // The first byte is the write endpoint (0x00).
-    // 0A 04 00 00 WW BB GG RR
-    buf[0] = 0x00;
-    buf[1] = 0x0A;
-    buf[2] = 0x04;
-    buf[3] = 0x00;
-    buf[4] = 0x00;
-    buf[5] = w;
-    buf[6] = b;
-    buf[7] = g;
-    buf[8] = r;
-
-    return writeBuffer(buf);
-}
-
-typedef uint32_t color_rgb_t;
-
-color_rgb_t util_hsv_to_rgb(float H, float S, float V) {
-  H = fmodf(H, 1.0);
-
-  float h = H * 6;
-  uint8_t i = floor(h);
-  float a = V * (1 - S);
-  float b = V * (1 - S * (h - i));
-  float c = V * (1 - (S * (1 - (h - i))));
-  float rf, gf, bf;
-
-  switch (i) {
-    case 0:
-      rf = V * 255;
-      gf = c * 255;
-      bf = a * 255;
-      break;
-    case 1:
-      rf = b * 255;
-      gf = V * 255;
-      bf = a * 255;
-      break;
-    case 2:
-      rf = a * 255;
-      gf = V * 255;
-      bf = c * 255;
-      break;
-    case 3:
-      rf = a * 255;
-      gf = b * 255;
-      bf = V * 255;
-      break;
-    case 4:
-      rf = c * 255;
-      gf = a * 255;
-      bf = V * 255;
-      break;
-    case 5:
-    default:
-      rf = V * 255;
-      gf = a * 255;
-      bf = b * 255;
-      break;
-  }
-
-  uint8_t R = rf;
-  uint8_t G = gf;
-  uint8_t B = bf;
-
-  color_rgb_t RGB = (R << 16) + (G << 8) + B;
-  return RGB;
 }
 
-
-void led_set_rgb(color_rgb_t rgb) {
-  setColor((rgb >> 16) & 0xFF, 
-           (rgb >> 8) & 0xFF,
-            rgb & 0xFF, 0);
-}
-
-void led_pattern_rainbow(float* p_hue, uint8_t repeat) {
-  float hue_step = 1;
-
-  color_rgb_t rgb = util_hsv_to_rgb(*p_hue + (hue_step), 1, 1);
-  led_set_rgb(rgb);
-
-  *p_hue += 0.05;
-  if (*p_hue > 1) {
-    *p_hue -= 1;
-  }
+/* Sleeps until an absolute deadline so frame timing doesn't drift with write latency. */
+static void sleep_until(const struct timespec *deadline) {
+    struct timespec now, wait;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wait.tv_sec = deadline->tv_sec - now.tv_sec;
+    wait.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (wait.tv_nsec < 0) {
+        wait.tv_nsec += 1000000000L;
+        wait.tv_sec--;
+    }
+    if (wait.tv_sec < 0) {
+        return;
+    }
+    while (nanosleep(&wait, &wait) < 0 && errno == EINTR) { }
 }
 
 int main() {
-    int res = hid_init();
-    float p_hue = 0;
+    float hue = 0;
+    struct timespec deadline;
 
-    if (res < 0) {
+    if (slicky_init() < 0) {
         printf("Error: Problem initializing the hidapi library.");
     }
 
-    // open device
-    hidDevice = hid_open(VENDOR_ID, PRODUCT_ID, NULL);
-
-//    setColor(0x3f, 0xb9, 0xbe, 0);
-//     setColor(0xff, 0xff, 0xff, 0);
-//    setColor(0xff, 0x36, 0x63, 0xff);
+    // one session for the whole run; it reconnects by itself if the light is replugged
+    slicky_device *dev = slicky_open(SLICKY_VENDOR_ID, SLICKY_PRODUCT_ID, NULL);
+    if (dev == NULL) {
+        return 1;
+    }
+    if (!slicky_connected(dev)) {
+        printf("Error: No device connected.");
+    }
 
-    
-    while(1) {
-        led_pattern_rainbow(&p_hue, 1);
-        usleep(33333);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (1) {
+        slicky_set_rgb(dev, slicky_hsv_to_rgb(hue, 1, 1));
+        long period = frame_ns(dev);
+        hue += TURNS_PER_SECOND * (float)period / 1e9f;
+        if (hue > 1) {
+            hue -= 1;
+        }
+        next_frame(&deadline, period);
+        sleep_until(&deadline);
     }
 }
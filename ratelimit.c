@@ -0,0 +1,357 @@
+#include "ratelimit.h"
+#include "alog.h"
+#include "timebase.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+#define RATELIMIT_PROBE 8          /* Slots searched before the least recently seen peer is evicted */
+#define RATELIMIT_MAX_PACKET 2048  /* Matches the receive buffer in oscserver.c */
+#define RATELIMIT_DEFER_SLOTS 32   /* Deprioritized packets queued across all peers */
+#define RATELIMIT_DEFER_PER_PEER 8 /* So a single noisy peer cannot fill the whole queue */
+
+typedef struct {
+    bool used;
+    struct in_addr addr;
+    double tokens;
+    uint64_t refill_ns;
+    uint64_t last_seen_ns;
+    bool throttling;
+    int deferred_pending;
+    int held_len;
+    int held_port;
+    struct sockaddr_in held_from;
+    char held[RATELIMIT_MAX_PACKET];
+    ratelimit_stats_t stats;
+} peer_t;
+
+typedef struct {
+    int len;
+    int port;
+    struct sockaddr_in from;
+    char data[RATELIMIT_MAX_PACKET];
+} deferred_t;
+
+static peer_t s_peers[RATELIMIT_PEERS];
+static double s_rate;
+static double s_burst;
+static ratelimit_policy_t s_policy;
+static int s_held;
+
+/* Deprioritized traffic shares one extra bucket, drained only after in-limit traffic has been served. */
+static deferred_t s_deferred[RATELIMIT_DEFER_SLOTS];
+static int s_deferred_head;
+static int s_deferred_count;
+static double s_spare_tokens;
+static uint64_t s_spare_refill_ns;
+
+static const char *const s_policy_names[] = { "drop", "coalesce", "deprioritize" };
+
+static void refill(double *tokens, uint64_t *refill_ns, uint64_t now) {
+    *tokens += (double)(now - *refill_ns) * s_rate / 1e9;
+    if (*tokens > s_burst) {
+        *tokens = s_burst;
+    }
+    *refill_ns = now;
+}
+
+static int ms_until_token(double tokens) {
+    if (tokens >= 1.0) {
+        return 0;
+    }
+    return (int)((1.0 - tokens) * 1000.0 / s_rate) + 1;
+}
+
+static unsigned peer_hash(struct in_addr addr) {
+    return ((uint32_t)addr.s_addr * 2654435761u) >> 16;
+}
+
+static peer_t *find_peer(struct in_addr addr) {
+    unsigned h = peer_hash(addr);
+    for (int i = 0; i < RATELIMIT_PROBE; i++) {
+        peer_t *p = &s_peers[(h + (unsigned)i) & (RATELIMIT_PEERS - 1)];
+        if (!p->used) {
+            return NULL;
+        }
+        if (p->addr.s_addr == addr.s_addr) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Entries are replaced in place and never removed, so an empty slot always ends a probe. */
+static peer_t *lookup_peer(struct in_addr addr, uint64_t now) {
+    unsigned h = peer_hash(addr);
+    peer_t *victim = NULL;
+
+    for (int i = 0; i < RATELIMIT_PROBE; i++) {
+        peer_t *p = &s_peers[(h + (unsigned)i) & (RATELIMIT_PEERS - 1)];
+        if (p->used && p->addr.s_addr == addr.s_addr) {
+            return p;
+        }
+        if (!p->used) {
+            victim = p;
+            break;
+        }
+        if (victim == NULL || p->last_seen_ns < victim->last_seen_ns) {
+            victim = p;
+        }
+    }
+
+    if (victim->used) {
+        log_debug("ratelimit: peer table full, evicting %s", inet_ntoa(victim->addr));
+        if (victim->held_len > 0) {
+            s_held--;
+        }
+    }
+    memset(victim, 0, sizeof(*victim));
+    victim->used = true;
+    victim->addr = addr;
+    victim->stats.addr = addr;
+    victim->tokens = s_burst;
+    victim->refill_ns = now;
+    return victim;
+}
+
+static void start_throttling(peer_t *p) {
+    if (!p->throttling) {
+        p->throttling = true;
+        log_warn("ratelimit: %s exceeds %.0f packets/s, applying %s", inet_ntoa(p->addr), s_rate,
+                 s_policy_names[s_policy]);
+    }
+}
+
+void ratelimit_init(double rate, double burst, ratelimit_policy_t policy) {
+    memset(s_peers, 0, sizeof(s_peers));
+    s_held = 0;
+    s_deferred_head = 0;
+    s_deferred_count = 0;
+    s_spare_refill_ns = timebase_now_ns();
+    ratelimit_configure(rate, burst, policy);
+    s_spare_tokens = s_burst;
+}
+
+/* Peer buckets and anything already held or queued are kept across a change. */
+void ratelimit_configure(double rate, double burst, ratelimit_policy_t policy) {
+    s_rate = rate;
+    s_burst = burst < 1.0 ? 1.0 : burst;
+    s_policy = policy;
+    if (s_rate > 0) {
+        log_info("Rate limit: %.0f packets/s per peer, burst %.0f, policy %s", s_rate, s_burst,
+                 s_policy_names[s_policy]);
+    } else {
+        log_info("Rate limit: disabled");
+    }
+}
+
+bool ratelimit_parse_policy(const char *name, ratelimit_policy_t *policy) {
+    for (int i = 0; i < (int)(sizeof(s_policy_names) / sizeof(s_policy_names[0])); i++) {
+        if (strcmp(name, s_policy_names[i]) == 0) {
+            *policy = (ratelimit_policy_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *ratelimit_policy_name(ratelimit_policy_t policy) {
+    return s_policy_names[policy];
+}
+
+static void defer_packet(peer_t *p, const char *buffer, int len, const struct sockaddr_in *from, int port) {
+    if (s_deferred_count >= RATELIMIT_DEFER_SLOTS || p->deferred_pending >= RATELIMIT_DEFER_PER_PEER) {
+        p->stats.dropped++;
+        return;
+    }
+    deferred_t *d = &s_deferred[(s_deferred_head + s_deferred_count) % RATELIMIT_DEFER_SLOTS];
+    memcpy(d->data, buffer, (size_t)len);
+    d->len = len;
+    d->from = *from;
+    d->port = port;
+    s_deferred_count++;
+    p->deferred_pending++;
+    p->stats.deferred++;
+}
+
+/* The held color is older than anything still to come from the peer, so it joins the queue first. */
+static void defer_held(peer_t *p) {
+    if (p->held_len > 0) {
+        int len = p->held_len;
+        p->held_len = 0;
+        s_held--;
+        defer_packet(p, p->held, len, &p->held_from, p->held_port);
+    }
+}
+
+/* A peer's packets are applied in the order it sent them: a packet never overtakes the peer's own
+   deferred packets, and the color held for it is delivered (or replaced by a newer color) first.
+   Cues, scene recalls and reliable bundles must each arrive, so only color streams are held. */
+bool ratelimit_admit(char *buffer, int len, const struct sockaddr_in *from, int port,
+                     ratelimit_coalescable_fn coalescable, ratelimit_deliver_fn deliver, void *ctx) {
+    if (s_rate <= 0) {
+        return true;
+    }
+
+    uint64_t now = timebase_now_ns();
+    peer_t *p = lookup_peer(from->sin_addr, now);
+    p->last_seen_ns = now;
+    refill(&p->tokens, &p->refill_ns, now);
+
+    if (p->tokens >= 1.0 && (p->deferred_pending == 0 || s_policy == RATELIMIT_DROP)) {
+        p->tokens -= 1.0;
+        p->stats.passed++;
+        if (p->held_len > 0) {
+            int held_len = p->held_len;
+            p->held_len = 0;
+            s_held--;
+            if (coalescable(buffer, len, port)) {
+                p->stats.coalesced++;
+            } else {
+                p->stats.passed++;
+                deliver(p->held, held_len, &p->held_from, p->held_port, ctx);
+            }
+        }
+        return true;
+    }
+
+    start_throttling(p);
+    if (len > RATELIMIT_MAX_PACKET) {
+        p->stats.dropped++;
+        return false;
+    }
+
+    switch (s_policy) {
+        case RATELIMIT_COALESCE:
+            if (p->deferred_pending > 0 || !coalescable(buffer, len, port)) {
+                defer_held(p);
+                defer_packet(p, buffer, len, from, port);
+                break;
+            }
+            if (p->held_len > 0) {
+                p->stats.coalesced++;
+            } else {
+                s_held++;
+            }
+            memcpy(p->held, buffer, (size_t)len);
+            p->held_len = len;
+            p->held_from = *from;
+            p->held_port = port;
+            break;
+        case RATELIMIT_DEPRIORITIZE:
+            defer_held(p);
+            defer_packet(p, buffer, len, from, port);
+            break;
+        case RATELIMIT_DROP:
+        default:
+            p->stats.dropped++;
+            break;
+    }
+    return false;
+}
+
+/* The limit was switched off while packets were held back: let them all through. */
+static void release_all(ratelimit_deliver_fn deliver, void *ctx) {
+    for (int i = 0; i < RATELIMIT_PEERS; i++) {
+        peer_t *p = &s_peers[i];
+        p->deferred_pending = 0;
+        if (p->used && p->held_len > 0) {
+            int len = p->held_len;
+            p->held_len = 0;
+            s_held--;
+            deliver(p->held, len, &p->held_from, p->held_port, ctx);
+        }
+    }
+    while (s_deferred_count > 0) {
+        deferred_t *d = &s_deferred[s_deferred_head];
+        s_deferred_head = (s_deferred_head + 1) % RATELIMIT_DEFER_SLOTS;
+        s_deferred_count--;
+        deliver(d->data, d->len, &d->from, d->port, ctx);
+    }
+}
+
+void ratelimit_tick(ratelimit_deliver_fn deliver, void *ctx) {
+    if (s_rate <= 0) {
+        release_all(deliver, ctx);
+        return;
+    }
+    uint64_t now = timebase_now_ns();
+
+    for (int i = 0; i < RATELIMIT_PEERS; i++) {
+        peer_t *p = &s_peers[i];
+        if (!p->used || (p->held_len == 0 && !p->throttling)) {
+            continue;
+        }
+        refill(&p->tokens, &p->refill_ns, now);
+        if (p->held_len > 0 && p->tokens >= 1.0) {
+            int len = p->held_len;
+            p->tokens -= 1.0;
+            p->stats.passed++;
+            p->held_len = 0;
+            s_held--;
+            deliver(p->held, len, &p->held_from, p->held_port, ctx);
+        }
+        if (p->throttling && p->held_len == 0 && p->deferred_pending == 0 && p->tokens >= s_burst) {
+            p->throttling = false;
+            log_info("ratelimit: %s back under limit (%llu dropped, %llu coalesced, %llu deferred so far)",
+                     inet_ntoa(p->addr), (unsigned long long)p->stats.dropped,
+                     (unsigned long long)p->stats.coalesced, (unsigned long long)p->stats.deferred);
+        }
+    }
+
+    refill(&s_spare_tokens, &s_spare_refill_ns, now);
+    while (s_deferred_count > 0 && s_spare_tokens >= 1.0) {
+        deferred_t *d = &s_deferred[s_deferred_head];
+        s_deferred_head = (s_deferred_head + 1) % RATELIMIT_DEFER_SLOTS;
+        s_deferred_count--;
+        s_spare_tokens -= 1.0;
+        peer_t *p = find_peer(d->from.sin_addr);
+        if (p != NULL && p->deferred_pending > 0) {
+            p->deferred_pending--;
+        }
+        deliver(d->data, d->len, &d->from, d->port, ctx);
+    }
+}
+
+int ratelimit_next_timeout_ms(void) {
+    int wait = -1;
+
+    if (s_rate <= 0) {
+        return s_held > 0 || s_deferred_count > 0 ? 0 : -1;
+    }
+    if (s_held > 0) {
+        for (int i = 0; i < RATELIMIT_PEERS; i++) {
+            const peer_t *p = &s_peers[i];
+            if (p->used && p->held_len > 0) {
+                int ms = ms_until_token(p->tokens);
+                if (wait < 0 || ms < wait) wait = ms;
+            }
+        }
+    }
+    if (s_deferred_count > 0) {
+        int ms = ms_until_token(s_spare_tokens);
+        if (wait < 0 || ms < wait) wait = ms;
+    }
+    return wait;
+}
+
+int ratelimit_stats(ratelimit_stats_t *out, int max) {
+    int n = 0;
+    for (int i = 0; i < RATELIMIT_PEERS && n < max; i++) {
+        if (s_peers[i].used) {
+            out[n++] = s_peers[i].stats;
+        }
+    }
+    return n;
+}
+
+void ratelimit_log_stats(void) {
+    for (int i = 0; i < RATELIMIT_PEERS; i++) {
+        const ratelimit_stats_t *st = &s_peers[i].stats;
+        if (!s_peers[i].used || st->dropped + st->coalesced + st->deferred == 0) {
+            continue;
+        }
+        log_info("ratelimit: %s passed %llu, dropped %llu, coalesced %llu, deferred %llu", inet_ntoa(st->addr),
+                 (unsigned long long)st->passed, (unsigned long long)st->dropped,
+                 (unsigned long long)st->coalesced, (unsigned long long)st->deferred);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define RATELIMIT_PEERS 64 /* Hashed peer table size (power of two) */
+
+typedef enum {
+    RATELIMIT_DROP,         /* Discard packets over the limit */
+    RATELIMIT_COALESCE,     /* Keep only the newest color stream packet over the limit, deliver it when a token
+                               frees up; other packets over the limit are deprioritized */
+    RATELIMIT_DEPRIORITIZE  /* Queue packets over the limit behind in-limit traffic, bounded */
+} ratelimit_policy_t;
+
+typedef struct {
+    struct in_addr addr;
+    uint64_t passed;
+    uint64_t dropped;
+    uint64_t coalesced;
+    uint64_t deferred;
+} ratelimit_stats_t;
+
+/* Delivers a packet that was held back and is now allowed through, ahead of anything newer from the
+   same peer; port is the one it arrived on. */
+typedef void (*ratelimit_deliver_fn)(char *buffer, int len, const struct sockaddr_in *from, int port, void *ctx);
+
+/* True if a later packet from the same peer may replace this one, i.e. it only streams colors. */
+typedef bool (*ratelimit_coalescable_fn)(char *buffer, int len, int port);
+
+void ratelimit_init(double rate, double burst, ratelimit_policy_t policy);
+void ratelimit_configure(double rate, double burst, ratelimit_policy_t policy);
+bool ratelimit_parse_policy(const char *name, ratelimit_policy_t *policy);
+const char *ratelimit_policy_name(ratelimit_policy_t policy);
+bool ratelimit_admit(char *buffer, int len, const struct sockaddr_in *from, int port,
+                     ratelimit_coalescable_fn coalescable, ratelimit_deliver_fn deliver, void *ctx);
+void ratelimit_tick(ratelimit_deliver_fn deliver, void *ctx);
+int ratelimit_next_timeout_ms(void);
+int ratelimit_stats(ratelimit_stats_t *out, int max);
+void ratelimit_log_stats(void);
+
+#endif /* RATELIMIT_H */
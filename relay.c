@@ -0,0 +1,420 @@
+#define _GNU_SOURCE /* sendmmsg */
+#include "relay.h"
+#include "config.h"
+#include "cli.h"
+#include "settings.h"
+#include "state.h"
+#include "led.h"
+#include "netif.h"
+#include "zone.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define RELAY_TARGET_SLOTS (RELAY_MAX * RELAY_TARGETS_MAX)
+#define RELAY_HEALTH_ROUND_MS 500 /* Health messages closer together than this belong to one status round */
+
+/* One downstream server. Rules that share a destination share its bundle. */
+typedef struct {
+    struct sockaddr_in addr;
+    char label[64];
+    char bundle[RELAY_BUNDLE_MAX];
+    int bundle_len;      /* 0 when nothing is pending */
+    uint64_t last_seen_ns;
+    int health;          /* Worst led_health_t across its zones in its latest status round */
+    uint64_t health_ns;
+    int sub_servers;     /* What it reports under /status/relay about its own downstream */
+    int sub_up;
+    int sub_worst;
+} relay_target_t;
+
+typedef struct {
+    relay_def_t def;
+    size_t match_len;
+    int targets[RELAY_TARGETS_MAX];
+    int target_count;
+} relay_rule_t;
+
+static int s_fd = -1;
+static relay_rule_t s_rules[RELAY_MAX];
+static int s_rule_count;
+static relay_target_t s_targets[RELAY_TARGET_SLOTS];
+static int s_target_count;
+static uint64_t s_forwarded;
+static uint64_t s_datagrams;
+static uint64_t s_send_calls;
+
+static bool resolve(const char *spec, struct sockaddr_in *out) {
+    char host[128];
+    const char *colon = strrchr(spec, ':');
+    int port = cli_port();
+    struct addrinfo hints, *res = NULL;
+
+    snprintf(host, sizeof(host), "%.*s", colon != NULL ? (int)(colon - spec) : (int)strlen(spec), spec);
+    if (colon != NULL) {
+        char *end;
+        long v = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || v < 1 || v > 65535) {
+            return false;
+        }
+        port = (int)v;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) {
+        return false;
+    }
+    *out = *(struct sockaddr_in *)res->ai_addr;
+    out->sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+/* A target that is this server's own OSC port would feed every forwarded message back to the relay. */
+static bool is_self(const struct sockaddr_in *addr) {
+    in_addr_t ip = ntohl(addr->sin_addr.s_addr);
+    bool local = ip == INADDR_ANY || (ip >> 24) == 127;
+    bool ours = false;
+
+    for (int i = 0; !local && i < netif_count(); i++) {
+        local = netif_get(i)->addr.s_addr == addr->sin_addr.s_addr;
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        ours = ours || zone_get(i)->port == ntohs(addr->sin_port);
+    }
+    return local && ours;
+}
+
+static int add_target(const char *spec) {
+    struct sockaddr_in addr;
+
+    if (!resolve(spec, &addr)) {
+        log_warn("relay: cannot resolve %s", spec);
+        return -1;
+    }
+    if (is_self(&addr)) {
+        log_warn("relay: %s is this server, ignoring it to avoid a forwarding loop", spec);
+        return -1;
+    }
+    for (int i = 0; i < s_target_count; i++) {
+        if (s_targets[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr && s_targets[i].addr.sin_port == addr.sin_port) {
+            return i;
+        }
+    }
+    if (s_target_count == RELAY_TARGET_SLOTS) {
+        return -1;
+    }
+    relay_target_t *t = &s_targets[s_target_count];
+    memset(t, 0, sizeof(*t));
+    t->addr = addr;
+    snprintf(t->label, sizeof(t->label), "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    return s_target_count++;
+}
+
+/* Downstream servers answer the sender's address on the feedback port, so that is where the
+   relay listens; it forwards from the same socket. */
+void relay_init(void) {
+    const settings_t *cfg = settings();
+
+    if (cfg->relay_count == 0) {
+        return;
+    }
+    for (int i = 0; i < cfg->relay_count; i++) {
+        relay_rule_t *r = &s_rules[s_rule_count];
+        char list[sizeof(r->def.targets)];
+        char *save = NULL;
+
+        if (cfg->relays[i].match[0] == '\0' || cfg->relays[i].targets[0] == '\0') {
+            log_warn("relay %s: needs both match and targets", cfg->relays[i].name);
+            continue;
+        }
+        r->def = cfg->relays[i];
+        r->match_len = strlen(r->def.match);
+        r->target_count = 0;
+        snprintf(list, sizeof(list), "%s", r->def.targets);
+        for (char *spec = strtok_r(list, ", ", &save); spec != NULL; spec = strtok_r(NULL, ", ", &save)) {
+            int t = add_target(spec);
+            if (t >= 0 && r->target_count < RELAY_TARGETS_MAX) {
+                r->targets[r->target_count++] = t;
+            }
+        }
+        log_info("relay %s: %s -> %d server(s)%s", r->def.name, r->def.match, r->target_count,
+                 r->def.strip ? ", prefix stripped" : "");
+        s_rule_count++;
+    }
+
+    s_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_fd < 0) {
+        log_error("relay: cannot create socket: %s", strerror(errno));
+        return;
+    }
+    fcntl(s_fd, F_SETFL, O_NONBLOCK);
+    int on = 1;
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(cfg->feedback_port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_warn("relay: cannot bind feedback port %d (%s); downstream status will not be collected",
+                 cfg->feedback_port, strerror(errno));
+    }
+}
+
+int relay_fd(void) { return s_fd; }
+
+static bool matches(const relay_rule_t *r, const char *address) {
+    if (r->match_len == 1) {
+        return true; /* "/" forwards everything */
+    }
+    return strncmp(address, r->def.match, r->match_len) == 0 &&
+           (address[r->match_len] == '\0' || address[r->match_len] == '/');
+}
+
+static void send_one(relay_target_t *t, const char *data, int len) {
+    if (sendto(s_fd, data, (size_t)len, 0, (struct sockaddr *)&t->addr, sizeof(t->addr)) < 0) {
+        log_debug("relay: send to %s failed: %s", t->label, strerror(errno));
+    }
+    s_datagrams++;
+    s_send_calls++;
+}
+
+static void append(relay_target_t *t, const char *msg, int len) {
+    if (16 + 4 + len > RELAY_BUNDLE_MAX) {
+        send_one(t, msg, len); /* Too big to bundle: goes alone */
+        return;
+    }
+    if (t->bundle_len + 4 + len > RELAY_BUNDLE_MAX) {
+        relay_flush();
+    }
+    if (t->bundle_len == 0) {
+        tosc_bundle b;
+        tosc_writeBundle(&b, 1, t->bundle, sizeof(t->bundle)); /* Timetag 1: apply immediately */
+        t->bundle_len = 16;
+    }
+    uint32_t be = htonl((uint32_t)len);
+    memcpy(t->bundle + t->bundle_len, &be, 4);
+    memcpy(t->bundle + t->bundle_len + 4, msg, (size_t)len);
+    t->bundle_len += 4 + len;
+}
+
+/* The first matching rule takes the message; it is then not applied locally. */
+bool relay_offer(tosc_message *osc) {
+    const char *address = tosc_getAddress(osc);
+
+    if (s_fd < 0) {
+        return false;
+    }
+    for (int i = 0; i < s_rule_count; i++) {
+        relay_rule_t *r = &s_rules[i];
+        if (!matches(r, address)) {
+            continue;
+        }
+        const char *msg = osc->buffer;
+        int len = (int)osc->len;
+        char stripped[RELAY_BUNDLE_MAX];
+        if (r->def.strip && r->match_len > 1) {
+            if (address[r->match_len] == '\0') {
+                return true;
+            }
+            len = state_rewrite_address(osc, address + r->match_len, stripped, sizeof(stripped));
+            if (len == 0) {
+                return true;
+            }
+            msg = stripped;
+        }
+        for (int k = 0; k < r->target_count; k++) {
+            append(&s_targets[r->targets[k]], msg, len);
+        }
+        s_forwarded++;
+        return true;
+    }
+    return false;
+}
+
+/* Every pending bundle leaves in one sendmmsg call where available. */
+void relay_flush(void) {
+    int pending[RELAY_TARGET_SLOTS];
+    int n = 0;
+
+    for (int i = 0; i < s_target_count; i++) {
+        if (s_targets[i].bundle_len > 0) {
+            pending[n++] = i;
+        }
+    }
+    if (n == 0 || s_fd < 0) {
+        return;
+    }
+#ifdef __linux__
+    struct mmsghdr msgs[RELAY_TARGET_SLOTS];
+    struct iovec iov[RELAY_TARGET_SLOTS];
+    memset(msgs, 0, sizeof(msgs[0]) * (size_t)n);
+    for (int i = 0; i < n; i++) {
+        relay_target_t *t = &s_targets[pending[i]];
+        iov[i].iov_base = t->bundle;
+        iov[i].iov_len = (size_t)t->bundle_len;
+        msgs[i].msg_hdr.msg_name = &t->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(t->addr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int sent = 0; sent < n;) {
+        int r = sendmmsg(s_fd, msgs + sent, (unsigned)(n - sent), 0);
+        s_send_calls++;
+        if (r <= 0) {
+            /* The datagram at the front failed; skip it and send the rest. */
+            log_debug("relay: send to %s failed: %s", s_targets[pending[sent]].label, strerror(errno));
+            sent++;
+            continue;
+        }
+        s_datagrams += (uint64_t)r;
+        sent += r;
+    }
+    for (int i = 0; i < n; i++) {
+        s_targets[pending[i]].bundle_len = 0;
+    }
+#else
+    for (int i = 0; i < n; i++) {
+        relay_target_t *t = &s_targets[pending[i]];
+        send_one(t, t->bundle, t->bundle_len);
+        t->bundle_len = 0;
+    }
+#endif
+}
+
+int relay_next_timeout_ms(void) {
+    for (int i = 0; i < s_target_count; i++) {
+        if (s_targets[i].bundle_len > 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void status_msg(tosc_message *osc, int len, void *ctx) {
+    relay_target_t *t = ctx;
+    const char *address = tosc_getAddress(osc);
+    size_t n = strlen(address);
+    uint64_t now = timebase_now_ns();
+    (void)len;
+
+    if (n >= 14 && strcmp(address + n - 14, "/status/health") == 0 && tosc_getFormat(osc)[0] == 's') {
+        const char *name = tosc_getNextString(osc);
+        int h = LED_OFFLINE;
+        for (int i = LED_HEALTHY; i <= LED_OFFLINE; i++) {
+            if (strcmp(name, led_health_name((led_health_t)i)) == 0) h = i;
+        }
+        if (now - t->health_ns > (uint64_t)RELAY_HEALTH_ROUND_MS * 1000000u || h > t->health) {
+            t->health = h;
+        }
+        t->health_ns = now;
+    } else if (strcmp(address, "/status/relay") == 0 && strcmp(tosc_getFormat(osc), "iii") == 0) {
+        t->sub_servers = tosc_getNextInt32(osc);
+        t->sub_up = tosc_getNextInt32(osc);
+        t->sub_worst = tosc_getNextInt32(osc);
+    }
+}
+
+void relay_handle_readable(void) {
+    char buffer[2048];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    while ((len = recvfrom(s_fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &from_len)) > 0) {
+        relay_target_t *t = NULL;
+        from_len = sizeof(from);
+        /* Status leaves from the downstream's OSC port, so address and port identify it. */
+        for (int i = 0; i < s_target_count && t == NULL; i++) {
+            if (s_targets[i].addr.sin_addr.s_addr == from.sin_addr.s_addr && s_targets[i].addr.sin_port == from.sin_port) {
+                t = &s_targets[i];
+            }
+        }
+        if (t == NULL) {
+            continue;
+        }
+        t->last_seen_ns = timebase_now_ns();
+        state_parse_packet(buffer, (int)len, status_msg, t);
+    }
+}
+
+/* Servers counts each downstream plus whatever it relays to; a silent one counts as offline. */
+static void summarise(const int *targets, int count, uint64_t now, int *servers, int *up, int *worst) {
+    *servers = 0;
+    *up = 0;
+    *worst = LED_HEALTHY;
+    for (int i = 0; i < count; i++) {
+        const relay_target_t *t = &s_targets[targets[i]];
+        bool fresh = t->last_seen_ns != 0 && now - t->last_seen_ns < (uint64_t)RELAY_STALE_MS * 1000000u;
+        *servers += 1 + t->sub_servers;
+        if (!fresh) {
+            *worst = LED_OFFLINE;
+            continue;
+        }
+        *up += 1 + t->sub_up;
+        if (t->health > *worst) *worst = t->health;
+        if (t->sub_worst > *worst) *worst = t->sub_worst;
+    }
+}
+
+/* /status/relay/<name> per rule and /status/relay over every downstream, each "iii":
+   servers, servers answering, worst health (0 healthy, 1 degraded, 2 offline). An upstream
+   relay adds the /status/relay totals into its own. */
+void relay_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len) {
+    char buf[128];
+    char addr[sizeof("/status/relay/") + ZONE_NAME_MAX];
+    uint64_t now = timebase_now_ns();
+    int servers, up, worst;
+
+    if (s_rule_count == 0) {
+        return;
+    }
+    for (int i = 0; i < s_rule_count; i++) {
+        summarise(s_rules[i].targets, s_rules[i].target_count, now, &servers, &up, &worst);
+        if (snprintf(addr, sizeof(addr), "/status/relay/%s", s_rules[i].def.name) >= (int)sizeof(addr)) {
+            continue;
+        }
+        uint32_t len = tosc_writeMessage(buf, sizeof(buf), addr, "iii", servers, up, worst);
+        sendto(fd, buf, len, 0, peer, peer_len);
+    }
+    int all[RELAY_TARGET_SLOTS];
+    for (int i = 0; i < s_target_count; i++) all[i] = i;
+    summarise(all, s_target_count, now, &servers, &up, &worst);
+    uint32_t len = tosc_writeMessage(buf, sizeof(buf), "/status/relay", "iii", servers, up, worst);
+    sendto(fd, buf, len, 0, peer, peer_len);
+}
+
+/* Rules and targets are rebuilt; pending bundles go out under the old rules first. */
+void relay_settings_changed(void) {
+    relay_shutdown();
+    relay_init();
+}
+
+void relay_log_stats(void) {
+    if (s_rule_count > 0) {
+        log_info("relay: %llu messages forwarded in %llu datagrams, %llu send calls",
+                 (unsigned long long)s_forwarded, (unsigned long long)s_datagrams, (unsigned long long)s_send_calls);
+    }
+}
+
+void relay_shutdown(void) {
+    relay_flush();
+    if (s_fd >= 0) {
+        close(s_fd);
+        s_fd = -1;
+    }
+    s_rule_count = 0;
+    s_target_count = 0;
+}
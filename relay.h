@@ -0,0 +1,22 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "tinyosc.h"
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/* Relay mode: messages matching a relay.<name>.match prefix are forwarded to that rule's
+   downstream servers instead of being applied here, bundled per destination and per loop pass.
+   Downstream status comes back to the feedback port and is summarised under /status/relay. */
+void relay_init(void);
+int relay_fd(void);
+bool relay_offer(tosc_message *osc);
+void relay_flush(void);
+int relay_next_timeout_ms(void);
+void relay_handle_readable(void);
+void relay_send_status(int fd, const struct sockaddr *peer, socklen_t peer_len);
+void relay_settings_changed(void);
+void relay_log_stats(void);
+void relay_shutdown(void);
+
+#endif /* RELAY_H */
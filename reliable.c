@@ -0,0 +1,161 @@
+#include "reliable.h"
+#include "config.h"
+#include "settings.h"
+#include "alog.h"
+#include "timebase.h"
+#include "tinyosc.h"
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Sequence numbers up to cum have all been applied; bit n of window is cum + 1 + n. */
+typedef struct {
+    bool used;
+    struct sockaddr_in peer;
+    uint32_t sender;
+    uint32_t cum;
+    uint32_t window;
+    bool ack_pending;
+    uint64_t seen_ns;
+} reliable_sender_t;
+
+static reliable_sender_t s_senders[RELIABLE_SENDERS];
+static uint64_t s_packets;
+static uint64_t s_duplicates;
+static uint64_t s_acks;
+
+/* A sender is its address plus its id, so a restarted client with a new id starts afresh. */
+static reliable_sender_t *find_sender(const struct sockaddr_in *from, uint32_t id) {
+    for (int i = 0; i < RELIABLE_SENDERS; i++) {
+        reliable_sender_t *s = &s_senders[i];
+        if (s->used && s->sender == id && s->peer.sin_addr.s_addr == from->sin_addr.s_addr) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* Takes a free slot, or the least recently heard sender's. */
+static reliable_sender_t *add_sender(uint32_t id) {
+    reliable_sender_t *oldest = &s_senders[0];
+
+    for (int i = 0; i < RELIABLE_SENDERS; i++) {
+        reliable_sender_t *s = &s_senders[i];
+        if (!s->used || (oldest->used && s->seen_ns < oldest->seen_ns)) {
+            oldest = s;
+        }
+    }
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->used = true;
+    oldest->sender = id;
+    return oldest;
+}
+
+/* Looks only at the first message of a bundle, so plain packets cost one comparison. */
+static bool parse_marker(char *buffer, int len, uint32_t *id, uint32_t *seq) {
+    if (len < 20 || !tosc_isBundle(buffer)) {
+        return false;
+    }
+    uint32_t size;
+    memcpy(&size, buffer + 16, 4);
+    size = ntohl(size);
+    if (size < 12 || size > (uint32_t)len - 20 || memcmp(buffer + 20, RELIABLE_ADDRESS, sizeof(RELIABLE_ADDRESS)) != 0) {
+        return false;
+    }
+    tosc_message osc;
+    if (tosc_parseMessage(&osc, buffer + 20, (int)size) != 0 || strcmp(tosc_getFormat(&osc), "ii") != 0 ||
+        osc.marker + 8 > osc.buffer + size) {
+        return false;
+    }
+    *id = (uint32_t)tosc_getNextInt32(&osc);
+    *seq = (uint32_t)tosc_getNextInt32(&osc);
+    return *seq != 0;
+}
+
+bool reliable_marked(char *buffer, int len) {
+    uint32_t id, seq;
+    return parse_marker(buffer, len, &id, &seq);
+}
+
+static bool already_applied(const reliable_sender_t *s, uint32_t seq) {
+    return seq <= s->cum || (seq - s->cum <= RELIABLE_WINDOW && (s->window & (1u << (seq - s->cum - 1))));
+}
+
+/* Only looks: a new packet is recorded by reliable_accept() once it has been queued, so a packet
+   that is rejected is neither acked nor later suppressed as a duplicate. */
+reliable_result_t reliable_check(char *buffer, int len, const struct sockaddr_in *from) {
+    uint32_t id, seq;
+
+    if (!parse_marker(buffer, len, &id, &seq)) {
+        return RELIABLE_PLAIN;
+    }
+    reliable_sender_t *s = find_sender(from, id);
+    if (s == NULL || !already_applied(s, seq)) {
+        return RELIABLE_NEW;
+    }
+    s->peer = *from;
+    s->seen_ns = timebase_now_ns();
+    s->ack_pending = true;
+    s_packets++;
+    s_duplicates++;
+    log_debug("reliable: duplicate %u from %08x", seq, id);
+    return RELIABLE_DUPLICATE;
+}
+
+void reliable_accept(char *buffer, int len, const struct sockaddr_in *from) {
+    uint32_t id, seq;
+
+    if (!parse_marker(buffer, len, &id, &seq)) {
+        return;
+    }
+    reliable_sender_t *s = find_sender(from, id);
+    if (s == NULL) {
+        s = add_sender(id);
+    }
+    s->peer = *from;
+    s->seen_ns = timebase_now_ns();
+    s->ack_pending = true;
+    s_packets++;
+    if (already_applied(s, seq)) {
+        return;
+    }
+    /* Too far ahead: the sender gave up on the oldest ones, so slide the window up to seq. */
+    if (seq - s->cum > RELIABLE_WINDOW) {
+        uint32_t shift = seq - s->cum - RELIABLE_WINDOW;
+        s->window = shift >= 32 ? 0 : s->window >> shift;
+        s->cum += shift;
+    }
+    s->window |= 1u << (seq - s->cum - 1);
+    while (s->window & 1) {
+        s->window >>= 1;
+        s->cum++;
+    }
+}
+
+/* One ack per sender per loop pass, however many of its packets arrived in it. */
+void reliable_send_acks(int fd) {
+    char buf[64];
+
+    for (int i = 0; i < RELIABLE_SENDERS; i++) {
+        reliable_sender_t *s = &s_senders[i];
+        if (!s->used || !s->ack_pending) {
+            continue;
+        }
+        struct sockaddr_in dest = s->peer;
+        dest.sin_port = htons(settings()->feedback_port);
+        uint32_t len = tosc_writeMessage(buf, sizeof(buf), RELIABLE_ACK_ADDRESS, "iii", (int32_t)s->sender,
+                                         (int32_t)s->cum, (int32_t)s->window);
+        if (sendto(fd, buf, len, 0, (struct sockaddr *)&dest, sizeof(dest)) > 0) {
+            s_acks++;
+        }
+        s->ack_pending = false;
+    }
+}
+
+void reliable_log_stats(void) {
+    if (s_packets > 0) {
+        log_info("reliable: %llu packets, %llu duplicates suppressed, %llu acks sent",
+                 (unsigned long long)s_packets, (unsigned long long)s_duplicates, (unsigned long long)s_acks);
+    }
+}
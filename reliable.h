@@ -0,0 +1,34 @@
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+/* Optional reliable delivery on top of OSC. A sender that wants it sends each packet as a
+   bundle whose first message is
+
+       /rel ,ii <sender id> <seq>
+
+   with seq counting up from 1 per sender id. The server applies each seq once. Once a packet
+   has been queued (reliable_accept), it answers on the feedback port with a cumulative ack,
+   once per loop pass:
+
+       /ack ,iii <sender id> <every seq up to this one arrived> <bit n: cum + 1 + n arrived>
+
+   The sender retransmits anything not acked in time. Plain packets are not touched. */
+#define RELIABLE_ADDRESS "/rel"
+#define RELIABLE_ACK_ADDRESS "/ack"
+
+typedef enum {
+    RELIABLE_PLAIN,     /* No /rel marker */
+    RELIABLE_NEW,       /* First copy: apply it */
+    RELIABLE_DUPLICATE  /* Already applied: acked again, not applied */
+} reliable_result_t;
+
+bool reliable_marked(char *buffer, int len);
+reliable_result_t reliable_check(char *buffer, int len, const struct sockaddr_in *from);
+void reliable_accept(char *buffer, int len, const struct sockaddr_in *from);
+void reliable_send_acks(int fd);
+void reliable_log_stats(void);
+
+#endif /* RELIABLE_H */
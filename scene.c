@@ -0,0 +1,164 @@
+#include "scene.h"
+#include "config.h"
+#include "persist.h"
+#include "state.h"
+#include "zone.h"
+#include "alog.h"
+#include <string.h>
+
+#define SCENE_FILE_VERSION 2
+
+/* Entries are keyed by zone name, like the state file, so zones can be added or reordered. */
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    state_look_t look;
+} scene_entry_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t reserved;
+    scene_entry_t entries[SCENE_MAX][ZONE_MAX];
+} scene_table_t;
+
+/* Version 1, before blinks had a period and duty. */
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    state_look_v1_t look;
+} scene_entry_v1_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t reserved;
+    scene_entry_v1_t entries[SCENE_MAX][ZONE_MAX];
+} scene_table_v1_t;
+
+static scene_table_t s_table;
+static persist_t s_store;
+
+/* Reads a version 1 file into s_table; the caller then rewrites it in the current layout. */
+static bool upgrade_v1(const char *path) {
+    static scene_table_v1_t old;
+    size_t len = 0;
+    bool ok = false;
+
+    if (!persist_sized_for(path, sizeof(scene_table_v1_t)) ||
+        !persist_open(&s_store, path, sizeof(scene_table_v1_t))) {
+        return false;
+    }
+    if (persist_load(&s_store, &old, &len, sizeof(old)) && len == sizeof(old) && old.version == 1) {
+        memset(&s_table, 0, sizeof(s_table));
+        for (int n = 0; n < SCENE_MAX; n++) {
+            for (int i = 0; i < ZONE_MAX; i++) {
+                memcpy(s_table.entries[n][i].name, old.entries[n][i].name, ZONE_NAME_MAX);
+                state_look_upgrade(&old.entries[n][i].look, &s_table.entries[n][i].look);
+            }
+        }
+        ok = true;
+    }
+    persist_close(&s_store);
+    return ok;
+}
+
+bool scene_open(const char *path) {
+    size_t len = 0;
+
+    if (upgrade_v1(path)) {
+        if (!persist_open(&s_store, path, sizeof(scene_table_t))) {
+            return false;
+        }
+        s_table.version = SCENE_FILE_VERSION;
+        persist_store(&s_store, &s_table, sizeof(s_table));
+        log_info("scene: upgraded %s", path);
+        return true;
+    }
+    if (!persist_open(&s_store, path, sizeof(scene_table_t))) {
+        return false;
+    }
+    if (persist_load(&s_store, &s_table, &len, sizeof(s_table))) {
+        if (len != sizeof(s_table) || s_table.version != SCENE_FILE_VERSION) {
+            log_warn("scene: ignoring %s, unknown layout", path);
+            memset(&s_table, 0, sizeof(s_table));
+        }
+    }
+    s_table.version = SCENE_FILE_VERSION;
+    return true;
+}
+
+void scene_close(void) {
+    persist_close(&s_store);
+}
+
+static scene_entry_t *find_entry(int n, const char *name, bool create) {
+    scene_entry_t *free_entry = NULL;
+
+    for (int i = 0; i < ZONE_MAX; i++) {
+        scene_entry_t *e = &s_table.entries[n][i];
+        if (e->name[0] == '\0') {
+            if (free_entry == NULL) free_entry = e;
+        } else if (strncmp(e->name, name, ZONE_NAME_MAX) == 0) {
+            return e;
+        }
+    }
+    if (create && free_entry != NULL) {
+        memset(free_entry, 0, sizeof(*free_entry));
+        strncpy(free_entry->name, name, ZONE_NAME_MAX - 1);
+        return free_entry;
+    }
+    return NULL;
+}
+
+static bool valid_slot(int n) {
+    if (n < 0 || n >= SCENE_MAX) {
+        log_warn("scene: %d out of range 0-%d", n, SCENE_MAX - 1);
+        return false;
+    }
+    return true;
+}
+
+bool scene_store(const struct zone *only, int n) {
+    if (!valid_slot(n)) {
+        return false;
+    }
+    if (only == NULL) {
+        memset(s_table.entries[n], 0, sizeof(s_table.entries[n]));
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        const zone_t *z = zone_get(i);
+        if (only != NULL && z != only) {
+            continue;
+        }
+        scene_entry_t *e = find_entry(n, z->name, true);
+        if (e != NULL) {
+            state_get_look(z, &e->look);
+        }
+    }
+    persist_store(&s_store, &s_table, sizeof(s_table));
+    log_info("scene: stored %d%s%s", n, only != NULL ? " for zone " : "", only != NULL ? only->name : "");
+    return true;
+}
+
+/* All affected zones change together before the next render, so each light is written once. */
+bool scene_recall(const struct zone *only, int n, uint32_t fade_ms) {
+    int recalled = 0;
+
+    if (!valid_slot(n)) {
+        return false;
+    }
+    for (int i = 0; i < zone_count(); i++) {
+        zone_t *z = zone_get(i);
+        if (only != NULL && z != only) {
+            continue;
+        }
+        const scene_entry_t *e = find_entry(n, z->name, false);
+        if (e != NULL) {
+            state_set_look(z, &e->look, fade_ms);
+            recalled++;
+        }
+    }
+    if (recalled == 0) {
+        log_warn("scene: %d is empty", n);
+        return false;
+    }
+    log_info("scene: recalled %d (%d zone(s), fade %u ms)", n, recalled, (unsigned)fade_ms);
+    return true;
+}
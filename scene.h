@@ -0,0 +1,15 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct zone;
+
+/* Preset looks. A NULL zone means every zone; otherwise only that zone's entry is touched. */
+bool scene_open(const char *path);
+void scene_close(void);
+bool scene_store(const struct zone *only, int n);
+bool scene_recall(const struct zone *only, int n, uint32_t fade_ms);
+
+#endif /* SCENE_H */
@@ -0,0 +1,428 @@
+#include "settings.h"
+#include "config.h"
+#include "ratelimit.h"
+#include "dmx.h"
+#include "alog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define SETTINGS_MAX_OVERRIDES 16
+#define ZONE_NAME_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-"
+
+typedef enum { SETTING_INT, SETTING_DOUBLE, SETTING_STRING, SETTING_POLICY, SETTING_MERGE } setting_type_t;
+
+typedef struct {
+    const char *key;
+    setting_type_t type;
+    size_t offset;
+    size_t size;
+    double min;
+    double max;
+} setting_desc_t;
+
+#define FIELD(f) offsetof(settings_t, f), sizeof(((settings_t *)0)->f)
+
+static const setting_desc_t s_descs[] = {
+    { "feedback_port", SETTING_INT, FIELD(feedback_port), 1, 65535 },
+    { "ssdp_port", SETTING_INT, FIELD(ssdp_port), 1, 65535 },
+    { "ssdp_interval", SETTING_INT, FIELD(ssdp_interval), 1, 86400 },
+    { "ssdp_max_age", SETTING_INT, FIELD(ssdp_max_age), 1, 86400 },
+    { "status_interval", SETTING_INT, FIELD(status_interval), 1, 3600 },
+    { "netif_poll_interval", SETTING_INT, FIELD(netif_poll_interval), 1, 3600 },
+    { "render_fps", SETTING_INT, FIELD(render_fps), 1, 1000 },
+    { "blink_interval_ms", SETTING_INT, FIELD(blink_interval_ms), 10, 60000 },
+    { "dither_fps", SETTING_INT, FIELD(dither_fps), 0, 1000 },
+    { "rate_limit", SETTING_DOUBLE, FIELD(rate_limit), 0, 1e6 },
+    { "rate_burst", SETTING_DOUBLE, FIELD(rate_burst), 0, 1e6 },
+    { "rate_policy", SETTING_POLICY, FIELD(rate_policy), 0, 0 },
+    { "vendor_id", SETTING_INT, FIELD(vendor_id), 0, 0xFFFF },
+    { "product_id", SETTING_INT, FIELD(product_id), 0, 0xFFFF },
+    { "device", SETTING_STRING, FIELD(device), 0, 0 },
+    { "lut", SETTING_STRING, FIELD(lut_path), 0, 0 },
+    { "sacn", SETTING_INT, FIELD(sacn), 0, 1 },
+    { "artnet", SETTING_INT, FIELD(artnet), 0, 1 },
+    { "dmx_universe", SETTING_INT, FIELD(dmx_universe), DMX_UNMAPPED, 63999 },
+    { "dmx_channel", SETTING_INT, FIELD(dmx_channel), 1, DMX_MAX_START_CHANNEL },
+    { "dmx_merge", SETTING_MERGE, FIELD(dmx_merge), 0, 0 },
+    { "shm", SETTING_STRING, FIELD(shm), 0, 0 },
+    { "unix_socket", SETTING_STRING, FIELD(unix_socket), 0, 0 },
+    { "unix_allow", SETTING_STRING, FIELD(unix_allow), 0, 0 },
+    { "osc_group", SETTING_STRING, FIELD(osc_group), 0, 0 },
+    { "osc_group_port", SETTING_INT, FIELD(osc_group_port), 1, 65535 },
+    { "groups", SETTING_STRING, FIELD(groups), 0, 0 },
+    { "sync_port", SETTING_INT, FIELD(sync_port), 0, 65535 },
+    { "sync_priority", SETTING_INT, FIELD(sync_priority), 0, 255 },
+    { "listen_address", SETTING_STRING, FIELD(listen_address), 0, 0 },
+};
+
+static const settings_t s_defaults = {
+    .feedback_port = FEEDBACK_PORT,
+    .ssdp_port = SSDP_PORT,
+    .ssdp_interval = SSDP_INTERVAL,
+    .ssdp_max_age = SSDP_MAX_AGE,
+    .status_interval = STATUS_INTERVAL,
+    .netif_poll_interval = NETIF_POLL_INTERVAL,
+    .render_fps = RENDER_FPS,
+    .blink_interval_ms = BLINK_INTERVAL_MS,
+    .dither_fps = DITHER_FPS,
+    .rate_limit = RATELIMIT_RATE,
+    .rate_burst = RATELIMIT_BURST,
+    .rate_policy = RATELIMIT_COALESCE,
+    .vendor_id = VENDOR_ID,
+    .product_id = PRODUCT_ID,
+    .device = "",
+    .lut_path = "",
+    .dmx_universe = DMX_UNMAPPED,
+    .dmx_channel = 1,
+    .dmx_merge = DMX_MERGE_HTP,
+    .shm = "",
+    .unix_socket = "",
+    .unix_allow = "",
+    .osc_group = "",
+    .osc_group_port = OSC_GROUP_PORT,
+    .groups = "",
+    .sync_port = 0,
+    .sync_priority = SYNC_PRIORITY,
+    .listen_address = "",
+};
+
+static settings_t s_current = s_defaults;
+
+static struct {
+    const setting_desc_t *desc;
+    char value[256];
+} s_overrides[SETTINGS_MAX_OVERRIDES];
+static int s_override_count;
+
+static char s_path[512];
+static int s_watch_fd = -1;
+static time_t s_mtime;
+
+static const setting_desc_t *find_desc(const char *key) {
+    for (size_t i = 0; i < sizeof(s_descs) / sizeof(s_descs[0]); i++) {
+        if (strcmp(s_descs[i].key, key) == 0) {
+            return &s_descs[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parse_value(const setting_desc_t *d, const char *value, settings_t *dst) {
+    char *field = (char *)dst + d->offset;
+    char *end;
+
+    errno = 0;
+    switch (d->type) {
+        case SETTING_INT: {
+            long v = strtol(value, &end, 0);
+            if (errno != 0 || end == value || *end != '\0' || v < d->min || v > d->max) {
+                return false;
+            }
+            *(int *)field = (int)v;
+            return true;
+        }
+        case SETTING_DOUBLE: {
+            double v = strtod(value, &end);
+            if (errno != 0 || end == value || *end != '\0' || v < d->min || v > d->max) {
+                return false;
+            }
+            *(double *)field = v;
+            return true;
+        }
+        case SETTING_POLICY: {
+            ratelimit_policy_t policy;
+            if (!ratelimit_parse_policy(value, &policy)) {
+                return false;
+            }
+            *(int *)field = (int)policy;
+            return true;
+        }
+        case SETTING_MERGE: {
+            dmx_merge_t merge;
+            if (!dmx_parse_merge(value, &merge)) {
+                return false;
+            }
+            *(int *)field = (int)merge;
+            return true;
+        }
+        case SETTING_STRING:
+            if (strlen(value) >= d->size) {
+                return false;
+            }
+            strcpy(field, value);
+            return true;
+    }
+    return false;
+}
+
+/* zone.<name>.<port|prefix|devices|universe|channel> = value */
+static bool parse_zone_key(settings_t *dst, const char *key, const char *value) {
+    const char *dot = strchr(key, '.');
+    size_t name_len = dot != NULL ? (size_t)(dot - key) : 0;
+    zone_def_t *z = NULL;
+
+    if (name_len == 0 || name_len >= ZONE_NAME_MAX || strspn(key, ZONE_NAME_CHARS) != name_len) {
+        return false;
+    }
+    for (int i = 0; i < dst->zone_count; i++) {
+        if (strncmp(dst->zones[i].name, key, name_len) == 0 && dst->zones[i].name[name_len] == '\0') {
+            z = &dst->zones[i];
+        }
+    }
+    if (z == NULL) {
+        if (dst->zone_count >= ZONE_MAX) {
+            return false;
+        }
+        z = &dst->zones[dst->zone_count++];
+        memset(z, 0, sizeof(*z));
+        memcpy(z->name, key, name_len);
+        z->universe = DMX_UNMAPPED;
+        z->channel = 1;
+    }
+
+    const char *field = dot + 1;
+    if (strcmp(field, "port") == 0) {
+        char *end;
+        long v = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || v < 0 || v > 65535) {
+            return false;
+        }
+        z->port = (int)v;
+    } else if (strcmp(field, "prefix") == 0) {
+        size_t n = strlen(value);
+        if (n >= sizeof(z->prefix) || (n > 0 && (value[0] != '/' || value[n - 1] == '/'))) {
+            return false;
+        }
+        strcpy(z->prefix, value);
+    } else if (strcmp(field, "universe") == 0 || strcmp(field, "channel") == 0) {
+        bool universe = field[0] == 'u';
+        char *end;
+        long v = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || v < (universe ? DMX_UNMAPPED : 1) || v > (universe ? 63999 : DMX_MAX_START_CHANNEL)) {
+            return false;
+        }
+        *(universe ? &z->universe : &z->channel) = (int)v;
+    } else if (strcmp(field, "devices") == 0) {
+        if (strlen(value) >= sizeof(z->devices)) {
+            return false;
+        }
+        strcpy(z->devices, value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* relay.<name>.<match|targets|strip> = value */
+static bool parse_relay_key(settings_t *dst, const char *key, const char *value) {
+    const char *dot = strchr(key, '.');
+    size_t name_len = dot != NULL ? (size_t)(dot - key) : 0;
+    relay_def_t *r = NULL;
+
+    if (name_len == 0 || name_len >= ZONE_NAME_MAX || strspn(key, ZONE_NAME_CHARS) != name_len) {
+        return false;
+    }
+    for (int i = 0; i < dst->relay_count; i++) {
+        if (strncmp(dst->relays[i].name, key, name_len) == 0 && dst->relays[i].name[name_len] == '\0') {
+            r = &dst->relays[i];
+        }
+    }
+    if (r == NULL) {
+        if (dst->relay_count >= RELAY_MAX) {
+            return false;
+        }
+        r = &dst->relays[dst->relay_count++];
+        memset(r, 0, sizeof(*r));
+        memcpy(r->name, key, name_len);
+    }
+
+    const char *field = dot + 1;
+    if (strcmp(field, "match") == 0) {
+        size_t n = strlen(value);
+        if (n == 0 || n >= sizeof(r->match) || value[0] != '/' || (n > 1 && value[n - 1] == '/')) {
+            return false;
+        }
+        strcpy(r->match, value);
+    } else if (strcmp(field, "targets") == 0) {
+        if (strlen(value) >= sizeof(r->targets)) {
+            return false;
+        }
+        strcpy(r->targets, value);
+    } else if (strcmp(field, "strip") == 0) {
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            return false;
+        }
+        r->strip = value[0] == '1';
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) e--;
+    *e = '\0';
+    return s;
+}
+
+const settings_t *settings(void) { return &s_current; }
+
+bool settings_override(const char *key, const char *value) {
+    const setting_desc_t *d = find_desc(key);
+    if (d == NULL || s_override_count >= SETTINGS_MAX_OVERRIDES || strlen(value) >= sizeof(s_overrides[0].value) ||
+        !parse_value(d, value, &s_current)) {
+        return false;
+    }
+    s_overrides[s_override_count].desc = d;
+    strcpy(s_overrides[s_override_count].value, value);
+    s_override_count++;
+    return true;
+}
+
+/* Keys missing from the file fall back to defaults; keys with bad values keep their current value. */
+bool settings_load(const char *path) {
+    char line[512];
+    int lineno = 0;
+    settings_t next = s_defaults;
+    struct stat st;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        log_error("config: cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (path != s_path) {
+        snprintf(s_path, sizeof(s_path), "%s", path);
+    }
+    if (fstat(fileno(f), &st) == 0) {
+        s_mtime = st.st_mtime;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        char *s = trim(line);
+        if (*s == '\0') continue;
+
+        char *eq = strchr(s, '=');
+        if (eq == NULL) {
+            log_warn("config: %s:%d: expected key = value", path, lineno);
+            continue;
+        }
+        *eq = '\0';
+        char *key = trim(s);
+        char *value = trim(eq + 1);
+        if (strncmp(key, "zone.", 5) == 0) {
+            if (!parse_zone_key(&next, key + 5, value)) {
+                log_warn("config: %s:%d: invalid zone setting %s", path, lineno, key);
+            }
+            continue;
+        }
+        if (strncmp(key, "relay.", 6) == 0) {
+            if (!parse_relay_key(&next, key + 6, value)) {
+                log_warn("config: %s:%d: invalid relay setting %s", path, lineno, key);
+            }
+            continue;
+        }
+        const setting_desc_t *d = find_desc(key);
+        if (d == NULL) {
+            log_warn("config: %s:%d: unknown setting %s", path, lineno, key);
+            continue;
+        }
+        if (!parse_value(d, value, &next)) {
+            log_warn("config: %s:%d: invalid value for %s, keeping current", path, lineno, key);
+            memcpy((char *)&next + d->offset, (const char *)&s_current + d->offset, d->size);
+        }
+    }
+    fclose(f);
+
+    for (int i = 0; i < s_override_count; i++) {
+        parse_value(s_overrides[i].desc, s_overrides[i].value, &next);
+    }
+    s_current = next;
+    log_info("config: loaded %s", path);
+    return true;
+}
+
+/* Watch the directory rather than the file: editors usually save by renaming a new file over it. */
+int settings_watch_init(void) {
+#ifdef __linux__
+    char dir[512];
+
+    if (s_path[0] == '\0') {
+        return -1;
+    }
+    snprintf(dir, sizeof(dir), "%s", s_path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == dir) {
+        dir[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    s_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (s_watch_fd < 0) {
+        log_error("config: inotify_init failed: %s", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(s_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_error("config: cannot watch %s: %s", dir, strerror(errno));
+        close(s_watch_fd);
+        s_watch_fd = -1;
+    }
+#endif
+    return s_watch_fd;
+}
+
+int settings_watch_fd(void) { return s_watch_fd; }
+
+bool settings_handle_readable(void) {
+    bool relevant = false;
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *base = strrchr(s_path, '/') != NULL ? strrchr(s_path, '/') + 1 : s_path;
+    ssize_t len;
+
+    while ((len = read(s_watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, base) == 0) {
+                relevant = true;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#endif
+    return relevant && settings_load(s_path);
+}
+
+/* Fallback where inotify is unavailable: reload when the modification time changes. */
+bool settings_poll(void) {
+    struct stat st;
+
+    if (s_path[0] == '\0' || stat(s_path, &st) < 0 || st.st_mtime == s_mtime) {
+        return false;
+    }
+    return settings_load(s_path);
+}
+
+void settings_watch_shutdown(void) {
+    if (s_watch_fd >= 0) {
+        close(s_watch_fd);
+        s_watch_fd = -1;
+    }
+}
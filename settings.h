@@ -0,0 +1,71 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "config.h"
+#include <stdbool.h>
+
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    int port;           /* 0 for the main -p port */
+    char prefix[32];    /* OSC address prefix such as /stage; empty to take every address on the port */
+    char devices[128];  /* Comma-separated serials; empty for the global device setting */
+    int universe;       /* DMX universe driving the zone; DMX_UNMAPPED (-1) for none */
+    int channel;        /* First of three (R, G, B) DMX channels, 1-based */
+} zone_def_t;
+
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    char match[64];     /* OSC address prefix forwarded downstream, matched on whole segments */
+    char targets[256];  /* Comma-separated host[:port] of the downstream servers */
+    int strip;          /* Remove the matched prefix before forwarding */
+} relay_def_t;
+
+/* Runtime settings. Defaults come from config.h, then the config file, then command-line
+   overrides. The file is watched and reloaded while the server runs. */
+typedef struct {
+    int feedback_port;
+    int ssdp_port;
+    int ssdp_interval;
+    int ssdp_max_age;
+    int status_interval;
+    int netif_poll_interval;
+    int render_fps;
+    int blink_interval_ms;
+    int dither_fps;
+    double rate_limit;
+    double rate_burst;
+    int rate_policy;
+    int vendor_id;
+    int product_id;
+    char device[64];     /* Serial of the light to drive; empty for the first one found */
+    char lut_path[256];  /* Color lookup table applied to every frame; empty for none */
+    int sacn;            /* Listen for sACN (E1.31) */
+    int artnet;          /* Listen for Art-Net */
+    int dmx_universe;    /* Universe and start channel for the default zone */
+    int dmx_channel;
+    int dmx_merge;       /* dmx_merge_t */
+    char shm[64];        /* POSIX shared-memory name of the local control ring; empty for none */
+    char unix_socket[108];  /* Path of the local SOCK_SEQPACKET OSC socket; empty for none */
+    char unix_allow[128];   /* Comma-separated uids allowed on it; empty for our own user and root */
+    char osc_group[16];  /* Multicast group to take OSC from; empty for none */
+    int osc_group_port;
+    char groups[128];    /* Comma-separated /group/<name>/ names this server answers, besides "all" */
+    int sync_port;       /* UDP port for clock beacons between servers; 0 disables phase sync */
+    int sync_priority;   /* Election priority, lower leads */
+    char listen_address[64];  /* IPv4 address or interface name for the UDP listeners; empty for all */
+    zone_def_t zones[ZONE_MAX];
+    int zone_count;
+    relay_def_t relays[RELAY_MAX];
+    int relay_count;
+} settings_t;
+
+const settings_t *settings(void);
+bool settings_override(const char *key, const char *value);
+bool settings_load(const char *path);
+int settings_watch_init(void);
+int settings_watch_fd(void);
+bool settings_handle_readable(void);
+bool settings_poll(void);
+void settings_watch_shutdown(void);
+
+#endif /* SETTINGS_H */
@@ -0,0 +1,238 @@
+#include "shmring.h"
+#include "slicky_shm.h"
+#include "lanes.h"
+#include "settings.h"
+#include "pattern.h"
+#include "zone.h"
+#include "alog.h"
+#include "tinyosc.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static slicky_shm_t *s_ring;
+static char s_name[sizeof(((settings_t *)0)->shm) + 1]; /* The setting plus a leading '/' */
+static char s_bell[104];
+static int s_bell_fd = -1;
+static int s_bell_keep_fd = -1; /* Our own writer, so the FIFO never reads as EOF between producers */
+static uint64_t s_records;
+static uint64_t s_coalesced;
+
+static void close_all(void) {
+    if (s_ring != NULL) {
+        munmap(s_ring, sizeof(*s_ring));
+        shm_unlink(s_name);
+        s_ring = NULL;
+    }
+    if (s_bell_fd >= 0) {
+        close(s_bell_fd);
+        s_bell_fd = -1;
+    }
+    if (s_bell_keep_fd >= 0) {
+        close(s_bell_keep_fd);
+        s_bell_keep_fd = -1;
+    }
+    if (s_bell[0] != '\0') {
+        unlink(s_bell);
+        s_bell[0] = '\0';
+    }
+}
+
+/* Created fresh on every start; a producer still mapped to an old ring must attach again. */
+void shmring_init(void) {
+    const char *name = settings()->shm;
+
+    if (name[0] == '\0') {
+        return;
+    }
+    snprintf(s_name, sizeof(s_name), "%s%s", name[0] == '/' ? "" : "/", name);
+    snprintf(s_bell, sizeof(s_bell), "/tmp%s.bell", s_name);
+
+    shm_unlink(s_name);
+    int fd = shm_open(s_name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0) {
+        log_error("shm: cannot create %s: %s", s_name, strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, (off_t)sizeof(slicky_shm_t)) < 0) {
+        log_error("shm: cannot size %s: %s", s_name, strerror(errno));
+        close(fd);
+        shm_unlink(s_name);
+        return;
+    }
+    void *m = mmap(NULL, sizeof(slicky_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        log_error("shm: mmap %s failed: %s", s_name, strerror(errno));
+        shm_unlink(s_name);
+        return;
+    }
+    s_ring = m;
+
+    unlink(s_bell);
+    if (mkfifo(s_bell, 0660) < 0 || (s_bell_fd = open(s_bell, O_RDONLY | O_NONBLOCK)) < 0 ||
+        (s_bell_keep_fd = open(s_bell, O_WRONLY | O_NONBLOCK)) < 0) {
+        log_error("shm: cannot create doorbell %s: %s", s_bell, strerror(errno));
+        close_all();
+        return;
+    }
+
+    memset(s_ring, 0, sizeof(*s_ring));
+    snprintf(s_ring->bell_path, sizeof(s_ring->bell_path), "%s", s_bell);
+    s_ring->slots = SLICKY_SHM_SLOTS;
+    s_ring->cmd_size = sizeof(slicky_shm_cmd_t);
+    s_ring->version = SLICKY_SHM_VERSION;
+    __atomic_store_n(&s_ring->magic, SLICKY_SHM_MAGIC, __ATOMIC_RELEASE);
+    log_info("shm: control ring %s (%d slots), doorbell %s", s_name, SLICKY_SHM_SLOTS, s_bell);
+}
+
+void shmring_fill_fdset(fd_set *set, int *max_fd) {
+    if (s_bell_fd >= 0) {
+        FD_SET(s_bell_fd, set);
+        if (s_bell_fd > *max_fd) *max_fd = s_bell_fd;
+    }
+}
+
+/* Called last before select(): from here on a producer rings the doorbell. Returns 0 if
+   records arrived meanwhile, so the loop does not block on them. */
+int shmring_next_timeout_ms(void) {
+    if (s_ring == NULL) {
+        return -1;
+    }
+    __atomic_store_n(&s_ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s_ring->head, __ATOMIC_SEQ_CST) != s_ring->tail) {
+        __atomic_store_n(&s_ring->sleeping, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return -1;
+}
+
+/* Records become the same OSC messages a network client would send, so they take the lane,
+   state and blink paths unchanged. */
+static void enqueue(const zone_t *z, const char *cmd, const char *fmt, const slicky_shm_cmd_t *rec, bool debug) {
+    char addr[64];
+    char buf[128];
+    uint32_t len;
+
+    snprintf(addr, sizeof(addr), "%s%s", z->prefix, cmd);
+    switch (rec->op) {
+        case SLICKY_SHM_COLOR:
+            len = tosc_writeMessage(buf, sizeof(buf), addr, fmt, rec->a);
+            break;
+        case SLICKY_SHM_BLINK:
+            len = tosc_writeMessage(buf, sizeof(buf), addr, fmt, rec->a, rec->b, rec->c);
+            break;
+        case SLICKY_SHM_PATTERN:
+            len = tosc_writeMessage(buf, sizeof(buf), addr, fmt, pattern_name((pattern_type_t)rec->a), rec->f);
+            break;
+        case SLICKY_SHM_SCENE_RECALL:
+            len = tosc_writeMessage(buf, sizeof(buf), addr, fmt, rec->a, rec->b);
+            break;
+        default:
+            len = tosc_writeMessage(buf, sizeof(buf), addr, fmt, rec->a);
+            break;
+    }
+    if (len > 0) {
+        lanes_enqueue_packet(buf, (int)len, z->port, debug);
+    }
+}
+
+static void apply(const slicky_shm_cmd_t *rec, bool debug) {
+    const zone_t *z = zone_get(rec->zone);
+
+    switch (rec->op) {
+        case SLICKY_SHM_COLOR:
+            enqueue(z, "/setcolorint", "i", rec, debug);
+            break;
+        case SLICKY_SHM_BLINK:
+            enqueue(z, "/blink", "iii", rec, debug);
+            break;
+        case SLICKY_SHM_PATTERN:
+            if (rec->a >= PATTERN_OFF && rec->a <= PATTERN_STROBE) {
+                enqueue(z, "/pattern", "sf", rec, debug);
+            }
+            break;
+        case SLICKY_SHM_SCENE_RECALL:
+            enqueue(z, "/scene/recall", "ii", rec, debug);
+            break;
+        case SLICKY_SHM_SCENE_STORE:
+            enqueue(z, "/scene/store", "i", rec, debug);
+            break;
+        default:
+            log_debug("shm: unknown op %d", rec->op);
+            break;
+    }
+}
+
+/* Drains everything published so far. Consecutive colors for a zone collapse into the newest,
+   so a kHz producer costs one lane entry per zone per loop pass; any other command flushes its
+   zone's pending color first to keep the order. */
+void shmring_drain(bool debug) {
+    slicky_shm_cmd_t pending[ZONE_MAX];
+    bool has_pending[ZONE_MAX] = { false };
+    char scratch[16];
+
+    if (s_ring == NULL) {
+        return;
+    }
+    __atomic_store_n(&s_ring->sleeping, 0, __ATOMIC_RELAXED);
+    while (read(s_bell_fd, scratch, sizeof(scratch)) > 0) { }
+
+    uint64_t tail = s_ring->tail;
+    uint64_t head = __atomic_load_n(&s_ring->head, __ATOMIC_ACQUIRE);
+    if (head - tail > SLICKY_SHM_SLOTS) {
+        log_warn("shm: producer overran the ring, resynchronising");
+        tail = head;
+    }
+    for (; tail != head; tail++) {
+        slicky_shm_cmd_t rec = s_ring->ring[tail & (SLICKY_SHM_SLOTS - 1)];
+        int zi = rec.zone;
+        s_records++;
+        if (zi >= zone_count()) {
+            log_debug("shm: no zone %d", zi);
+            continue;
+        }
+        if (rec.op == SLICKY_SHM_COLOR) {
+            if (has_pending[zi]) {
+                s_coalesced++;
+            }
+            pending[zi] = rec;
+            has_pending[zi] = true;
+            continue;
+        }
+        if (has_pending[zi]) {
+            apply(&pending[zi], debug);
+            has_pending[zi] = false;
+        }
+        apply(&rec, debug);
+    }
+    __atomic_store_n(&s_ring->tail, tail, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < ZONE_MAX; i++) {
+        if (has_pending[i]) {
+            apply(&pending[i], debug);
+        }
+    }
+}
+
+/* The ring is recreated under the new name; an attached producer has to attach again. */
+void shmring_settings_changed(void) {
+    close_all();
+    shmring_init();
+}
+
+void shmring_log_stats(void) {
+    if (s_ring != NULL && s_records > 0) {
+        log_info("shm: %llu records, %llu colors coalesced, %llu pushes refused while full",
+                 (unsigned long long)s_records, (unsigned long long)s_coalesced,
+                 (unsigned long long)__atomic_load_n(&s_ring->full, __ATOMIC_RELAXED));
+    }
+}
+
+void shmring_shutdown(void) {
+    close_all();
+}
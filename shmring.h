@@ -0,0 +1,16 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+/* Server side of the shared-memory control channel (see slicky_shm.h). */
+void shmring_init(void);
+void shmring_fill_fdset(fd_set *set, int *max_fd);
+int shmring_next_timeout_ms(void);
+void shmring_drain(bool debug);
+void shmring_settings_changed(void);
+void shmring_log_stats(void);
+void shmring_shutdown(void);
+
+#endif /* SHMRING_H */
@@ -0,0 +1,210 @@
+#include "slicky.h"
+#include "hidapi.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#define SLICKY_REPORT_LEN 65
+
+struct slicky_device {
+    hid_device *hid;
+    unsigned short vendor_id;
+    unsigned short product_id;
+    bool any_serial;
+    wchar_t serial[64];
+    uint64_t next_open_ns;
+    uint64_t write_avg_ns;
+    unsigned write_samples;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void ascii_from_wide(char *out, size_t out_len, const wchar_t *w) {
+    size_t o = 0;
+    for ( ; w != NULL && *w && o + 1 < out_len; w++) {
+        out[o++] = (*w >= 0x20 && *w < 0x7F) ? (char)*w : '?';
+    }
+    out[o] = '\0';
+}
+
+/* Reconnects at most once per SLICKY_REOPEN_MS so a missing device costs nothing per frame. */
+static bool ensure_open(slicky_device *dev) {
+    if (dev->hid != NULL) {
+        return true;
+    }
+    uint64_t now = now_ns();
+    if (now < dev->next_open_ns) {
+        return false;
+    }
+    dev->next_open_ns = now + (uint64_t)SLICKY_REOPEN_MS * 1000000u;
+    dev->hid = hid_open(dev->vendor_id, dev->product_id, dev->any_serial ? NULL : dev->serial);
+    /* A replugged device may sit behind a different hub or controller; measure it afresh. */
+    dev->write_avg_ns = 0;
+    dev->write_samples = 0;
+    return dev->hid != NULL;
+}
+
+int slicky_init(void) {
+    return hid_init() < 0 ? -1 : 0;
+}
+
+void slicky_exit(void) {
+    hid_exit();
+}
+
+int slicky_enumerate(unsigned short vendor_id, unsigned short product_id, slicky_info_t *out, int max) {
+    int count = 0;
+    struct hid_device_info *devs = hid_enumerate(vendor_id, product_id);
+
+    for (struct hid_device_info *d = devs; d != NULL; d = d->next) {
+        if (count < max) {
+            memset(&out[count], 0, sizeof(out[count]));
+            if (d->path != NULL) {
+                strncpy(out[count].path, d->path, sizeof(out[count].path) - 1);
+            }
+            ascii_from_wide(out[count].serial, sizeof(out[count].serial), d->serial_number);
+        }
+        count++;
+    }
+    hid_free_enumeration(devs);
+    return count;
+}
+
+slicky_device *slicky_open(unsigned short vendor_id, unsigned short product_id, const char *serial) {
+    slicky_device *dev = calloc(1, sizeof(*dev));
+    if (dev == NULL) {
+        return NULL;
+    }
+    dev->vendor_id = vendor_id;
+    dev->product_id = product_id;
+    dev->any_serial = serial == NULL || serial[0] == '\0';
+    if (!dev->any_serial) {
+        size_t i;
+        for (i = 0; serial[i] != '\0' && i + 1 < sizeof(dev->serial) / sizeof(dev->serial[0]); i++) {
+            dev->serial[i] = (wchar_t)(unsigned char)serial[i];
+        }
+        dev->serial[i] = L'\0';
+    }
+    ensure_open(dev);
+    return dev;
+}
+
+bool slicky_connected(const slicky_device *dev) {
+    return dev != NULL && dev->hid != NULL;
+}
+
+bool slicky_reconnect(slicky_device *dev) {
+    if (dev == NULL) {
+        return false;
+    }
+    if (dev->hid != NULL) {
+        hid_close(dev->hid);
+        dev->hid = NULL;
+    }
+    dev->next_open_ns = 0;
+    return ensure_open(dev);
+}
+
+unsigned slicky_max_fps(const slicky_device *dev) {
+    if (dev == NULL || dev->hid == NULL || dev->write_samples < SLICKY_PACING_SAMPLES) {
+        return 0;
+    }
+    uint64_t period = dev->write_avg_ns * SLICKY_PACING_HEADROOM;
+    if (period < 1000000000u / SLICKY_MAX_FPS) {
+        return SLICKY_MAX_FPS;
+    }
+    return period >= 1000000000u ? 1 : (unsigned)(1000000000u / period);
+}
+
+int slicky_set_color(slicky_device *dev, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+    unsigned char buf[SLICKY_REPORT_LEN];
+
+    if (dev == NULL || !ensure_open(dev)) {
+        return -1;
+    }
+
+    /* Report 0, then 0A 04 00 00 WW BB GG RR */
+    memset(buf, 0, sizeof(buf));
+    buf[1] = 0x0A;
+    buf[2] = 0x04;
+    buf[5] = w;
+    buf[6] = b;
+    buf[7] = g;
+    buf[8] = r;
+
+    uint64_t start = now_ns();
+    int res = hid_write(dev->hid, buf, sizeof(buf));
+    if (res >= 0) {
+        /* Rise fast and decay slowly, so one quick write after a slow patch doesn't lift the rate. */
+        uint64_t took = now_ns() - start;
+        if (dev->write_samples == 0 || took > dev->write_avg_ns) {
+            dev->write_avg_ns = dev->write_samples == 0 ? took : (dev->write_avg_ns + took) / 2;
+        } else {
+            dev->write_avg_ns -= (dev->write_avg_ns - took) / 16;
+        }
+        dev->write_samples++;
+    } else {
+        /* Most likely unplugged: drop the handle and let ensure_open() retry later. */
+        hid_close(dev->hid);
+        dev->hid = NULL;
+    }
+    return res;
+}
+
+int slicky_set_rgb(slicky_device *dev, uint32_t rgb) {
+    return slicky_set_color(dev, (rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF, 0);
+}
+
+void slicky_close(slicky_device *dev) {
+    if (dev == NULL) {
+        return;
+    }
+    if (dev->hid != NULL) {
+        hid_close(dev->hid);
+    }
+    free(dev);
+}
+
+uint32_t slicky_hsv_to_rgb(float H, float S, float V) {
+    H = fmodf(H, 1.0f);
+
+    float h = H * 6;
+    unsigned char i = (unsigned char)floorf(h);
+    float a = V * (1 - S);
+    float b = V * (1 - S * (h - i));
+    float c = V * (1 - (S * (1 - (h - i))));
+    float rf, gf, bf;
+
+    switch (i) {
+        case 0:
+            rf = V * 255; gf = c * 255; bf = a * 255;
+            break;
+        case 1:
+            rf = b * 255; gf = V * 255; bf = a * 255;
+            break;
+        case 2:
+            rf = a * 255; gf = V * 255; bf = c * 255;
+            break;
+        case 3:
+            rf = a * 255; gf = b * 255; bf = V * 255;
+            break;
+        case 4:
+            rf = c * 255; gf = a * 255; bf = V * 255;
+            break;
+        case 5:
+        default:
+            rf = V * 255; gf = a * 255; bf = b * 255;
+            break;
+    }
+
+    unsigned char R = (unsigned char)rf;
+    unsigned char G = (unsigned char)gf;
+    unsigned char B = (unsigned char)bf;
+    return (uint32_t)((R << 16) | (G << 8) | B);
+}
@@ -0,0 +1,56 @@
+#ifndef SLICKY_H
+#define SLICKY_H
+
+/* libslicky: device discovery, a persistent session and color output for the Slicky USB light.
+   Link with libslicky.a or libslicky.so/.dylib plus hidapi. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLICKY_VENDOR_ID 0x04D8
+#define SLICKY_PRODUCT_ID 0xEC24
+#define SLICKY_REOPEN_MS 1000 /* Minimum time between reconnect attempts after the device goes away */
+#define SLICKY_PACING_SAMPLES 8  /* Writes timed after (re)connecting before a rate is reported */
+#define SLICKY_PACING_HEADROOM 2 /* Frame period as a multiple of the measured write time */
+#define SLICKY_MAX_FPS 1000
+
+typedef struct slicky_device slicky_device;
+
+typedef struct {
+    char path[256];
+    char serial[64];
+} slicky_info_t;
+
+/* Initialise hidapi; call once before anything else. Returns 0 on success, -1 on failure. */
+int slicky_init(void);
+void slicky_exit(void);
+
+/* Fills up to max entries and returns the number of matching devices found. */
+int slicky_enumerate(unsigned short vendor_id, unsigned short product_id, slicky_info_t *out, int max);
+
+/* Opens a session for the first device matching serial (NULL for any). The session outlives the
+   device: if it is absent or unplugged, writes fail and the session reconnects on its own. Returns
+   NULL only on allocation failure. */
+slicky_device *slicky_open(unsigned short vendor_id, unsigned short product_id, const char *serial);
+bool slicky_connected(const slicky_device *dev);
+/* Drops the current handle and opens the device again right away, ignoring SLICKY_REOPEN_MS.
+   May block in hidapi; meant for a recovery thread. Returns true if the device is back. */
+bool slicky_reconnect(slicky_device *dev);
+/* Highest frame rate the device sustains, from timing recent writes; 0 until enough were measured. */
+unsigned slicky_max_fps(const slicky_device *dev);
+int slicky_set_color(slicky_device *dev, uint8_t r, uint8_t g, uint8_t b, uint8_t w);
+int slicky_set_rgb(slicky_device *dev, uint32_t rgb);
+void slicky_close(slicky_device *dev);
+
+uint32_t slicky_hsv_to_rgb(float h, float s, float v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLICKY_H */
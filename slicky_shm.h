@@ -0,0 +1,155 @@
+#ifndef SLICKY_SHM_H
+#define SLICKY_SHM_H
+
+/* Client side of oscserver's shared-memory control channel, for a producer on the same host
+   (set "shm = /name" in the server's settings). Commands are fixed-size records in a
+   single-producer/single-consumer ring. A push is a few stores and no system call. The
+   server's doorbell FIFO is written only when the server is idle in select(), at most once
+   per loop pass.
+
+       int bell;
+       slicky_shm_t *ring = slicky_shm_attach("/slicky_osc", &bell);
+       slicky_shm_color(ring, bell, 0, 0xFF8000);
+       slicky_shm_detach(ring, bell);
+
+   One producer at a time: attaching claims the ring until detach, or until the claiming
+   process has exited. Header only; nothing to link. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLICKY_SHM_MAGIC 0x534C4B52u /* "SLKR" */
+#define SLICKY_SHM_VERSION 1
+#define SLICKY_SHM_SLOTS 1024        /* Power of two */
+
+typedef enum {
+    SLICKY_SHM_COLOR = 1,        /* a = 0xRRGGBB, as /setcolorint */
+    SLICKY_SHM_BLINK = 2,        /* a = period_ms, b = duty percent, c = count; a = 0 stops */
+    SLICKY_SHM_PATTERN = 3,      /* a = 0 off, 1 rainbow, 2 pulse, 3 strobe; f = rate (0 default) */
+    SLICKY_SHM_SCENE_RECALL = 4, /* a = scene, b = fade_ms */
+    SLICKY_SHM_SCENE_STORE = 5   /* a = scene */
+} slicky_shm_op_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t zone;  /* Index in the server's zone list (config order) */
+    uint16_t reserved;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+    float f;
+    uint32_t pad;
+} slicky_shm_cmd_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t cmd_size;
+    char bell_path[104];
+    int32_t producer_pid;                        /* 0 when no producer is attached */
+    uint32_t reserved;
+    uint64_t head __attribute__((aligned(64))); /* Written by the producer */
+    uint64_t full;                               /* Pushes refused because the ring was full */
+    uint64_t tail __attribute__((aligned(64))); /* Written by the server */
+    uint32_t sleeping;                           /* Server is (about to be) blocked in select() */
+    slicky_shm_cmd_t ring[SLICKY_SHM_SLOTS] __attribute__((aligned(64)));
+} slicky_shm_t;
+
+/* Maps the ring and opens its doorbell. Returns NULL with errno set: ENOENT if the server is
+   not running with that name, EPROTO on a layout mismatch, EBUSY if another producer is live. */
+static inline slicky_shm_t *slicky_shm_attach(const char *name, int *bell_fd) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *m = mmap(NULL, sizeof(slicky_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    slicky_shm_t *s = (slicky_shm_t *)m;
+    if (s->magic != SLICKY_SHM_MAGIC || s->version != SLICKY_SHM_VERSION || s->slots != SLICKY_SHM_SLOTS ||
+        s->cmd_size != sizeof(slicky_shm_cmd_t)) {
+        munmap(m, sizeof(slicky_shm_t));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    int32_t me = (int32_t)getpid();
+    int32_t owner = __atomic_load_n(&s->producer_pid, __ATOMIC_ACQUIRE);
+    if (owner != 0 && owner != me && kill(owner, 0) == 0) {
+        munmap(m, sizeof(slicky_shm_t));
+        errno = EBUSY;
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&s->producer_pid, &owner, me, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(m, sizeof(slicky_shm_t));
+        errno = EBUSY;
+        return NULL;
+    }
+
+    *bell_fd = open(s->bell_path, O_WRONLY | O_NONBLOCK);
+    if (*bell_fd < 0) {
+        int err = errno;
+        __atomic_store_n(&s->producer_pid, 0, __ATOMIC_RELEASE);
+        munmap(m, sizeof(slicky_shm_t));
+        errno = err;
+        return NULL;
+    }
+    return s;
+}
+
+static inline void slicky_shm_detach(slicky_shm_t *s, int bell_fd) {
+    if (s == NULL) {
+        return;
+    }
+    if (bell_fd >= 0) {
+        close(bell_fd);
+    }
+    __atomic_store_n(&s->producer_pid, 0, __ATOMIC_RELEASE);
+    munmap(s, sizeof(slicky_shm_t));
+}
+
+/* Returns false if the ring is full; the server then lags by a whole ring and the caller may
+   drop the update (colors are coalesced on the server anyway). */
+static inline bool slicky_shm_push(slicky_shm_t *s, int bell_fd, const slicky_shm_cmd_t *cmd) {
+    uint64_t head = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >= SLICKY_SHM_SLOTS) {
+        s->full++;
+        return false;
+    }
+    s->ring[head & (SLICKY_SHM_SLOTS - 1)] = *cmd;
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_SEQ_CST);
+    /* Pairs with the server setting `sleeping` and then re-reading head before it blocks. */
+    if (__atomic_load_n(&s->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&s->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        ssize_t n = write(bell_fd, "", 1);
+        (void)n;
+    }
+    return true;
+}
+
+static inline bool slicky_shm_color(slicky_shm_t *s, int bell_fd, int zone, uint32_t rgb) {
+    slicky_shm_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = SLICKY_SHM_COLOR;
+    cmd.zone = (uint8_t)zone;
+    cmd.a = (int32_t)(rgb & 0xFFFFFFu);
+    return slicky_shm_push(s, bell_fd, &cmd);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLICKY_SHM_H */
@@ -1,107 +1,404 @@
 #include "ssdp.h"
+#include "netif.h"
 #include "config.h"
 #include "cli.h"
-#include "log.h"
+#include "settings.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-static char *get_local_ip_address(void) {
-    static char ip_buffer[INET_ADDRSTRLEN];
+#define SSDP_SERVICE_TYPE "urn:schemas-upnp-org:service:OSC_CUE:1"
+#define SSDP_SERVER_STRING "OSC_Cue_Light/1.0 UPnP/1.0"
+#define SSDP_MAX_PENDING 8
+#define SSDP_MAX_MX 5
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        log_debug("get_local_ip_address: socket failed, fallback to 127.0.0.1");
-        strcpy(ip_buffer, "127.0.0.1");
-        return ip_buffer;
+typedef struct {
+    bool used;
+    uint64_t due_ms;
+    struct sockaddr_in dest;
+    char st[128];
+} ssdp_pending_t;
+
+static int s_fd = -1;
+static int s_port;
+static int s_ssdp_port;
+static char s_uuid[64];
+static struct in_addr s_joined[NETIF_MAX];
+static int s_joined_count;
+static uint64_t s_next_notify_ms;
+static ssdp_pending_t s_pending[SSDP_MAX_PENDING];
+
+static uint64_t now_ms(void) {
+    return timebase_now_ns() / 1000000u;
+}
+
+/* Stable per host+port so several lights on one network get distinct USNs across restarts. */
+static void make_uuid(int port) {
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+
+    uint64_t h1 = 0xcbf29ce484222325ull, h2 = 0x84222325cbf29ce4ull;
+    for (const char *p = host; *p; p++) {
+        h1 = (h1 ^ (unsigned char)*p) * 0x100000001b3ull;
+        h2 = (h2 ^ (unsigned char)*p) * 0x100000001b3ull;
     }
+    h1 = (h1 ^ (uint64_t)port) * 0x100000001b3ull;
+    h2 = (h2 ^ ((uint64_t)port << 7)) * 0x100000001b3ull;
 
-    struct sockaddr_in remote_addr;
-    memset(&remote_addr, 0, sizeof(remote_addr));
-    remote_addr.sin_family = AF_INET;
-    remote_addr.sin_port = htons(53);
-    remote_addr.sin_addr.s_addr = inet_addr("8.8.8.8");
+    snprintf(s_uuid, sizeof(s_uuid), "%08x-%04x-%04x-%04x-%012llx",
+             (unsigned)(h1 >> 32), (unsigned)(h1 >> 16) & 0xFFFF,
+             ((unsigned)h1 & 0x0FFF) | 0x5000, ((unsigned)(h2 >> 48) & 0x3FFF) | 0x8000,
+             (unsigned long long)(h2 & 0xFFFFFFFFFFFFull));
+}
 
-    if (connect(sock, (struct sockaddr *)&remote_addr, sizeof(remote_addr)) < 0) {
-        log_debug("connect failed, fallback to 127.0.0.1");
-        close(sock);
-        strcpy(ip_buffer, "127.0.0.1");
-        return ip_buffer;
+static int format_usn(char *out, size_t out_len, const char *nt) {
+    if (strncmp(nt, "uuid:", 5) == 0) {
+        return snprintf(out, out_len, "uuid:%s", s_uuid);
     }
+    return snprintf(out, out_len, "uuid:%s::%s", s_uuid, nt);
+}
 
-    struct sockaddr_in local_addr;
-    socklen_t addr_len = sizeof(local_addr);
-    if (getsockname(sock, (struct sockaddr *)&local_addr, &addr_len) < 0) {
-        log_debug("getsockname failed: %s", strerror(errno));
-        close(sock);
-        strcpy(ip_buffer, "127.0.0.1");
-        return ip_buffer;
+static void send_notify(const char *nt, const char *nts, const char *ip) {
+    char usn[256];
+    char buffer[1024];
+    int len;
+
+    format_usn(usn, sizeof(usn), nt);
+    if (strcmp(nts, "ssdp:byebye") == 0) {
+        len = snprintf(buffer, sizeof(buffer),
+            "NOTIFY * HTTP/1.1\r\n"
+            "HOST: %s:%d\r\n"
+            "NT: %s\r\n"
+            "NTS: ssdp:byebye\r\n"
+            "USN: %s\r\n"
+            "\r\n",
+            SSDP_MULTICAST_IP, s_ssdp_port, nt, usn);
+    } else {
+        len = snprintf(buffer, sizeof(buffer),
+            "NOTIFY * HTTP/1.1\r\n"
+            "HOST: %s:%d\r\n"
+            "CACHE-CONTROL: max-age=%d\r\n"
+            "LOCATION: http://%s:%d%s\r\n"
+            "NT: %s\r\n"
+            "NTS: ssdp:alive\r\n"
+            "SERVER: %s\r\n"
+            "USN: %s\r\n"
+            "\r\n",
+            SSDP_MULTICAST_IP, s_ssdp_port, settings()->ssdp_max_age, ip, s_port, SSDP_DESCRIPTION_PATH,
+            nt, SSDP_SERVER_STRING, usn);
+    }
+    if (len <= 0 || (size_t)len >= sizeof(buffer)) {
+        return;
     }
 
-    close(sock);
+    struct sockaddr_in ssdp_addr;
+    memset(&ssdp_addr, 0, sizeof(ssdp_addr));
+    ssdp_addr.sin_family = AF_INET;
+    ssdp_addr.sin_port = htons(s_ssdp_port);
+    ssdp_addr.sin_addr.s_addr = inet_addr(SSDP_MULTICAST_IP);
 
-    if (inet_ntop(AF_INET, &local_addr.sin_addr, ip_buffer, INET_ADDRSTRLEN) == NULL) {
-        strcpy(ip_buffer, "127.0.0.1");
+    for (int i = 0; i < SSDP_NOTIFY_REPEAT; i++) {
+        ssize_t sent = sendto(s_fd, buffer, (size_t)len, 0, (struct sockaddr *)&ssdp_addr, sizeof(ssdp_addr));
+        if (sent < 0) {
+            log_error("Failed to send SSDP %s: %s", nts, strerror(errno));
+            return;
+        }
     }
+    log_debug("SSDP %s sent for %s via %s", nts, nt, ip);
+}
 
-    return ip_buffer;
+static void send_notify_set(const char *nts, const char *ip) {
+    char uuid_nt[80];
+    snprintf(uuid_nt, sizeof(uuid_nt), "uuid:%s", s_uuid);
+    send_notify("upnp:rootdevice", nts, ip);
+    send_notify(uuid_nt, nts, ip);
+    send_notify(SSDP_SERVICE_TYPE, nts, ip);
 }
 
-void ssdp_send_announcement(int port) {
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        log_error("Failed to create SSDP socket");
+/* One set per interface, each sent out of that interface with its own address in LOCATION. */
+static void send_all_notify(const char *nts) {
+    if (netif_count() == 0) {
+        struct in_addr any = { .s_addr = htonl(INADDR_ANY) };
+        setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_IF, &any, sizeof(any));
+        send_notify_set(nts, "127.0.0.1");
         return;
     }
+    for (int i = 0; i < netif_count(); i++) {
+        const netif_t *nif = netif_get(i);
+        if (setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_IF, &nif->addr, sizeof(nif->addr)) < 0) {
+            log_debug("IP_MULTICAST_IF %s failed: %s", nif->name, strerror(errno));
+            continue;
+        }
+        send_notify_set(nts, nif->ip);
+    }
+}
 
-    int ttl = 4;
-    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
-        log_error("Failed to set multicast TTL");
-        close(sock);
+static void join_groups(void) {
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr.s_addr = inet_addr(SSDP_MULTICAST_IP);
+
+    for (int i = 0; i < s_joined_count; i++) {
+        mreq.imr_interface = s_joined[i];
+        setsockopt(s_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    s_joined_count = 0;
+
+    if (netif_count() == 0) {
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
+            s_joined[s_joined_count++] = mreq.imr_interface;
+        }
         return;
     }
+    for (int i = 0; i < netif_count(); i++) {
+        mreq.imr_interface = netif_get(i)->addr;
+        if (setsockopt(s_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            log_error("Failed to join SSDP multicast group on %s: %s", netif_get(i)->name, strerror(errno));
+            continue;
+        }
+        s_joined[s_joined_count++] = mreq.imr_interface;
+    }
+}
 
-    char *local_ip = get_local_ip_address();
+static void schedule_next_notify(void) {
+    /* Jitter the period so a rig of lights powered on together doesn't re-announce in lockstep. */
+    uint64_t jitter = (uint64_t)(rand() % (settings()->ssdp_interval * 100 + 1));
+    s_next_notify_ms = now_ms() + (uint64_t)settings()->ssdp_interval * 900u + jitter;
+}
 
-    char buffer[2048];
+static void send_search_reply(const ssdp_pending_t *p) {
+    char usn[256];
+    char buffer[1024];
+
+    const netif_t *nif = netif_for_peer(p->dest.sin_addr);
+    const char *ip = nif != NULL ? nif->ip : "127.0.0.1";
+
+    format_usn(usn, sizeof(usn), p->st);
     int len = snprintf(buffer, sizeof(buffer),
-        "NOTIFY * HTTP/1.1\r\n"
-        "HOST: %s:%d\r\n"
-        "CACHE-CONTROL: max-age=1800\r\n"
-        "LOCATION: http://%s:%d/osc-cue-description.xml\r\n"
-        "NT: urn:schemas-upnp-org:service:OSC_CUE:1\r\n"
-        "NTS: ssdp:alive\r\n"
-        "SERVER: OSC_Cue_Light/1.0 UPnP/1.0\r\n"
-        "USN: uuid:OSC_Cue_Light_1.0::urn:schemas-upnp-org:service:OSC_CUE:1\r\n"
+        "HTTP/1.1 200 OK\r\n"
+        "CACHE-CONTROL: max-age=%d\r\n"
+        "EXT:\r\n"
+        "LOCATION: http://%s:%d%s\r\n"
+        "SERVER: %s\r\n"
+        "ST: %s\r\n"
+        "USN: %s\r\n"
         "\r\n",
-        SSDP_MULTICAST_IP, SSDP_PORT, local_ip, port);
+        settings()->ssdp_max_age, ip, s_port, SSDP_DESCRIPTION_PATH, SSDP_SERVER_STRING, p->st, usn);
+    if (len <= 0 || (size_t)len >= sizeof(buffer)) {
+        return;
+    }
 
-    struct sockaddr_in ssdp_addr;
-    memset(&ssdp_addr, 0, sizeof(ssdp_addr));
-    ssdp_addr.sin_family = AF_INET;
-    ssdp_addr.sin_port = htons(SSDP_PORT);
-    ssdp_addr.sin_addr.s_addr = inet_addr(SSDP_MULTICAST_IP);
+    if (sendto(s_fd, buffer, (size_t)len, 0, (const struct sockaddr *)&p->dest, sizeof(p->dest)) < 0) {
+        log_debug("SSDP M-SEARCH reply to %s failed: %s", inet_ntoa(p->dest.sin_addr), strerror(errno));
+    } else {
+        log_debug("SSDP M-SEARCH reply sent to %s:%d (ST %s)",
+                  inet_ntoa(p->dest.sin_addr), ntohs(p->dest.sin_port), p->st);
+    }
+}
+
+static void queue_search_reply(const struct sockaddr_in *dest, const char *st, int mx) {
+    ssdp_pending_t *slot = NULL;
+    for (int i = 0; i < SSDP_MAX_PENDING; i++) {
+        if (!s_pending[i].used) {
+            slot = &s_pending[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        log_debug("SSDP reply queue full, dropping M-SEARCH from %s", inet_ntoa(dest->sin_addr));
+        return;
+    }
 
-    ssize_t sent = sendto(sock, buffer, len, 0, (struct sockaddr *)&ssdp_addr, sizeof(ssdp_addr));
+    slot->used = true;
+    slot->dest = *dest;
+    strncpy(slot->st, st, sizeof(slot->st) - 1);
+    slot->st[sizeof(slot->st) - 1] = '\0';
+    slot->due_ms = now_ms();
+    if (mx > 0) {
+        slot->due_ms += (uint64_t)(rand() % (mx * 1000));
+    }
+}
 
-    if (sent > 0) {
+/* Returns a pointer to the trimmed header value, or NULL if the header is absent. */
+static const char *find_header(char *msg, const char *name, char *out, size_t out_len) {
+    size_t name_len = strlen(name);
+    char *line = strstr(msg, "\r\n");
+    while (line != NULL) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t n = strcspn(v, "\r\n");
+            while (n > 0 && (v[n - 1] == ' ' || v[n - 1] == '\t')) n--;
+            if (n >= out_len) n = out_len - 1;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return out;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+static void handle_msearch(char *msg, const struct sockaddr_in *from) {
+    char man[64], st[128], mx_str[16];
+
+    if (find_header(msg, "MAN", man, sizeof(man)) == NULL || strcmp(man, "\"ssdp:discover\"") != 0) {
+        return;
+    }
+    if (find_header(msg, "ST", st, sizeof(st)) == NULL) {
+        return;
+    }
+
+    /* Multicast searches must carry MX; unicast searches (no MX) are answered immediately. */
+    int mx = 0;
+    if (find_header(msg, "MX", mx_str, sizeof(mx_str)) != NULL) {
+        mx = atoi(mx_str);
+        if (mx < 0) mx = 0;
+        if (mx > SSDP_MAX_MX) mx = SSDP_MAX_MX;
+    }
+
+    char uuid_st[80];
+    snprintf(uuid_st, sizeof(uuid_st), "uuid:%s", s_uuid);
+
+    if (strcmp(st, "ssdp:all") == 0) {
+        queue_search_reply(from, "upnp:rootdevice", mx);
+        queue_search_reply(from, uuid_st, mx);
+        queue_search_reply(from, SSDP_SERVICE_TYPE, mx);
+    } else if (strcmp(st, "upnp:rootdevice") == 0 || strcmp(st, uuid_st) == 0 ||
+               strcmp(st, SSDP_SERVICE_TYPE) == 0) {
+        queue_search_reply(from, st, mx);
+    }
+}
+
+int ssdp_init(int port) {
+    s_port = port;
+    s_ssdp_port = settings()->ssdp_port;
+    make_uuid(port);
+    srand((unsigned)(time(NULL) ^ getpid()));
+
+    s_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_fd < 0) {
+        log_error("Failed to create SSDP socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(s_fd, F_SETFL, O_NONBLOCK);
+
+    int on = 1;
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(s_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(s_ssdp_port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        log_error("Failed to bind SSDP socket to port %d: %s", s_ssdp_port, strerror(errno));
+        close(s_fd);
+        s_fd = -1;
+        return -1;
+    }
+
+    join_groups();
+
+    unsigned char ttl = 4;
+    if (setsockopt(s_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        log_error("Failed to set multicast TTL");
+    }
+
+    send_all_notify("ssdp:alive");
+    schedule_next_notify();
+
+    log_info("SSDP responder on port %d, USN uuid:%s, description at http://<ip>:%d%s",
+             s_ssdp_port, s_uuid, s_port, SSDP_DESCRIPTION_PATH);
+    return s_fd;
+}
+
+int ssdp_fd(void) { return s_fd; }
+const char *ssdp_uuid(void) { return s_uuid; }
+
+void ssdp_interfaces_changed(void) {
+    if (s_fd < 0) {
+        return;
+    }
+    join_groups();
+    send_all_notify("ssdp:alive");
+    schedule_next_notify();
+}
+
+void ssdp_handle_readable(void) {
+    char buffer[2048];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    while ((len = recvfrom(s_fd, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *)&from, &from_len)) > 0) {
+        buffer[len] = '\0';
+        if (strncmp(buffer, "M-SEARCH * HTTP/1.1\r\n", 21) == 0) {
+            handle_msearch(buffer, &from);
+        }
+        from_len = sizeof(from);
+    }
+}
+
+void ssdp_tick(void) {
+    if (s_fd < 0) {
+        return;
+    }
+
+    uint64_t now = now_ms();
+    for (int i = 0; i < SSDP_MAX_PENDING; i++) {
+        if (s_pending[i].used && s_pending[i].due_ms <= now) {
+            send_search_reply(&s_pending[i]);
+            s_pending[i].used = false;
+        }
+    }
+
+    if (now >= s_next_notify_ms) {
+        send_all_notify("ssdp:alive");
+        schedule_next_notify();
         if (cli_debug()) {
-            log_debug("SSDP service announcement sent for port %d (%zd bytes)", port, sent);
-            log_debug("Local IP: %s, Service: urn:schemas-upnp-org:service:OSC:1", local_ip);
+            log_debug("Sent periodic SSDP announcement for port %d", s_port);
         }
-    } else {
-        log_error("Failed to send SSDP announcement: %s", strerror(errno));
+    }
+}
+
+int ssdp_next_timeout_ms(void) {
+    if (s_fd < 0) {
+        return -1;
     }
 
-    close(sock);
+    uint64_t now = now_ms();
+    uint64_t next = s_next_notify_ms;
+    for (int i = 0; i < SSDP_MAX_PENDING; i++) {
+        if (s_pending[i].used && s_pending[i].due_ms < next) {
+            next = s_pending[i].due_ms;
+        }
+    }
+    return next <= now ? 0 : (int)(next - now);
 }
 
-void ssdp_announce_service(int port) {
-    ssdp_send_announcement(port);
-    if (cli_debug()) {
-        log_info("SSDP service announced: urn:schemas-upnp-org:service:OSC:1 on port %d", port);
+void ssdp_shutdown(void) {
+    if (s_fd < 0) {
+        return;
     }
+    send_all_notify("ssdp:byebye");
+    close(s_fd);
+    s_fd = -1;
 }
@@ -1,7 +1,13 @@
 #ifndef SSDP_H
 #define SSDP_H
 
-void ssdp_announce_service(int port);
-void ssdp_send_announcement(int port);
+int ssdp_init(int port);
+int ssdp_fd(void);
+const char *ssdp_uuid(void);
+void ssdp_handle_readable(void);
+void ssdp_interfaces_changed(void);
+void ssdp_tick(void);
+int ssdp_next_timeout_ms(void);
+void ssdp_shutdown(void);
 
 #endif /* SSDP_H */
@@ -1,18 +1,291 @@
 #include "state.h"
 #include "config.h"
 #include "led.h"
-#include "log.h"
+#include "persist.h"
+#include "pattern.h"
+#include "settings.h"
+#include "zone.h"
+#include "reliable.h"
+#include "scene.h"
+#include "alog.h"
+#include "timebase.h"
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 
-static int current_color = 0x000000;
-static int blinks_to_do = 0;
-static bool blink_on_change = true;
-static bool blinking = false;
-static bool last_state = true;
+#define STATE_SNAPSHOT_VERSION 4
 
-void state_process_osc_msg(tosc_message *osc, int len, bool debug) {
+/* Version 1 and 2 snapshots hold a single light's look, which is restored into the first zone. */
+typedef struct {
+    uint32_t version;
+    int32_t color;
+    uint8_t blinking;
+    uint8_t blink_on_change;
+    uint8_t pattern;
+    uint8_t reserved;
+    float pattern_rate;
+} state_snapshot_v2_t;
+
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    state_look_v1_t look;
+} zone_snapshot_v3_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t count;
+    zone_snapshot_v3_t zones[ZONE_MAX];
+} state_snapshot_v3_t;
+
+typedef struct {
+    char name[ZONE_NAME_MAX];
+    state_look_t look;
+} zone_snapshot_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t count;
+    zone_snapshot_t zones[ZONE_MAX];
+} state_snapshot_t;
+
+static persist_t s_store;
+static state_snapshot_t last_saved;
+
+static uint32_t blink_period_ms(const zone_t *z) {
+    return z->blink_period_ms != 0 ? z->blink_period_ms : (uint32_t)settings()->blink_interval_ms * 2u;
+}
+
+static float blink_duty(const zone_t *z) {
+    return (z->blink_duty != 0 ? z->blink_duty : 50) / 100.0f;
+}
+
+/* The look's endless blink, or none. */
+static void look_blink_restart(zone_t *z) {
+    if (z->blinking) {
+        blink_start(&z->blink, blink_period_ms(z), blink_duty(z), 0, timebase_now_ns());
+    } else {
+        blink_stop(&z->blink);
+    }
+}
+
+/* A new color ends any blink; with blink-on-change it is acknowledged by a few flashes. */
+static void color_blink(zone_t *z) {
+    z->blinking = false;
+    if (z->blink_on_change) {
+        blink_start(&z->blink, blink_period_ms(z), blink_duty(z), BLINK_ON_CHANGE_COUNT, timebase_now_ns());
+    } else {
+        blink_stop(&z->blink);
+    }
+}
+
+/* A new color replaces the rainbow and any scene fade; pulse and strobe carry on with it. */
+static void color_changed(zone_t *z) {
+    z->fade_ns = 0;
+    if (z->pattern.type == PATTERN_RAINBOW) {
+        pattern_start(&z->pattern, PATTERN_OFF, 0.0f, timebase_now_ns());
+    }
+}
+
+static void save_state(void) {
+    state_snapshot_t snap;
+    memset(&snap, 0, sizeof(snap));
+    snap.version = STATE_SNAPSHOT_VERSION;
+    snap.count = (uint32_t)zone_count();
+    for (int i = 0; i < zone_count(); i++) {
+        const zone_t *z = zone_get(i);
+        zone_snapshot_t *zs = &snap.zones[i];
+        memcpy(zs->name, z->name, sizeof(zs->name));
+        state_get_look(z, &zs->look);
+    }
+    size_t len = offsetof(state_snapshot_t, zones) + snap.count * sizeof(zone_snapshot_t);
+    if (memcmp(&snap, &last_saved, len) != 0) {
+        persist_store(&s_store, &snap, len);
+        last_saved = snap;
+    }
+}
+
+/* For continuous sources such as DMX: no blink-on-change, and not written to the state file
+   on every frame. */
+void state_set_live_color(zone_t *z, int color) {
+    z->color = color;
+    z->blinking = false;
+    blink_stop(&z->blink);
+    color_changed(z);
+}
+
+void state_get_look(const zone_t *z, state_look_t *look) {
+    memset(look, 0, sizeof(*look));
+    look->color = z->color;
+    look->blinking = z->blinking ? 1 : 0;
+    look->blink_on_change = z->blink_on_change ? 1 : 0;
+    look->pattern = (uint8_t)z->pattern.type;
+    look->pattern_rate = z->pattern.rate;
+    look->blink_period_ms = z->blink_period_ms;
+    look->blink_duty = z->blink_duty;
+}
+
+void state_look_upgrade(const state_look_v1_t *old, state_look_t *look) {
+    memset(look, 0, sizeof(*look));
+    look->color = old->color;
+    look->blinking = old->blinking;
+    look->blink_on_change = old->blink_on_change;
+    look->pattern = old->pattern;
+    look->pattern_rate = old->pattern_rate;
+}
+
+/* Takes effect on the next render; with fade_ms the output crossfades from what is showing now. */
+void state_set_look(zone_t *z, const state_look_t *look, uint32_t fade_ms) {
+    uint64_t now = timebase_now_ns();
+
+    z->fade_from = z->output_valid ? z->output_color : (color_rgb_t)z->color;
+    z->color = look->color;
+    z->blinking = look->blinking != 0;
+    z->blink_on_change = look->blink_on_change != 0;
+    z->blink_period_ms = look->blink_period_ms;
+    z->blink_duty = look->blink_duty <= 100 ? look->blink_duty : 0;
+    look_blink_restart(z);
+    if (look->pattern <= PATTERN_STROBE && (look->pattern != z->pattern.type || look->pattern_rate != z->pattern.rate)) {
+        pattern_start(&z->pattern, (pattern_type_t)look->pattern, look->pattern_rate, now);
+    }
+    z->fade_start_ns = now;
+    z->fade_ns = (uint64_t)fade_ms * 1000000u;
+    memset(z->dither_err, 0, sizeof(z->dither_err));
+    z->next_frame_ns = 0;
+    z->output_valid = false;
+}
+
+static void restore_zone(zone_t *z, const zone_snapshot_t *zs) {
+    state_set_look(z, &zs->look, 0);
+    log_info("Restored zone %s: color 0x%06x, blinking %d, blink_on_change %d, pattern %s", z->name,
+             z->color & 0xFFFFFF, z->blinking ? 1 : 0, z->blink_on_change ? 1 : 0, pattern_name(z->pattern.type));
+}
+
+/* Zones are matched by name, so adding or reordering zones keeps everyone else's look. */
+static bool state_restore(void) {
+    union {
+        state_snapshot_v2_t v2;
+        state_snapshot_v3_t v3;
+        state_snapshot_t v4;
+    } snap;
+    size_t len = 0;
+    int restored = 0;
+
+    memset(&snap, 0, sizeof(snap));
+    if (!persist_load(&s_store, &snap, &len, sizeof(snap)) || len < sizeof(uint32_t)) {
+        return false;
+    }
+    if (snap.v2.version == 1 || snap.v2.version == 2) {
+        /* Version 1 snapshots end before the pattern fields, which then stay zero (off). */
+        if (len < offsetof(state_snapshot_v2_t, pattern)) {
+            return false;
+        }
+        zone_snapshot_t zs;
+        memset(&zs, 0, sizeof(zs));
+        zs.look.color = snap.v2.color;
+        zs.look.blinking = snap.v2.blinking;
+        zs.look.blink_on_change = snap.v2.blink_on_change;
+        zs.look.pattern = snap.v2.pattern;
+        zs.look.pattern_rate = snap.v2.pattern_rate;
+        restore_zone(zone_get(0), &zs);
+        restored = 1;
+    } else if (snap.v3.version == 3) {
+        uint32_t count = snap.v3.count;
+        if (count > ZONE_MAX || len < offsetof(state_snapshot_v3_t, zones) + count * sizeof(zone_snapshot_v3_t)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            zone_snapshot_t zs;
+            memcpy(zs.name, snap.v3.zones[i].name, sizeof(zs.name));
+            zs.name[ZONE_NAME_MAX - 1] = '\0';
+            state_look_upgrade(&snap.v3.zones[i].look, &zs.look);
+            zone_t *z = zone_find(zs.name);
+            if (z != NULL) {
+                restore_zone(z, &zs);
+                restored++;
+            }
+        }
+    } else if (snap.v4.version == STATE_SNAPSHOT_VERSION) {
+        uint32_t count = snap.v4.count;
+        if (count > ZONE_MAX || len < offsetof(state_snapshot_t, zones) + count * sizeof(zone_snapshot_t)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            zone_snapshot_t *zs = &snap.v4.zones[i];
+            zs->name[ZONE_NAME_MAX - 1] = '\0';
+            zone_t *z = zone_find(zs->name);
+            if (z != NULL) {
+                restore_zone(z, zs);
+                restored++;
+            }
+        }
+    } else {
+        return false;
+    }
+
+    save_state();
+    state_render();
+    return restored > 0;
+}
+
+bool state_open(const char *path) {
+    return persist_open(&s_store, path, PERSIST_MAX_PAYLOAD) && state_restore();
+}
+
+void state_close(void) {
+    persist_close(&s_store);
+}
+
+/* "/blink n" switches the look's blink on or off. "/blink period_ms duty [count]" sets its
+   period and lit fraction (float 0-1, or int percent); a count gives that many flashes and
+   then a steady light, without becoming part of the look. */
+static void process_blink(zone_t *z, tosc_message *osc) {
+    const char *fmt = tosc_getFormat(osc);
+    int period_ms = fmt[0] == 'i' ? tosc_getNextInt32(osc) : 0;
+
+    if (fmt[0] != 'i' || (fmt[1] != 'i' && fmt[1] != 'f')) {
+        if (period_ms > 0) {
+            log_info("set blink on");
+            z->blinking = true;
+        } else {
+            log_info("set blink off");
+            z->blinking = false;
+        }
+        z->blink_period_ms = 0;
+        z->blink_duty = 0;
+    } else {
+        float duty = fmt[1] == 'f' ? tosc_getNextFloat(osc) : tosc_getNextInt32(osc) / 100.0f;
+        int count = fmt[2] == 'i' ? tosc_getNextInt32(osc) : 0;
+        if (period_ms <= 0 || !(duty > 0.0f) || count < 0) {
+            log_info("set blink off");
+            z->blinking = false;
+            blink_stop(&z->blink);
+            return;
+        }
+        if (duty > 1.0f) {
+            duty = 1.0f;
+        }
+        log_info("set blink %d ms, %.0f%% lit, %s", period_ms, duty * 100.0f, count > 0 ? "counted" : "endless");
+        if (count > 0) {
+            z->blinking = false;
+            blink_start(&z->blink, (uint32_t)period_ms, duty, (uint32_t)count, timebase_now_ns());
+            if (z->color == 0) {
+                z->color = 0xFF0000;
+            }
+            return;
+        }
+        z->blinking = true;
+        z->blink_period_ms = (uint32_t)period_ms;
+        z->blink_duty = (uint8_t)(duty * 100.0f + 0.5f) > 0 ? (uint8_t)(duty * 100.0f + 0.5f) : 1;
+    }
+    if (z->blinking && z->color == 0) {
+        z->color = 0xFF0000;
+    }
+    look_blink_restart(z);
+}
+
+void state_process_osc_msg(zone_t *z, tosc_message *osc, int len, bool debug) {
     char cmd[MAX_STR];
 
     if (debug) {
@@ -20,18 +293,16 @@ void state_process_osc_msg(tosc_message *osc, int len, bool debug) {
                   len, tosc_getAddress(osc), tosc_getFormat(osc));
     }
 
-    strncpy(cmd, tosc_getAddress(osc), MAX_STR - 1);
+    /* Commands are matched with the zone prefix stripped, so /stage/blink is /blink for zone "stage". */
+    strncpy(cmd, tosc_getAddress(osc) + z->prefix_len, MAX_STR - 1);
     cmd[MAX_STR - 1] = '\0';
-    log_info("cmd: %s", cmd);
+    log_info("cmd: %s%s%s", cmd, z->prefix_len > 0 ? " zone " : "", z->prefix_len > 0 ? z->name : "");
 
     if (strncmp(cmd, "/setcolorint", MAX_STR) == 0) {
         int newcolor = tosc_getNextInt32(osc);
-        current_color = newcolor;
-        blinking = false;
-        led_set_rgb((color_rgb_t)newcolor);
-        if (blink_on_change) {
-            blinks_to_do = 6;
-        }
+        z->color = newcolor;
+        color_changed(z);
+        color_blink(z);
     }
 
     if (strncmp(cmd, "/setcolorhex", MAX_STR) == 0) {
@@ -42,94 +313,373 @@ void state_process_osc_msg(tosc_message *osc, int len, bool debug) {
             unsigned long u = strtoul(hexstr, &end, 16);
             if (errno == 0 && (*end == '\0' || *end == ' ') && u <= 0xFFFFFFu) {
                 int newcolor = (int)u;
-                current_color = newcolor;
-                blinking = false;
-                led_set_rgb((color_rgb_t)newcolor);
+                z->color = newcolor;
+                color_changed(z);
+                color_blink(z);
             }
         }
-        if (blink_on_change) {
-            blinks_to_do = 6;
-        }
+        /* A malformed string leaves the color, and any running /blink, alone. */
     }
 
     if (strncmp(cmd, "/blink", MAX_STR) == 0) {
-        int blinkparam = tosc_getNextInt32(osc);
-        if (blinkparam > 0) {
-            log_info("set blink on");
-            blinking = true;
-            if (current_color == 0) {
-                current_color = 0xFF0000;
-            }
+        process_blink(z, osc);
+    }
+
+    if (strncmp(cmd, "/pattern", MAX_STR) == 0) {
+        const char *fmt = tosc_getFormat(osc);
+        const char *name = fmt[0] == 's' ? tosc_getNextString(osc) : NULL;
+        pattern_type_t type;
+        if (name == NULL || !pattern_parse(name, &type)) {
+            log_warn("unknown pattern %s", name != NULL ? name : "(none)");
         } else {
-            log_info("set blink off");
-            blinking = false;
-            led_set_rgb((color_rgb_t)current_color);
+            float rate = 0.0f;
+            if (fmt[1] == 'f') {
+                rate = tosc_getNextFloat(osc);
+            } else if (fmt[1] == 'i') {
+                rate = (float)tosc_getNextInt32(osc);
+            }
+            pattern_start(&z->pattern, type, rate, timebase_now_ns());
+            z->next_frame_ns = 0;
+            log_info("set pattern %s (rate %.2f)", pattern_name(type), z->pattern.rate);
         }
     }
 
+    /* Without a zone prefix a scene covers every zone. */
+    if (strncmp(cmd, "/scene/store", MAX_STR) == 0 && tosc_getFormat(osc)[0] == 'i') {
+        scene_store(z->prefix_len > 0 ? z : NULL, tosc_getNextInt32(osc));
+    }
+
+    if (strncmp(cmd, "/scene/recall", MAX_STR) == 0 && tosc_getFormat(osc)[0] == 'i') {
+        const char *fmt = tosc_getFormat(osc);
+        int n = tosc_getNextInt32(osc);
+        int fade_ms = 0;
+        if (fmt[1] == 'i') {
+            fade_ms = tosc_getNextInt32(osc);
+        } else if (fmt[1] == 'f') {
+            fade_ms = (int)tosc_getNextFloat(osc);
+        }
+        scene_recall(z->prefix_len > 0 ? z : NULL, n, fade_ms > 0 ? (uint32_t)fade_ms : 0);
+    }
+
     if (strncmp(cmd, "/blink_on_change", MAX_STR) == 0) {
         int blinkparam = tosc_getNextInt32(osc);
         if (blinkparam > 0) {
             log_info("set blink_on_change on");
-            blink_on_change = true;
+            z->blink_on_change = true;
         } else {
             log_info("set blink_on_change off");
-            blink_on_change = false;
+            z->blink_on_change = false;
         }
     }
+
+    save_state();
 }
 
-void state_handle_blink(void) {
-    if (blinking || blinks_to_do > 0) {
-        if (last_state) {
-            led_set_rgb((color_rgb_t)current_color);
-        } else {
-            led_set_rgb((color_rgb_t)0x000000);
+/* Copies a message under a new address; returns the new length, or 0 if it does not fit. */
+int state_rewrite_address(const tosc_message *osc, const char *address, char *out, int cap) {
+    size_t addr_len = (strlen(address) + 4) & ~(size_t)3;
+    const char *tail = osc->format - 1; /* The ',' that starts the type tags */
+    size_t tail_len = osc->len - (size_t)(tail - osc->buffer);
+
+    if (addr_len + tail_len > (size_t)cap) {
+        return 0;
+    }
+    memset(out, 0, addr_len);
+    memcpy(out, address, strlen(address));
+    memcpy(out + addr_len, tail, tail_len);
+    return (int)(addr_len + tail_len);
+}
+
+/* A /group/<name>/ message is passed on as the rest of its address, or dropped if this server is
+   not in the group, so zone prefixes and every handler see it like a direct message. */
+static void deliver(tosc_message *osc, int len, state_msg_fn fn, void *ctx) {
+    const char *addr = tosc_getAddress(osc);
+    const char *rest = zone_strip_group(addr);
+    char buf[2048];
+
+    if (strcmp(addr, RELIABLE_ADDRESS) == 0) {
+        return; /* Delivery metadata, already handled by reliable_check */
+    }
+    if (rest == addr) {
+        fn(osc, len, ctx);
+        return;
+    }
+    if (rest == NULL) {
+        log_debug("group: not a member for %s", addr);
+        return;
+    }
+    int n = state_rewrite_address(osc, rest, buf, sizeof(buf));
+    tosc_message stripped;
+    if (n > 0 && tosc_parseMessage(&stripped, buf, n) == 0) {
+        fn(&stripped, len, ctx);
+    }
+}
+
+bool state_parse_packet(char *buffer, int len, state_msg_fn fn, void *ctx) {
+    if (tosc_isBundle(buffer)) {
+        tosc_bundle bundle;
+        tosc_parseBundle(&bundle, buffer, len);
+        tosc_message osc;
+        while (tosc_getNextMessage(&bundle, &osc)) {
+            deliver(&osc, len, fn, ctx);
         }
-        last_state = !last_state;
-        if (blinks_to_do > 0) {
-            blinks_to_do--;
+        return true;
+    }
+
+    /* Require NUL and comma within bounds so tinyosc doesn't over-read */
+    size_t i;
+    for (i = 0; i < (size_t)len && buffer[i] != '\0'; i++) { }
+    if (i >= (size_t)len) return false;
+    for ( ; i < (size_t)len && buffer[i] != ','; i++) { }
+    if (i >= (size_t)len) return false;
+
+    tosc_message osc;
+    if (tosc_parseMessage(&osc, buffer, len) != 0) return false;
+    deliver(&osc, len, fn, ctx);
+    return true;
+}
+
+typedef struct {
+    int port;
+    bool debug;
+} process_ctx_t;
+
+static void process_msg(tosc_message *osc, int len, void *ctx) {
+    process_ctx_t *pc = ctx;
+    zone_t *z = zone_route(pc->port, tosc_getAddress(osc));
+    if (z != NULL) {
+        state_process_osc_msg(z, osc, len, pc->debug);
+    }
+}
+
+bool state_process_packet(char *buffer, int len, int port, bool debug) {
+    process_ctx_t pc = { port, debug };
+    return state_parse_packet(buffer, len, process_msg, &pc);
+}
+
+/* The slowest light in the zone sets the pace; 0 when none has been measured yet. */
+static unsigned device_fps(const zone_t *z) {
+    unsigned fps = 0;
+    for (int i = 0; i < z->led_count; i++) {
+        unsigned f = led_max_fps(z->leds[i]);
+        if (f != 0 && (fps == 0 || f < fps)) fps = f;
+    }
+    return fps;
+}
+
+static uint64_t min_write_interval_ns(const zone_t *z) {
+    unsigned fps = device_fps(z);
+    return fps != 0 ? 1000000000u / fps : 0;
+}
+
+/* Frames that arrive faster than the lights accept writes are coalesced: only the newest one is
+   written, as soon as the device is ready for it. */
+static void output(zone_t *z, color_rgb_t color, uint64_t now) {
+    if (z->output_valid && color == z->output_color && now - z->output_ns < (uint64_t)LED_REASSERT_MS * 1000000u) {
+        z->output_pending = false;
+        return;
+    }
+    if (z->output_valid && now - z->output_ns < min_write_interval_ns(z)) {
+        z->output_pending = true;
+        return;
+    }
+    z->output_pending = false;
+    for (int i = 0; i < z->led_count; i++) {
+        led_write(z->leds[i], color);
+    }
+    z->output_color = color;
+    z->output_ns = now;
+    z->output_valid = true;
+}
+
+static color_rgb_t mix(color_rgb_t from, color_rgb_t to, uint64_t pos, uint64_t span) {
+    color_rgb_t out = 0;
+    for (int shift = 0; shift <= 16; shift += 8) {
+        int64_t a = (int64_t)((from >> shift) & 0xFF);
+        int64_t b = (int64_t)((to >> shift) & 0xFF);
+        out |= (color_rgb_t)(a + (b - a) * (int64_t)pos / (int64_t)span) << shift;
+    }
+    return out;
+}
+
+/* Slow fades move less than one 8-bit step per frame, so near black they visibly stair-step.
+   They are computed at 16 bits instead, and each frame's rounding error is carried into the
+   next one; at the higher dither refresh rate the eye averages the levels in between. */
+static bool dithering(const zone_t *z) {
+    return z->fade_ns >= (uint64_t)DITHER_MIN_FADE_MS * 1000000u && settings()->dither_fps > 0;
+}
+
+static color_rgb_t dither(zone_t *z, color_rgb_t to, uint64_t pos) {
+    color_rgb_t out = 0;
+
+    for (int i = 0; i < 3; i++) {
+        int shift = 16 - i * 8;
+        int64_t a = (int64_t)((z->fade_from >> shift) & 0xFF) * 257;
+        int64_t b = (int64_t)((to >> shift) & 0xFF) * 257;
+        int32_t level = (int32_t)(a + (b - a) * (int64_t)pos / (int64_t)z->fade_ns) + z->dither_err[i];
+        int32_t out8 = (level + 128) / 257;
+        if (out8 < 0) out8 = 0;
+        if (out8 > 255) out8 = 255;
+        z->dither_err[i] = level - out8 * 257;
+        out |= (color_rgb_t)out8 << shift;
+    }
+    return out;
+}
+
+static unsigned frame_rate(const zone_t *z) {
+    unsigned fps = dithering(z) ? (unsigned)settings()->dither_fps : (unsigned)settings()->render_fps;
+    unsigned max = device_fps(z);
+    return max != 0 && max < fps ? max : fps;
+}
+
+static bool animating(const zone_t *z) {
+    return z->pattern.type != PATTERN_OFF || z->fade_ns != 0;
+}
+
+static void render_zone(zone_t *z, uint64_t now) {
+    color_rgb_t frame;
+
+    if (animating(z)) {
+        if (z->output_valid && now < z->next_frame_ns) {
+            frame = z->output_color;
+        } else {
+            frame = z->pattern.type != PATTERN_OFF ? pattern_frame(&z->pattern, (color_rgb_t)z->color, now)
+                                                   : (color_rgb_t)z->color;
+            if (z->fade_ns != 0) {
+                if (now - z->fade_start_ns >= z->fade_ns) {
+                    z->fade_ns = 0;
+                } else if (dithering(z)) {
+                    frame = dither(z, frame, now - z->fade_start_ns);
+                } else {
+                    frame = mix(z->fade_from, frame, now - z->fade_start_ns, z->fade_ns);
+                }
+            }
+            z->next_frame_ns = now + 1000000000u / frame_rate(z);
         }
     } else {
-        led_set_rgb((color_rgb_t)current_color);
+        frame = (color_rgb_t)z->color;
+    }
+
+    if (!blink_lit(&z->blink, now)) {
+        frame = 0x000000;
     }
+    output(z, frame, now);
 }
 
-void state_send_osc_status(int fd, const struct sockaddr *peer, socklen_t peer_len, bool debug) {
-    char outbuf[128];
-    uint32_t n;
-    ssize_t sent;
+void state_render(void) {
+    uint64_t now = timebase_now_ns();
+    for (int i = 0; i < zone_count(); i++) {
+        render_zone(zone_get(i), now);
+    }
+}
 
-    n = tosc_writeMessage(outbuf, sizeof(outbuf), "/status/color", "i", current_color);
-    if (n > 0) {
-        if (debug) {
-            log_debug("status: /status/color %d (0x%06x)", current_color, current_color & 0xFFFFFF);
-        }
-        sent = sendto(fd, outbuf, (size_t)n, 0, peer, peer_len);
-        if (sent != (ssize_t)n && debug) {
-            log_debug("send_osc_status: sendto %zd of %u", (long)sent, (unsigned)n);
-        }
+/* Forces the next render to write the devices, e.g. after a session or the LUT changed. */
+void state_refresh_output(void) {
+    for (int i = 0; i < zone_count(); i++) {
+        zone_get(i)->output_valid = false;
     }
+}
+
+static int ms_until(uint64_t deadline, uint64_t now) {
+    return deadline <= now ? 0 : (int)((deadline - now + 999999u) / 1000000u);
+}
+
+static void earliest(uint64_t *next, uint64_t deadline, uint64_t now) {
+    if (deadline < now) deadline = now;
+    if (deadline < *next) *next = deadline;
+}
 
-    n = tosc_writeMessage(outbuf, sizeof(outbuf), "/status/blinking", "i", blinking ? 1 : 0);
-    if (n > 0) {
-        if (debug) {
-            log_debug("status: /status/blinking %d", blinking ? 1 : 0);
+/* The earliest render deadline over all zones, or UINT64_MAX if nothing is scheduled. */
+uint64_t state_next_render_ns(void) {
+    uint64_t now = timebase_now_ns();
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < zone_count(); i++) {
+        const zone_t *z = zone_get(i);
+        earliest(&next, z->output_ns + (uint64_t)LED_REASSERT_MS * 1000000u, now);
+        if (animating(z)) {
+            earliest(&next, z->next_frame_ns, now);
+        }
+        if (z->output_pending) {
+            earliest(&next, z->output_ns + min_write_interval_ns(z), now);
         }
-        sent = sendto(fd, outbuf, (size_t)n, 0, peer, peer_len);
-        if (sent != (ssize_t)n && debug) {
-            log_debug("send_osc_status: sendto %zd of %u", (long)sent, (unsigned)n);
+        uint64_t edge = blink_next_edge_ns(&z->blink, now);
+        if (edge != 0) {
+            earliest(&next, edge, now);
         }
     }
+    return next;
+}
 
-    n = tosc_writeMessage(outbuf, sizeof(outbuf), "/status/blink_on_change", "i", blink_on_change ? 1 : 0);
-    if (n > 0) {
-        if (debug) {
-            log_debug("status: /status/blink_on_change %d", blink_on_change ? 1 : 0);
-        }
-        sent = sendto(fd, outbuf, (size_t)n, 0, peer, peer_len);
-        if (sent != (ssize_t)n && debug) {
-            log_debug("send_osc_status: sendto %zd of %u", (long)sent, (unsigned)n);
+int state_next_render_ms(void) {
+    uint64_t next = state_next_render_ns();
+    return next == UINT64_MAX ? -1 : ms_until(next, timebase_now_ns());
+}
+
+static void send_status(int fd, const struct sockaddr *peer, socklen_t peer_len, bool debug, const char *outbuf,
+                        uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    ssize_t sent = sendto(fd, outbuf, (size_t)n, 0, peer, peer_len);
+    if (sent != (ssize_t)n && debug) {
+        log_debug("send_osc_status: sendto %zd of %u", (long)sent, (unsigned)n);
+    }
+}
+
+/* Status addresses carry the zone prefix, e.g. /stage/status/color. */
+void state_send_osc_status(const zone_t *z, int fd, const struct sockaddr *peer, socklen_t peer_len, bool debug) {
+    char outbuf[128];
+    char addr[64];
+    uint32_t n;
+
+    snprintf(addr, sizeof(addr), "%s/status/color", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "i", z->color);
+    if (debug) {
+        log_debug("status: %s %d (0x%06x)", addr, z->color, z->color & 0xFFFFFF);
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
+
+    snprintf(addr, sizeof(addr), "%s/status/blinking", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "i", z->blinking ? 1 : 0);
+    if (debug) {
+        log_debug("status: %s %d", addr, z->blinking ? 1 : 0);
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
+
+    snprintf(addr, sizeof(addr), "%s/status/blink", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "ii", (int32_t)blink_period_ms(z),
+                          (int32_t)(blink_duty(z) * 100.0f + 0.5f));
+    if (debug) {
+        log_debug("status: %s %u %.0f%%", addr, blink_period_ms(z), blink_duty(z) * 100.0f);
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
+
+    snprintf(addr, sizeof(addr), "%s/status/pattern", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "s", pattern_name(z->pattern.type));
+    if (debug) {
+        log_debug("status: %s %s", addr, pattern_name(z->pattern.type));
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
+
+    snprintf(addr, sizeof(addr), "%s/status/blink_on_change", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "i", z->blink_on_change ? 1 : 0);
+    if (debug) {
+        log_debug("status: %s %d", addr, z->blink_on_change ? 1 : 0);
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
+
+    /* The zone is only as healthy as its worst light. */
+    led_health_t health = z->led_count > 0 ? LED_HEALTHY : LED_OFFLINE;
+    for (int i = 0; i < z->led_count; i++) {
+        if (led_health(z->leds[i]) > health) {
+            health = led_health(z->leds[i]);
         }
     }
+    snprintf(addr, sizeof(addr), "%s/status/health", z->prefix);
+    n = tosc_writeMessage(outbuf, sizeof(outbuf), addr, "s", led_health_name(health));
+    if (debug) {
+        log_debug("status: %s %s", addr, led_health_name(health));
+    }
+    send_status(fd, peer, peer_len, debug, outbuf, n);
 }
@@ -3,12 +3,50 @@
 
 #include "tinyosc.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/socket.h>
 
 struct sockaddr;
+struct zone;
 
-void state_process_osc_msg(tosc_message *osc, int len, bool debug);
-void state_handle_blink(void);
-void state_send_osc_status(int fd, const struct sockaddr *peer, socklen_t peer_len, bool debug);
+/* Everything that makes up a zone's look; stored in the state file and in scenes. */
+typedef struct {
+    int32_t color;
+    uint8_t blinking;
+    uint8_t blink_on_change;
+    uint8_t pattern;
+    uint8_t blink_duty;        /* Percent lit; 0 means 50 */
+    float pattern_rate;
+    uint32_t blink_period_ms;  /* 0 means twice blink_interval_ms */
+} state_look_t;
+
+/* The look as stored before blinks had a period and duty (state file v3, scene file v1). */
+typedef struct {
+    int32_t color;
+    uint8_t blinking;
+    uint8_t blink_on_change;
+    uint8_t pattern;
+    uint8_t reserved;
+    float pattern_rate;
+} state_look_v1_t;
+
+/* Called for each message in a packet; len is the length of the whole packet. */
+typedef void (*state_msg_fn)(tosc_message *osc, int len, void *ctx);
+
+void state_process_osc_msg(struct zone *z, tosc_message *osc, int len, bool debug);
+bool state_open(const char *path);
+void state_close(void);
+void state_get_look(const struct zone *z, state_look_t *look);
+void state_set_look(struct zone *z, const state_look_t *look, uint32_t fade_ms);
+void state_look_upgrade(const state_look_v1_t *old, state_look_t *look);
+void state_set_live_color(struct zone *z, int color);
+bool state_parse_packet(char *buffer, int len, state_msg_fn fn, void *ctx);
+int state_rewrite_address(const tosc_message *osc, const char *address, char *out, int cap);
+bool state_process_packet(char *buffer, int len, int port, bool debug);
+void state_render(void);
+uint64_t state_next_render_ns(void);
+int state_next_render_ms(void);
+void state_refresh_output(void);
+void state_send_osc_status(const struct zone *z, int fd, const struct sockaddr *peer, socklen_t peer_len, bool debug);
 
 #endif /* STATE_H */
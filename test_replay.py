@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Replay Timing Test
+Writes fixed captures, replays them with oscreplay --fast on the virtual clock and
+compares every light update against the expected frame trace
+"""
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import argparse
+
+CAPTURE_MAGIC = b'SLKCAP01'
+CAPTURE_VERSION = 1
+HEADER_SIZE = 32
+RECORD_SIZE = 24
+LOOPBACK = 0x0100007f  # 127.0.0.1 as stored (network order read little-endian)
+
+def osc_string(text):
+    data = text.encode() + b'\0'
+    return data + b'\0' * (-len(data) % 4)
+
+def osc_message(address, fmt='', *args):
+    """Encode one OSC message; fmt uses 'i', 'f' and 's' like tinyosc"""
+    out = osc_string(address) + osc_string(',' + fmt)
+    for tag, arg in zip(fmt, args):
+        if tag == 'i':
+            out += struct.pack('>i', arg)
+        elif tag == 'f':
+            out += struct.pack('>f', arg)
+        else:
+            out += osc_string(arg)
+    return out
+
+def osc_bundle(*messages):
+    out = b'#bundle\0' + struct.pack('>q', 1)
+    for message in messages:
+        out += struct.pack('>i', len(message)) + message
+    return out
+
+def write_capture(path, packets):
+    """packets: (t_ms, port, data); port 0 replays to the main port"""
+    body = b''
+    for t_ms, port, data in packets:
+        rec_len = (RECORD_SIZE + len(data) + 7) & ~7
+        body += struct.pack('<IIQIHH', rec_len, len(data), t_ms * 1000000, LOOPBACK, 0, port)
+        body += data + b'\0' * (rec_len - RECORD_SIZE - len(data))
+    header = CAPTURE_MAGIC + struct.pack('<IIQQ', CAPTURE_VERSION, HEADER_SIZE, HEADER_SIZE + len(body), len(packets))
+    with open(path, 'wb') as f:
+        f.write(header + body)
+
+GREEN_BLINK = ["{} (any) {}".format(t * 500000, "00ff00" if t % 2 == 0 else "000000") for t in range(11)]
+GREEN_BLINK.insert(0, "0 (any) 000000")
+
+# Each case: name, packets, tail (ms), expected "<us> <light> <rrggbb>" frames
+CASES = [
+    ("counted blink",
+     [(0, 0, osc_message('/blink', 'iii', 1000, 50, 3))],
+     4000,
+     ["0 (any) 000000",
+      "0 (any) ff0000",
+      "500000 (any) 000000",
+      "1000000 (any) ff0000",
+      "1500000 (any) 000000",
+      "2000000 (any) ff0000",
+      "2500000 (any) 000000",
+      "3000000 (any) ff0000",
+      "4000000 (any) ff0000"]),
+    ("color changes, then endless blink on the shared phase",
+     [(0, 0, osc_message('/setcolorint', 'i', 0x123456)),
+      (250, 0, osc_message('/setcolorhex', 's', '00ff00')),
+      (600, 0, osc_message('/blink', 'ii', 400, 25))],
+     1500,
+     ["0 (any) 000000",
+      "0 (any) 123456",
+      "250000 (any) 00ff00",
+      "500000 (any) 000000",
+      "800000 (any) 00ff00",
+      "900000 (any) 000000",
+      "1200000 (any) 00ff00",
+      "1300000 (any) 000000",
+      "1600000 (any) 00ff00",
+      "1700000 (any) 000000",
+      "2000000 (any) 00ff00",
+      "2100000 (any) 000000"]),
+    # A queued color must apply before a later cue to the same zone, or it stops the blink.
+    ("color then blink in one bundle keeps blinking that color",
+     [(0, 0, osc_bundle(osc_message('/setcolorint', 'i', 0x00ff00), osc_message('/blink', 'i', 1)))],
+     5000,
+     GREEN_BLINK),
+    ("color then blink in two packets keeps blinking that color",
+     [(0, 0, osc_message('/setcolorint', 'i', 0x00ff00)),
+      (0, 0, osc_message('/blink', 'i', 1))],
+     5000,
+     GREEN_BLINK),
+]
+
+def run_case(replay, name, packets, tail_ms, expected):
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'case.cap')
+        write_capture(path, packets)
+        result = subprocess.run([replay, '--fast', '--tail', str(tail_ms), '--frames', '-', path],
+                                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True)
+    frames = [line for line in result.stdout.splitlines() if not line.startswith('replayed')]
+    if result.returncode == 0 and frames == expected:
+        print("ok   {}".format(name))
+        return True
+    print("FAIL {} (exit {})".format(name, result.returncode))
+    print("  expected: {}".format(expected))
+    print("  got:      {}".format(frames))
+    return False
+
+def main():
+    parser = argparse.ArgumentParser(description='Check oscreplay frame timings against expected traces')
+    parser.add_argument('--replay', default='./oscreplay', help='oscreplay binary to test')
+    args = parser.parse_args()
+
+    failed = 0
+    for name, packets, tail_ms, expected in CASES:
+        if not run_case(args.replay, name, packets, tail_ms, expected):
+            failed += 1
+    print("{} of {} cases passed".format(len(CASES) - failed, len(CASES)))
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
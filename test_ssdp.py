@@ -10,7 +10,7 @@ import time
 import argparse
 from urllib.parse import urlparse
 
-def discover_ssdp_services(duration=10):
+def discover_ssdp_services(duration=10, search=False):
     """Discover SSDP services on the network"""
     if duration == 0:
         print("Discovering SSDP services forever...".format(duration))
@@ -31,6 +31,9 @@ def discover_ssdp_services(duration=10):
     
     # Set timeout
     sock.settimeout(1.0)
+
+    if search:
+        send_msearch(sock, mcast_group)
     
     discovered_services = []
     start_time = time.time()
@@ -56,6 +59,13 @@ def discover_ssdp_services(duration=10):
                         print_discovered_service(addr, service_info)
                         discovered_services.append(service_info)
                 
+                elif method.startswith('HTTP/1.1 200'):
+                    service_info = parse_ssdp_message(lines)
+                    if service_info and 'OSC' in service_info.get('ST', ''):
+                        service_info['NT'] = service_info.get('ST', '')
+                        print_discovered_service(addr, service_info)
+                        discovered_services.append(service_info)
+
                 elif 'M-SEARCH' in method:
                     print("📡 M-SEARCH request from {}:{}".format(addr[0], addr[1]))
                     
@@ -72,6 +82,17 @@ def discover_ssdp_services(duration=10):
     
     return discovered_services
 
+def send_msearch(sock, mcast_group, mx=1):
+    """Multicast an M-SEARCH for OSC cue lights; responders reply unicast"""
+    message = ('M-SEARCH * HTTP/1.1\r\n'
+               'HOST: {}:1901\r\n'
+               'MAN: "ssdp:discover"\r\n'
+               'MX: {}\r\n'
+               'ST: urn:schemas-upnp-org:service:OSC_CUE:1\r\n'
+               '\r\n').format(mcast_group, mx)
+    sock.sendto(message.encode('utf-8'), (mcast_group, 1901))
+    print("📡 M-SEARCH sent")
+
 def parse_ssdp_message(lines):
     """Parse SSDP message lines into service info dict"""
     service_info = {}
@@ -127,6 +148,8 @@ def main():
                        help='Enable verbose output')
     parser.add_argument('--test-connection', action='store_true',
                        help='Test OSC connection to discovered services')
+    parser.add_argument('-s', '--search', action='store_true',
+                       help='Send an M-SEARCH instead of waiting for periodic NOTIFYs')
     
     args = parser.parse_args()
     
@@ -134,7 +157,7 @@ def main():
     print("=" * 50)
     
     # Discover services
-    services = discover_ssdp_services(args.duration)
+    services = discover_ssdp_services(args.duration, args.search)
     
     if not services:
         print("\n❌ No OSC services discovered")
@@ -0,0 +1,29 @@
+#include "timebase.h"
+#include <time.h>
+
+static bool s_virtual;
+static uint64_t s_virtual_ns;
+
+uint64_t timebase_now_ns(void) {
+    if (s_virtual) {
+        return s_virtual_ns;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void timebase_use_virtual(uint64_t start_ns) {
+    s_virtual = true;
+    s_virtual_ns = start_ns;
+}
+
+void timebase_advance_to(uint64_t now_ns) {
+    if (s_virtual && now_ns > s_virtual_ns) {
+        s_virtual_ns = now_ns;
+    }
+}
+
+bool timebase_is_virtual(void) {
+    return s_virtual;
+}
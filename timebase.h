@@ -0,0 +1,25 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+/*
+ * The one clock behind every timer and animation in the server: render and blink deadlines,
+ * fades, status and SSDP/mDNS cadence, rate-limit buckets, lane delays and DMX timeouts.
+ * It reads CLOCK_MONOTONIC unless a virtual clock is installed, in which case time stands
+ * still until the caller moves it, so a replay can run hours of schedule in milliseconds
+ * with exactly repeatable frame times.
+ *
+ * Device I/O timing (libslicky pacing and led.c health) stays on the real clock: it measures
+ * the hardware, not the schedule. The virtual clock is meant for single-threaded drivers.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NS_PER_SEC 1000000000u
+
+uint64_t timebase_now_ns(void);
+void timebase_use_virtual(uint64_t start_ns);
+void timebase_advance_to(uint64_t now_ns); /* Virtual clock only; never moves backwards */
+bool timebase_is_virtual(void);
+
+#endif /* TIMEBASE_H */
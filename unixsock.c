@@ -0,0 +1,278 @@
+#define _GNU_SOURCE /* struct ucred, recvmmsg */
+#include "unixsock.h"
+#include "settings.h"
+#include "state.h"
+#include "zone.h"
+#include "alog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define UNIX_MAX_CLIENTS 8
+#define UNIX_BATCH 32       /* Packets taken per receive call */
+#define UNIX_PACKET_MAX 2048
+
+typedef struct {
+    int fd;
+    uid_t uid;
+    pid_t pid;
+    unsigned reply_zones; /* Zones to report back once this pass's messages are applied */
+} unix_client_t;
+
+static int s_listen_fd = -1;
+static char s_path[108];
+static unix_client_t s_clients[UNIX_MAX_CLIENTS];
+static char s_bufs[UNIX_BATCH][UNIX_PACKET_MAX];
+
+/* Returns false if the peer could not be identified. */
+static bool peer_credentials(int fd, uid_t *uid, pid_t *pid) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        return false;
+    }
+    *uid = cred.uid;
+    *pid = cred.pid;
+    return true;
+#else
+    gid_t gid;
+    *pid = 0;
+    return getpeereid(fd, uid, &gid) == 0;
+#endif
+}
+
+/* unix_allow lists the uids that may connect; empty means our own user and root. */
+static bool uid_allowed(uid_t uid) {
+    const char *list = settings()->unix_allow;
+
+    if (list[0] == '\0') {
+        return uid == geteuid() || uid == 0;
+    }
+    while (*list != '\0') {
+        char *end;
+        unsigned long v = strtoul(list, &end, 10);
+        if (end != list && v == (unsigned long)uid) {
+            return true;
+        }
+        list = end != list ? end : list + 1;
+        while (*list == ',' || *list == ' ') list++;
+    }
+    return false;
+}
+
+void unixsock_init(void) {
+    const char *path = settings()->unix_socket;
+    struct sockaddr_un sun;
+
+    for (int i = 0; i < UNIX_MAX_CLIENTS; i++) {
+        s_clients[i].fd = -1;
+    }
+    if (path[0] == '\0') {
+        return;
+    }
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        log_error("unix: socket path %s is too long", path);
+        return;
+    }
+    s_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (s_listen_fd < 0) {
+        log_error("unix: cannot create socket: %s", strerror(errno));
+        return;
+    }
+    fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    unlink(path);
+    if (bind(s_listen_fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(s_listen_fd, UNIX_MAX_CLIENTS) < 0) {
+        log_error("unix: cannot listen on %s: %s", path, strerror(errno));
+        close(s_listen_fd);
+        s_listen_fd = -1;
+        return;
+    }
+    /* Group members may connect at the file level; SO_PEERCRED then decides. */
+    chmod(path, 0660);
+    snprintf(s_path, sizeof(s_path), "%s", path);
+    log_info("unix: OSC on %s", path);
+}
+
+/* Clients are polled even without a listener: they outlive a path change or a failed rebind. */
+void unixsock_fill_fdset(fd_set *set, int *max_fd) {
+    if (s_listen_fd >= 0) {
+        FD_SET(s_listen_fd, set);
+        if (s_listen_fd > *max_fd) *max_fd = s_listen_fd;
+    }
+    for (int i = 0; i < UNIX_MAX_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0) {
+            FD_SET(s_clients[i].fd, set);
+            if (s_clients[i].fd > *max_fd) *max_fd = s_clients[i].fd;
+        }
+    }
+}
+
+static void drop_client(unix_client_t *c) {
+    log_info("unix: client uid %u pid %d disconnected", (unsigned)c->uid, (int)c->pid);
+    close(c->fd);
+    c->fd = -1;
+    c->reply_zones = 0;
+}
+
+static void accept_clients(void) {
+    int fd;
+
+    while ((fd = accept(s_listen_fd, NULL, NULL)) >= 0) {
+        uid_t uid;
+        pid_t pid;
+        int slot;
+        if (!peer_credentials(fd, &uid, &pid)) {
+            log_warn("unix: refusing client without credentials");
+            close(fd);
+            continue;
+        }
+        if (!uid_allowed(uid)) {
+            log_warn("unix: refusing client uid %u pid %d", (unsigned)uid, (int)pid);
+            close(fd);
+            continue;
+        }
+        for (slot = 0; slot < UNIX_MAX_CLIENTS && s_clients[slot].fd >= 0; slot++) { }
+        if (slot == UNIX_MAX_CLIENTS) {
+            log_warn("unix: too many clients, refusing uid %u", (unsigned)uid);
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        s_clients[slot].fd = fd;
+        s_clients[slot].uid = uid;
+        s_clients[slot].pid = pid;
+        s_clients[slot].reply_zones = 0;
+        log_info("unix: client uid %u pid %d connected", (unsigned)uid, (int)pid);
+    }
+}
+
+/* Fills s_bufs with up to UNIX_BATCH packets; returns the count, 0 when drained, -1 on hangup. */
+static int receive_batch(int fd, int lens[UNIX_BATCH]) {
+#ifdef __linux__
+    struct mmsghdr msgs[UNIX_BATCH];
+    struct iovec iov[UNIX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < UNIX_BATCH; i++) {
+        iov[i].iov_base = s_bufs[i];
+        iov[i].iov_len = UNIX_PACKET_MAX;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(fd, msgs, UNIX_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        /* A zero-length message in the batch is how SEQPACKET reports the peer hanging up. */
+        if (msgs[i].msg_len == 0) {
+            return i > 0 ? i : -1;
+        }
+        lens[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : (int)msgs[i].msg_len;
+    }
+    return n == 0 ? -1 : n;
+#else
+    int n = 0;
+    while (n < UNIX_BATCH) {
+        ssize_t len = recv(fd, s_bufs[n], UNIX_PACKET_MAX, MSG_DONTWAIT);
+        if (len == 0) {
+            return n > 0 ? n : -1;
+        }
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            return n > 0 ? n : -1;
+        }
+        lens[n++] = (int)len;
+    }
+    return n;
+#endif
+}
+
+/* Each client's queued packets are taken a batch at a time and go through the same path as UDP,
+   routed as if they had arrived on the main port. */
+void unixsock_handle(fd_set *set, unixsock_packet_fn fn, void *ctx) {
+    int lens[UNIX_BATCH];
+
+    if (s_listen_fd >= 0 && FD_ISSET(s_listen_fd, set)) {
+        accept_clients();
+    }
+    for (int i = 0; i < UNIX_MAX_CLIENTS; i++) {
+        unix_client_t *c = &s_clients[i];
+        if (c->fd < 0 || !FD_ISSET(c->fd, set)) {
+            continue;
+        }
+        int n;
+        while ((n = receive_batch(c->fd, lens)) > 0) {
+            for (int k = 0; k < n; k++) {
+                if (lens[k] > 0) {
+                    c->reply_zones |= fn(s_bufs[k], lens[k], ctx);
+                }
+            }
+            if (n < UNIX_BATCH) {
+                break;
+            }
+        }
+        if (n < 0) {
+            drop_client(c);
+        }
+    }
+}
+
+/* Status goes back over the client's own connection, once per pass however many packets it sent. */
+void unixsock_send_replies(bool debug) {
+    for (int i = 0; i < UNIX_MAX_CLIENTS; i++) {
+        unix_client_t *c = &s_clients[i];
+        if (c->fd < 0 || c->reply_zones == 0) {
+            continue;
+        }
+        for (int z = 0; z < zone_count(); z++) {
+            if (c->reply_zones & (1u << z)) {
+                state_send_osc_status(zone_get(z), c->fd, NULL, 0, debug);
+            }
+        }
+        c->reply_zones = 0;
+    }
+}
+
+/* Connected clients stay; a new path or allow list applies to new connections. */
+void unixsock_settings_changed(void) {
+    if (strcmp(s_path, settings()->unix_socket) != 0) {
+        if (s_listen_fd >= 0) {
+            close(s_listen_fd);
+            unlink(s_path);
+            s_listen_fd = -1;
+            s_path[0] = '\0';
+        }
+        unix_client_t keep[UNIX_MAX_CLIENTS];
+        memcpy(keep, s_clients, sizeof(keep));
+        unixsock_init();
+        memcpy(s_clients, keep, sizeof(keep));
+    }
+}
+
+void unixsock_shutdown(void) {
+    for (int i = 0; i < UNIX_MAX_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0) {
+            close(s_clients[i].fd);
+            s_clients[i].fd = -1;
+        }
+    }
+    if (s_listen_fd >= 0) {
+        close(s_listen_fd);
+        unlink(s_path);
+        s_listen_fd = -1;
+        s_path[0] = '\0';
+    }
+}
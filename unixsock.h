@@ -0,0 +1,17 @@
+#ifndef UNIXSOCK_H
+#define UNIXSOCK_H
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+/* Handles one OSC packet from a local client and returns the zones it addressed. */
+typedef unsigned (*unixsock_packet_fn)(char *buffer, int len, void *ctx);
+
+void unixsock_init(void);
+void unixsock_fill_fdset(fd_set *set, int *max_fd);
+void unixsock_handle(fd_set *set, unixsock_packet_fn fn, void *ctx);
+void unixsock_send_replies(bool debug);
+void unixsock_settings_changed(void);
+void unixsock_shutdown(void);
+
+#endif /* UNIXSOCK_H */
@@ -0,0 +1,196 @@
+#include "zone.h"
+#include "alog.h"
+#include <stdio.h>
+#include <string.h>
+
+static zone_t s_zones[ZONE_MAX];
+static int s_count;
+static int s_default_port;
+
+static void bind_zone_devices(zone_t *z, const zone_def_t *def) {
+    char list[sizeof(def->devices)];
+
+    z->led_count = 0;
+    snprintf(list, sizeof(list), "%s", def != NULL && def->devices[0] != '\0' ? def->devices : settings()->device);
+    if (list[0] == '\0') {
+        z->leds[z->led_count++] = led_open("");
+        return;
+    }
+    char *save = NULL;
+    for (char *serial = strtok_r(list, ", ", &save); serial != NULL; serial = strtok_r(NULL, ", ", &save)) {
+        if (z->led_count == ZONE_MAX_DEVICES) {
+            log_warn("zone %s: more than %d devices, ignoring %s", z->name, ZONE_MAX_DEVICES, serial);
+            continue;
+        }
+        int handle = led_open(serial);
+        if (handle >= 0) {
+            z->leds[z->led_count++] = handle;
+        }
+    }
+}
+
+static const zone_def_t *zone_def(const zone_t *z) {
+    const settings_t *cfg = settings();
+    for (int i = 0; i < cfg->zone_count; i++) {
+        if (strcmp(cfg->zones[i].name, z->name) == 0) {
+            return &cfg->zones[i];
+        }
+    }
+    return NULL;
+}
+
+static void map_dmx(zone_t *z, const zone_def_t *def) {
+    const settings_t *cfg = settings();
+    z->dmx_universe = def != NULL ? def->universe : cfg->dmx_universe;
+    z->dmx_channel = def != NULL ? def->channel : cfg->dmx_channel;
+    z->dmx_color = -1;
+}
+
+static zone_t *add_zone(const char *name, int port, const char *prefix) {
+    for (int i = 0; i < s_count; i++) {
+        if (s_zones[i].port == port && strcmp(s_zones[i].prefix, prefix) == 0) {
+            log_warn("zone %s: port %d prefix '%s' already belongs to zone %s, skipping", name, port, prefix,
+                     s_zones[i].name);
+            return NULL;
+        }
+    }
+
+    zone_t *z = &s_zones[s_count];
+    memset(z, 0, sizeof(*z));
+    snprintf(z->name, sizeof(z->name), "%s", name);
+    snprintf(z->prefix, sizeof(z->prefix), "%s", prefix);
+    z->index = s_count;
+    z->port = port;
+    z->prefix_len = strlen(z->prefix);
+    z->fd = -1;
+    z->blink_on_change = true;
+    s_count++;
+    return z;
+}
+
+/* Without zone.* settings there is a single zone that behaves exactly like the old single-light server. */
+void zone_init(int default_port) {
+    const settings_t *cfg = settings();
+
+    s_count = 0;
+    s_default_port = default_port;
+    for (int i = 0; i < cfg->zone_count; i++) {
+        const zone_def_t *def = &cfg->zones[i];
+        zone_t *z = add_zone(def->name, def->port != 0 ? def->port : default_port, def->prefix);
+        if (z != NULL) {
+            bind_zone_devices(z, def);
+            map_dmx(z, def);
+            log_info("zone %s: port %d, prefix '%s', %d device(s)", z->name, z->port, z->prefix, z->led_count);
+        }
+    }
+    if (s_count == 0) {
+        zone_t *z = add_zone("default", default_port, "");
+        bind_zone_devices(z, NULL);
+        map_dmx(z, NULL);
+    }
+}
+
+int zone_count(void) { return s_count; }
+
+zone_t *zone_get(int index) {
+    return index >= 0 && index < s_count ? &s_zones[index] : NULL;
+}
+
+zone_t *zone_find(const char *name) {
+    for (int i = 0; i < s_count; i++) {
+        if (strcmp(s_zones[i].name, name) == 0) {
+            return &s_zones[i];
+        }
+    }
+    return NULL;
+}
+
+/* Longest prefix on the receiving port wins; a prefix only matches whole address segments. */
+zone_t *zone_route(int port, const char *address) {
+    zone_t *best = NULL;
+
+    if (port == 0) {
+        port = s_default_port;
+    }
+    for (int i = 0; i < s_count; i++) {
+        zone_t *z = &s_zones[i];
+        if (z->port != port || (best != NULL && best->prefix_len >= z->prefix_len)) {
+            continue;
+        }
+        if (z->prefix_len == 0 ||
+            (strncmp(address, z->prefix, z->prefix_len) == 0 && address[z->prefix_len] == '/')) {
+            best = z;
+        }
+    }
+    return best;
+}
+
+/* Reopens every zone's lights, e.g. after a device list changed. */
+void zone_bind_devices(void) {
+    led_close_all();
+    for (int i = 0; i < s_count; i++) {
+        bind_zone_devices(&s_zones[i], zone_def(&s_zones[i]));
+        s_zones[i].output_valid = false;
+    }
+}
+
+#define GROUP_PREFIX "/group/"
+#define GROUP_ALL "all" /* Every server is a member */
+
+/* Membership is read from the settings on each call, so edits to `groups` apply live. */
+static bool group_member(const char *name, size_t len) {
+    const char *list = settings()->groups;
+
+    if (len == strlen(GROUP_ALL) && strncmp(name, GROUP_ALL, len) == 0) {
+        return true;
+    }
+    while (*list != '\0') {
+        while (*list == ',' || *list == ' ') list++;
+        size_t n = strcspn(list, ", ");
+        if (n == len && n > 0 && strncmp(list, name, len) == 0) {
+            return true;
+        }
+        list += n;
+    }
+    return false;
+}
+
+/* Returns the address with /group/<name> removed, the address itself if it names no group, or
+   NULL if this server is not in the group. Applies to every input, not only the multicast one. */
+const char *zone_strip_group(const char *address) {
+    size_t plen = strlen(GROUP_PREFIX);
+
+    if (strncmp(address, GROUP_PREFIX, plen) != 0) {
+        return address;
+    }
+    const char *name = address + plen;
+    const char *rest = strchr(name, '/');
+    if (rest == NULL || !group_member(name, (size_t)(rest - name))) {
+        return NULL;
+    }
+    return rest;
+}
+
+/* Device lists and DMX mappings apply live; ports, prefixes and the set of zones need a restart since listeners and
+   saved state are keyed by them. */
+void zone_settings_changed(const settings_t *old) {
+    const settings_t *cfg = settings();
+    bool layout = cfg->zone_count != old->zone_count;
+    bool devices = strcmp(cfg->device, old->device) != 0;
+
+    for (int i = 0; i < cfg->zone_count && !layout; i++) {
+        const zone_def_t *a = &cfg->zones[i];
+        const zone_def_t *b = &old->zones[i];
+        layout = strcmp(a->name, b->name) != 0 || a->port != b->port || strcmp(a->prefix, b->prefix) != 0;
+        devices = devices || strcmp(a->devices, b->devices) != 0;
+    }
+    if (layout) {
+        log_warn("config: zone names, ports and prefixes take effect on restart");
+    }
+    if (devices) {
+        zone_bind_devices();
+    }
+    for (int i = 0; i < s_count; i++) {
+        map_dmx(&s_zones[i], zone_def(&s_zones[i]));
+    }
+}
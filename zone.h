@@ -0,0 +1,64 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include "config.h"
+#include "blink.h"
+#include "led.h"
+#include "pattern.h"
+#include "settings.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define ZONE_MAX_DEVICES 4
+
+/* A zone is one independently controlled look: its own color, blink and pattern state,
+   its own lights, and its own status subscriber. Zones are told apart by the UDP port a
+   message arrives on and by an optional OSC address prefix. */
+typedef struct zone {
+    char name[ZONE_NAME_MAX];
+    int index;
+    int port;
+    char prefix[32];
+    size_t prefix_len;
+    int fd;                    /* Listener the zone's messages arrive on; replies go out through it */
+    int leds[ZONE_MAX_DEVICES];
+    int led_count;
+
+    int color;
+    bool blink_on_change;
+    bool blinking;             /* Endless blink that is part of the look */
+    uint32_t blink_period_ms;  /* Its period and lit percentage; 0 for the defaults */
+    uint8_t blink_duty;
+    blink_t blink;             /* What is blinking now: the look's blink or a counted one */
+    uint64_t next_frame_ns;
+    pattern_t pattern;
+    color_rgb_t fade_from;     /* Scene recall crossfade; fade_ns is 0 when none is running */
+    uint64_t fade_start_ns;
+    uint64_t fade_ns;
+    int32_t dither_err[3];     /* 16-bit remainder carried into the next frame, per channel */
+    color_rgb_t output_color;
+    uint64_t output_ns;
+    bool output_valid;
+    bool output_pending;       /* A newer frame is waiting for the lights to accept another write */
+
+    int dmx_universe;          /* 0 when the zone takes no DMX */
+    int dmx_channel;
+    int dmx_color;             /* Last color taken from DMX, -1 before the first frame */
+
+    struct sockaddr_in status_peer;
+    bool have_status_peer;
+    uint64_t last_status_ns;
+} zone_t;
+
+void zone_init(int default_port);
+int zone_count(void);
+zone_t *zone_get(int index);
+zone_t *zone_find(const char *name);
+zone_t *zone_route(int port, const char *address);
+const char *zone_strip_group(const char *address);
+void zone_bind_devices(void);
+void zone_settings_changed(const settings_t *old);
+
+#endif /* ZONE_H */